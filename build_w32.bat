@@ -256,6 +256,7 @@ if exist %OUTDIR%\link.sc del %OUTDIR%\link.sc
 
 call :Compile src/ar
 call :Compile src/arscan
+call :Compile src/cache
 call :Compile src/commands
 call :Compile src/default
 call :Compile src/dir
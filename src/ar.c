@@ -70,17 +70,234 @@ ar_parse_name (const char *name, char **arname_p, char **memname_p)
 }
 
 
-/* This function is called by 'ar_scan' to find which member to look at.  */
+/* An index of the members of an archive, so that finding the date of a
+   member or globbing over them doesn't read the whole archive each time.
+   An index is rebuilt when the modtime or size of the archive changes.  */
+
+struct ar_member
+  {
+    const char *name;           /* Name as it appears in the archive.  */
+    intmax_t date;
+    unsigned int truncated:1;   /* NAME might be truncated.  */
+  };
+
+struct ar_index
+  {
+    const char *name;           /* Name of the archive.  */
+    FILE_TIMESTAMP mtime;
+    off_t size;
+    intmax_t status;            /* What ar_scan returned.  */
+    struct ar_member *members;  /* In the order of the archive.  */
+    unsigned int count;
+    unsigned int max;
+    unsigned int truncated;     /* Number of truncated member names.  */
+    struct hash_table table;    /* Members with a date, by name.  */
+  };
+
+static struct hash_table ar_indexes;
+
+static unsigned long
+ar_index_hash_1 (const void *key)
+{
+  return_STRING_HASH_1 (((const struct ar_index *) key)->name);
+}
+
+static unsigned long
+ar_index_hash_2 (const void *key)
+{
+  return_STRING_HASH_2 (((const struct ar_index *) key)->name);
+}
+
+static int
+ar_index_hash_cmp (const void *x, const void *y)
+{
+  return_STRING_COMPARE (((const struct ar_index *) x)->name,
+                         ((const struct ar_index *) y)->name);
+}
+
+static unsigned long
+ar_member_hash_1 (const void *key)
+{
+  return_STRING_HASH_1 (((const struct ar_member *) key)->name);
+}
+
+static unsigned long
+ar_member_hash_2 (const void *key)
+{
+  return_STRING_HASH_2 (((const struct ar_member *) key)->name);
+}
+
+static int
+ar_member_hash_cmp (const void *x, const void *y)
+{
+  return_STRING_COMPARE (((const struct ar_member *) x)->name,
+                         ((const struct ar_member *) y)->name);
+}
+
+/* This function is called by 'ar_scan' to add each member to an index.  */
 
 /* ARGSUSED */
 static intmax_t
-ar_member_date_1 (int desc UNUSED, const char *mem, int truncated,
-                  long int hdrpos UNUSED, long int datapos UNUSED,
-                  long int size UNUSED, intmax_t date,
-                  int uid UNUSED, int gid UNUSED, unsigned int mode UNUSED,
-                  const void *name)
+ar_index_member (int desc UNUSED, const char *mem, int truncated,
+                 long int hdrpos UNUSED, long int datapos UNUSED,
+                 long int size UNUSED, intmax_t date,
+                 int uid UNUSED, int gid UNUSED, unsigned int mode UNUSED,
+                 const void *arg)
+{
+  struct ar_index *idx = (struct ar_index *) arg;
+  struct ar_member *m;
+
+  if (idx->count == idx->max)
+    {
+      idx->max = idx->max ? idx->max * 2 : 32;
+      idx->members = xrealloc (idx->members,
+                               idx->max * sizeof (struct ar_member));
+    }
+
+  m = &idx->members[idx->count++];
+  m->name = strcache_add (mem);
+  m->date = date;
+  /* ar_name_equal compares at most the first 14 or 15 characters of a
+     name that might be truncated, so a shorter name only matches whole.  */
+  m->truncated = truncated && strlen (mem) >= 14;
+  idx->truncated += m->truncated;
+
+  return 0;
+}
+
+static void
+ar_clear_index (struct ar_index *idx)
+{
+  if (idx->table.ht_vec)
+    hash_free (&idx->table, 0);
+  free (idx->members);
+  idx->members = 0;
+  idx->count = idx->max = idx->truncated = 0;
+}
+
+/* Return the index of archive ARNAME, reading the archive if it has changed
+   since we last looked.  Return NULL if ARNAME doesn't exist.  */
+
+static struct ar_index *
+ar_get_index (const char *arname)
+{
+  struct ar_index key;
+  struct ar_index **slot;
+  struct ar_index *idx;
+  struct stat st;
+  unsigned int i;
+  int r;
+
+  EINTRLOOP (r, stat (arname, &st));
+  if (r < 0)
+    return 0;
+
+  if (ar_indexes.ht_vec == NULL)
+    hash_init (&ar_indexes, 16, ar_index_hash_1, ar_index_hash_2,
+               ar_index_hash_cmp);
+
+  key.name = arname;
+  slot = (struct ar_index **) hash_find_slot (&ar_indexes, &key);
+  idx = *slot;
+  if (!HASH_VACANT (idx))
+    {
+      if (idx->mtime == FILE_TIMESTAMP_STAT_MODTIME (arname, st)
+          && idx->size == st.st_size)
+        return idx;
+      ar_clear_index (idx);
+    }
+  else
+    {
+      idx = xcalloc (sizeof (struct ar_index));
+      idx->name = strcache_add (arname);
+      hash_insert_at (&ar_indexes, idx, slot);
+    }
+
+  /* If the archive changes while we read it, its new modtime will make us
+     read it again next time.  */
+  idx->mtime = FILE_TIMESTAMP_STAT_MODTIME (arname, st);
+  idx->size = st.st_size;
+  idx->status = ar_scan (arname, ar_index_member, idx);
+
+  /* ar_scan stops at the first member with this name and a date, so that
+     is the one to remember.  */
+  hash_init (&idx->table, idx->count, ar_member_hash_1, ar_member_hash_2,
+             ar_member_hash_cmp);
+  for (i = 0; i < idx->count; ++i)
+    if (idx->members[i].date != 0)
+      {
+        void **mslot = hash_find_slot (&idx->table, &idx->members[i]);
+        if (HASH_VACANT (*mslot))
+          hash_insert_at (&idx->table, &idx->members[i], mslot);
+      }
+
+  return idx;
+}
+
+/* Find the first member of IDX that has a date and matches NAME according
+   to ar_name_equal, or NULL if there is none.  */
+
+static const struct ar_member *
+ar_find_member (struct ar_index *idx, const char *name)
 {
-  return ar_name_equal (name, mem, truncated) ? date : 0;
+  const struct ar_member *found;
+  unsigned int i;
+#if !MK_OS_VMS
+  struct ar_member key;
+  const struct ar_member *m;
+  const char *p;
+
+  key.name = name;
+  found = hash_find_item (&idx->table, &key);
+
+  p = strrchr (name, '/');
+  if (p != 0)
+    {
+      key.name = p + 1;
+      m = hash_find_item (&idx->table, &key);
+      if (m != 0 && (found == 0 || m < found))
+        found = m;
+    }
+
+  if (idx->truncated == 0)
+    return found;
+#else
+  /* Member names are matched without case or suffix; just look at each.  */
+  found = 0;
+#endif
+
+  for (i = 0; i < idx->count; ++i)
+    {
+      const struct ar_member *mem = &idx->members[i];
+      if (found != 0 && mem >= found)
+        break;
+      if (mem->date != 0 && ar_name_equal (name, mem->name, mem->truncated))
+        return mem;
+    }
+
+  return found;
+}
+
+/* Forget what we know about the members of archive ARNAME.  */
+
+void
+ar_forget (const char *arname)
+{
+  struct ar_index key;
+  struct ar_index **slot;
+
+  if (ar_indexes.ht_vec == NULL)
+    return;
+
+  key.name = arname;
+  slot = (struct ar_index **) hash_find_slot (&ar_indexes, &key);
+  if (!HASH_VACANT (*slot))
+    {
+      struct ar_index *idx = *slot;
+      hash_delete_at (&ar_indexes, slot);
+      ar_clear_index (idx);
+      free (idx);
+    }
 }
 
 /* Return the modtime of NAME.  */
@@ -90,6 +307,7 @@ ar_member_date (const char *name)
 {
   char *arname;
   char *memname;
+  struct ar_index *idx;
   intmax_t val;
 
   ar_parse_name (name, &arname, &memname);
@@ -111,13 +329,45 @@ ar_member_date (const char *name)
       (void) f_mtime (arfile, 0);
   }
 
-  val = ar_scan (arname, ar_member_date_1, memname);
+  idx = ar_get_index (arname);
+  if (idx == 0)
+    val = -1;
+  else if (idx->status != 0)
+    val = idx->status;
+  else
+    {
+      const struct ar_member *m = ar_find_member (idx, memname);
+      val = m ? m->date : 0;
+    }
 
   free (arname);
 
   return 0 < val && val <= TYPE_MAXIMUM (time_t) ? val : -1;
 }
-
+
+/* Print the memory used by the archive indexes for --memory-stats.  */
+
+void
+print_ar_memory_stats (void)
+{
+  unsigned long members = 0;
+  unsigned long bytes = hash_memory_size (&ar_indexes);
+  struct ar_index **slot;
+  struct ar_index **end = (struct ar_index **) ar_indexes.ht_vec
+                          + ar_indexes.ht_size;
+
+  for (slot = (struct ar_index **) ar_indexes.ht_vec; slot < end; ++slot)
+    if (!HASH_VACANT (*slot))
+      {
+        members += (*slot)->count;
+        bytes += sizeof (struct ar_index)
+                 + (*slot)->max * sizeof (struct ar_member)
+                 + hash_memory_size (&(*slot)->table);
+      }
+
+  print_memory_usage (_("archive members"), members, bytes);
+}
+
 /* Set the archive-member NAME's modtime to now.  */
 
 #if MK_OS_VMS
@@ -168,6 +418,9 @@ ar_touch (const char *name)
           _("touch: bad return code from ar_member_touch on '%s'"), name);
     }
 
+  /* Whether or not that worked, the archive may have changed.  */
+  ar_forget (arname);
+
   free (arname);
 
   return val;
@@ -195,21 +448,15 @@ struct ar_glob_state
     unsigned int n;
   };
 
-/* This function is called by 'ar_scan' to match one archive
-   element against the pattern in STATE.  */
+/* Match one archive member MEM against the pattern in STATE.  */
 
-static intmax_t
-ar_glob_match (int desc UNUSED, const char *mem, int truncated UNUSED,
-               long int hdrpos UNUSED, long int datapos UNUSED,
-               long int size UNUSED, intmax_t date UNUSED, int uid UNUSED,
-               int gid UNUSED, unsigned int mode UNUSED, const void *arg)
+static void
+ar_glob_match (struct ar_glob_state *state, const char *mem)
 {
-  struct ar_glob_state *state = (struct ar_glob_state *)arg;
-
   if (fnmatch (state->pattern, mem, FNM_PATHNAME|FNM_PERIOD) == 0)
     {
       /* We have a match.  Add it to the chain.  */
-      struct nameseq *new = xcalloc (state->size);
+      struct nameseq *new = alloc_ns ();
 #if MK_OS_VMS
       if (state->suffix)
         new->name = strcache_add(
@@ -221,8 +468,6 @@ ar_glob_match (int desc UNUSED, const char *mem, int truncated UNUSED,
       state->chain = new;
       ++state->n;
     }
-
-  return 0;
 }
 
 /* Return nonzero if PATTERN contains any metacharacters.
@@ -265,6 +510,7 @@ struct nameseq *
 ar_glob (const char *arname, const char *member_pattern, size_t size)
 {
   struct ar_glob_state state;
+  struct ar_index *idx;
   struct nameseq *n;
   const char **names;
   unsigned int i;
@@ -274,7 +520,7 @@ ar_glob (const char *arname, const char *member_pattern, size_t size)
   if (! ar_glob_pattern_p (member_pattern, 1))
     return 0;
 
-  /* Scan the archive for matches.
+  /* Look through the archive's members for matches.
      ar_glob_match will accumulate them in STATE.chain.  */
   state.arname = arname;
   state.pattern = member_pattern;
@@ -297,7 +543,10 @@ ar_glob (const char *arname, const char *member_pattern, size_t size)
   state.size = size;
   state.chain = 0;
   state.n = 0;
-  ar_scan (arname, ar_glob_match, &state);
+  idx = ar_get_index (arname);
+  if (idx != 0)
+    for (i = 0; i < idx->count; ++i)
+      ar_glob_match (&state, idx->members[i].name);
 
 #if MK_OS_VMS
   /* Deallocate any duplicated string */
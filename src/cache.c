@@ -0,0 +1,1275 @@
+/* Cache the outputs of recipes for GNU Make.
+Copyright (C) 2024 Free Software Foundation, Inc.
+This file is part of GNU Make.
+
+GNU Make is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+GNU Make is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Targets listed as prerequisites of .CACHEABLE have their outputs saved in
+   a content-addressed cache directory after they are built successfully.
+   The key for an entry is a SHA-256 digest of the names of the targets, the
+   names and contents of their prerequisites, the fully expanded recipe, and
+   the values of the variables listed in .CACHE_ENV.  When a cacheable target
+   must be remade and an entry with the same key exists, the outputs are
+   copied out of the cache instead of running the recipe.
+
+   Each entry is a directory named by the key, split after the first two hex
+   digits to keep the top-level directory small.  It contains one file per
+   output, named by the position of the output in the rule: "0" for the
+   target itself followed by any grouped or also-made targets.
+
+   A cache directory may be shared by any number of makes on the same host,
+   for example by several checkouts of the same project.  Entries are filled
+   in under a temporary name and published with rename(), so they are never
+   seen incomplete.  The time stamp of an entry records when it was last
+   used, and if .CACHE_SIZE is set the least recently used entries are
+   evicted when make exits.  No locking is needed: if an entry disappears
+   while it is being restored, the recipe is simply run.  */
+
+#include "makeint.h"
+
+#include "cache.h"
+
+#include "filedef.h"
+#include "dep.h"
+#include "variable.h"
+#include "debug.h"
+#include "hash.h"
+
+#include <fcntl.h>
+
+#ifdef HAVE_DIRENT_H
+# include <dirent.h>
+#endif
+#ifdef HAVE_UTIME_H
+# include <utime.h>
+#endif
+#ifdef HAVE_LINUX_FS_H
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+#endif
+
+#if MK_OS_W32
+# include <direct.h>
+# define mkdir(_d, _m)  _mkdir (_d)
+#endif
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+/* Size of the buffer used to read and copy files.  */
+#define CACHE_BUFSIZ    65536
+
+/* Seconds after which a temporary entry is assumed to be abandoned.  */
+#define CACHE_STALE_TIME    3600
+
+/* How outputs are moved between the cache and the build tree.  */
+enum cache_link
+  {
+    cl_copy,            /* Always copy the contents.  */
+    cl_reflink,         /* Share data blocks if possible, else copy.  */
+    cl_hardlink         /* Link to the cached file if possible, else copy.  */
+  };
+
+/* Cache directories we've stored entries in, which may need trimming.  */
+struct cache_root
+  {
+    struct cache_root *next;
+    char *name;
+  };
+
+static struct cache_root *cache_roots = NULL;
+
+/* An entry found while trimming a cache.  */
+struct cache_use
+  {
+    char *name;
+    time_t used;                /* When the entry was last used.  */
+    uintmax_t size;             /* Total size of its outputs.  */
+  };
+
+
+/* A minimal SHA-256 implementation (FIPS 180-4).  */
+
+#define SHA256_DIGEST_SIZE  32
+
+struct sha256
+  {
+    uint32_t state[8];
+    uint64_t length;            /* Bytes hashed so far.  */
+    unsigned char block[64];
+    unsigned int fill;          /* Bytes of BLOCK in use.  */
+  };
+
+static const uint32_t sha256_k[64] =
+  {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+#define ROTR(_x, _n)    (((_x) >> (_n)) | ((_x) << (32 - (_n))))
+
+static void
+sha256_init (struct sha256 *ctx)
+{
+  ctx->state[0] = 0x6a09e667;
+  ctx->state[1] = 0xbb67ae85;
+  ctx->state[2] = 0x3c6ef372;
+  ctx->state[3] = 0xa54ff53a;
+  ctx->state[4] = 0x510e527f;
+  ctx->state[5] = 0x9b05688c;
+  ctx->state[6] = 0x1f83d9ab;
+  ctx->state[7] = 0x5be0cd19;
+  ctx->length = 0;
+  ctx->fill = 0;
+}
+
+static void
+sha256_block (struct sha256 *ctx, const unsigned char *p)
+{
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, h;
+  unsigned int i;
+
+  for (i = 0; i < 16; ++i, p += 4)
+    w[i] = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+           | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+  for (; i < 64; ++i)
+    {
+      uint32_t s0 = ROTR (w[i-15], 7) ^ ROTR (w[i-15], 18) ^ (w[i-15] >> 3);
+      uint32_t s1 = ROTR (w[i-2], 17) ^ ROTR (w[i-2], 19) ^ (w[i-2] >> 10);
+      w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+  a = ctx->state[0];
+  b = ctx->state[1];
+  c = ctx->state[2];
+  d = ctx->state[3];
+  e = ctx->state[4];
+  f = ctx->state[5];
+  g = ctx->state[6];
+  h = ctx->state[7];
+
+  for (i = 0; i < 64; ++i)
+    {
+      uint32_t t1 = h + (ROTR (e, 6) ^ ROTR (e, 11) ^ ROTR (e, 25))
+                    + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+      uint32_t t2 = (ROTR (a, 2) ^ ROTR (a, 13) ^ ROTR (a, 22))
+                    + ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+
+  ctx->state[0] += a;
+  ctx->state[1] += b;
+  ctx->state[2] += c;
+  ctx->state[3] += d;
+  ctx->state[4] += e;
+  ctx->state[5] += f;
+  ctx->state[6] += g;
+  ctx->state[7] += h;
+}
+
+static void
+sha256_update (struct sha256 *ctx, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+
+  ctx->length += len;
+
+  if (ctx->fill)
+    {
+      size_t n = 64 - ctx->fill;
+      if (n > len)
+        n = len;
+      memcpy (ctx->block + ctx->fill, p, n);
+      ctx->fill += (unsigned int) n;
+      p += n;
+      len -= n;
+      if (ctx->fill < 64)
+        return;
+      sha256_block (ctx, ctx->block);
+      ctx->fill = 0;
+    }
+
+  for (; len >= 64; p += 64, len -= 64)
+    sha256_block (ctx, p);
+
+  memcpy (ctx->block, p, len);
+  ctx->fill = (unsigned int) len;
+}
+
+static void
+sha256_final (struct sha256 *ctx, unsigned char *digest)
+{
+  uint64_t bits = ctx->length * 8;
+  unsigned int i;
+
+  ctx->block[ctx->fill++] = 0x80;
+  if (ctx->fill > 56)
+    {
+      memset (ctx->block + ctx->fill, 0, 64 - ctx->fill);
+      sha256_block (ctx, ctx->block);
+      ctx->fill = 0;
+    }
+  memset (ctx->block + ctx->fill, 0, 56 - ctx->fill);
+  for (i = 0; i < 8; ++i)
+    ctx->block[56 + i] = (unsigned char) (bits >> (56 - i * 8));
+  sha256_block (ctx, ctx->block);
+
+  for (i = 0; i < 32; ++i)
+    digest[i] = (unsigned char) (ctx->state[i / 4] >> (24 - (i % 4) * 8));
+}
+
+/* Add a length-prefixed field to CTX, so that adjacent fields can't be
+   confused with one another.  */
+
+static void
+sha256_field (struct sha256 *ctx, const char *str, size_t len)
+{
+  unsigned char prefix[8];
+  unsigned int i;
+
+  for (i = 0; i < 8; ++i)
+    prefix[i] = (unsigned char) ((uint64_t) len >> (56 - i * 8));
+  sha256_update (ctx, prefix, sizeof (prefix));
+  sha256_update (ctx, str, len);
+}
+
+
+/* Prerequisites are often shared by many targets, so remember the digest
+   of each file we've read along with the time stamp and size it had.  */
+
+struct content_digest
+  {
+    const char *name;
+    FILE_TIMESTAMP mtime;
+    off_t size;
+    unsigned char digest[SHA256_DIGEST_SIZE];
+  };
+
+static struct hash_table content_digests;
+
+static unsigned long
+content_digest_hash_1 (const void *key)
+{
+  return_STRING_HASH_1 (((const struct content_digest *) key)->name);
+}
+
+static unsigned long
+content_digest_hash_2 (const void *key)
+{
+  return_STRING_HASH_2 (((const struct content_digest *) key)->name);
+}
+
+static int
+content_digest_hash_cmp (const void *x, const void *y)
+{
+  return_STRING_COMPARE (((const struct content_digest *) x)->name,
+                         ((const struct content_digest *) y)->name);
+}
+
+/* Store the SHA-256 digest of the contents of NAME in DIGEST.
+   Return 0 if NAME is not a regular file we can read.  */
+
+static int
+file_digest (const char *name, unsigned char *digest)
+{
+  struct content_digest key;
+  struct content_digest **slot;
+  struct content_digest *cd;
+  struct sha256 ctx;
+  struct stat st;
+  char *buf;
+  int fd;
+  int r;
+
+  EINTRLOOP (r, stat (name, &st));
+  if (r < 0 || !S_ISREG (st.st_mode))
+    return 0;
+
+  if (content_digests.ht_vec == NULL)
+    hash_init (&content_digests, 256, content_digest_hash_1,
+               content_digest_hash_2, content_digest_hash_cmp);
+
+  key.name = name;
+  slot = (struct content_digest **) hash_find_slot (&content_digests, &key);
+  cd = *slot;
+  if (!HASH_VACANT (cd)
+      && cd->mtime == FILE_TIMESTAMP_STAT_MODTIME (name, st)
+      && cd->size == st.st_size)
+    {
+      memcpy (digest, cd->digest, SHA256_DIGEST_SIZE);
+      return 1;
+    }
+
+  EINTRLOOP (fd, open (name, O_RDONLY | O_BINARY));
+  if (fd < 0)
+    return 0;
+
+  buf = xmalloc (CACHE_BUFSIZ);
+  sha256_init (&ctx);
+  while (1)
+    {
+      ssize_t n;
+      EINTRLOOP (n, read (fd, buf, CACHE_BUFSIZ));
+      if (n <= 0)
+        {
+          r = (int) n;
+          break;
+        }
+      sha256_update (&ctx, buf, n);
+    }
+  free (buf);
+  close (fd);
+
+  if (r < 0)
+    return 0;
+
+  sha256_final (&ctx, digest);
+
+  if (HASH_VACANT (cd))
+    {
+      cd = xmalloc (sizeof (struct content_digest));
+      cd->name = xstrdup (name);
+      hash_insert_at (&content_digests, cd, slot);
+    }
+  cd->mtime = FILE_TIMESTAMP_STAT_MODTIME (name, st);
+  cd->size = st.st_size;
+  memcpy (cd->digest, digest, SHA256_DIGEST_SIZE);
+
+  return 1;
+}
+
+
+/* Return the name of the cache entry with key DIGEST, in the directory given
+   by .CACHE_DIR for FILE (or globally, if FILE is NULL).  The result is
+   allocated.  */
+
+static char *
+entry_name (struct file *file, const unsigned char *digest)
+{
+  static const char hex[] = "0123456789abcdef";
+  const char *p;
+  size_t len;
+  char *dir;
+  char *entry;
+  char *cp;
+  unsigned int i;
+
+  dir = allocated_expand_variable_for_file (STRING_SIZE_TUPLE (".CACHE_DIR"),
+                                            file);
+  p = dir;
+  NEXT_TOKEN (p);
+  if (*p == '\0')
+    p = DEFAULT_CACHE_DIR;
+  len = strlen (p);
+  while (len > 1 && ISBLANK (p[len-1]))
+    --len;
+
+  entry = xmalloc (len + 1 + SHA256_DIGEST_SIZE * 2 + 1 + 1);
+  cp = mempcpy (entry, p, len);
+  *(cp++) = '/';
+  for (i = 0; i < SHA256_DIGEST_SIZE; ++i)
+    {
+      *(cp++) = hex[digest[i] >> 4];
+      *(cp++) = hex[digest[i] & 0xf];
+      if (i == 0)
+        *(cp++) = '/';
+    }
+  *cp = '\0';
+
+  free (dir);
+
+  return entry;
+}
+
+/* Return the name of the cache entry for the outputs of FILE, whose recipe
+   expands to the NLINES lines in LINES.  The result is allocated.
+   Return NULL if FILE is not cacheable.  */
+
+char *
+cache_entry (struct file *file, char **lines, unsigned int nlines)
+{
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  struct sha256 ctx;
+  struct dep *d;
+  const char *p;
+  const char *name;
+  size_t len;
+  char *env;
+  unsigned int i;
+
+  if (!file->cacheable || file->phony
+      || just_print_flag || question_flag || touch_flag)
+    return NULL;
+
+#ifndef NO_ARCHIVES
+  if (ar_name (file->name))
+    return NULL;
+#endif
+
+  sha256_init (&ctx);
+
+  sha256_field (&ctx, file->name, strlen (file->name));
+  for (d = file->also_make; d != NULL; d = d->next)
+    sha256_field (&ctx, d->file->name, strlen (d->file->name));
+
+  for (d = file->deps; d != NULL; d = d->next)
+    {
+      if (d->ignore_mtime)
+        continue;
+
+      name = d->file->name;
+      if (!file_digest (name, digest))
+        {
+          DB (DB_JOBS, (_("Not caching '%s': cannot read prerequisite '%s'.\n"),
+                        file->name, name));
+          return NULL;
+        }
+      sha256_field (&ctx, name, strlen (name));
+      sha256_update (&ctx, digest, SHA256_DIGEST_SIZE);
+    }
+
+  for (i = 0; i < nlines; ++i)
+    sha256_field (&ctx, lines[i], strlen (lines[i]));
+
+  /* Add the values of the selected variables.  An unset variable is
+     distinguished from one with an empty value.  */
+  env = allocated_expand_variable_for_file (STRING_SIZE_TUPLE (".CACHE_ENV"),
+                                            file);
+  p = env;
+  while ((name = find_next_token (&p, &len)) != NULL)
+    {
+      sha256_field (&ctx, name, len);
+      if (lookup_variable_for_file (name, len, file) == NULL)
+        sha256_update (&ctx, "", 1);
+      else
+        {
+          char *value = allocated_expand_variable_for_file (name, len, file);
+          sha256_field (&ctx, value, strlen (value));
+          free (value);
+        }
+    }
+  free (env);
+
+  sha256_final (&ctx, digest);
+
+  return entry_name (file, digest);
+}
+
+/* Return the name NAME in directory DIR.  The result is allocated.  */
+
+static char *
+path_join (const char *dir, const char *name)
+{
+  char *path = xmalloc (strlen (dir) + 1 + strlen (name) + 1);
+  char *cp = stpcpy (path, dir);
+  *(cp++) = '/';
+  strcpy (cp, name);
+  return path;
+}
+
+/* Return the name of output number N in cache entry ENTRY.
+   The result is allocated.  */
+
+static char *
+output_name (const char *entry, unsigned int n)
+{
+  char num[INTSTR_LENGTH + 1];
+  sprintf (num, "%u", n);
+  return path_join (entry, num);
+}
+
+/* Create directory DIR and any missing parents.  Return 0 on success.  */
+
+static int
+make_dirs (char *dir)
+{
+  char *cp;
+  int r;
+
+  for (cp = dir + 1; ; ++cp)
+    if (*cp == '/' || *cp == '\0')
+      {
+        char c = *cp;
+        *cp = '\0';
+        EINTRLOOP (r, mkdir (dir, 0777));
+        *cp = c;
+        if (r < 0 && errno != EEXIST)
+          return -1;
+        if (c == '\0')
+          return 0;
+      }
+}
+
+/* Remove the cache entry, or temporary entry, DIR.  Entries contain only
+   plain files.  */
+
+static void
+remove_tree (const char *dir)
+{
+#ifdef HAVE_DIRENT_H
+  DIR *dp = opendir (dir);
+
+  if (dp != NULL)
+    {
+      struct dirent *de;
+
+      while ((de = readdir (dp)) != NULL)
+        if (de->d_name[0] != '.')
+          {
+            char *name = path_join (dir, de->d_name);
+            unlink (name);
+            free (name);
+          }
+      closedir (dp);
+    }
+#endif
+
+  rmdir (dir);
+}
+
+/* Copy the contents of the file open on IFD to the file open on OFD.
+   Return 0 on success, else -1 with errno set.  */
+
+static int
+copy_contents (int ifd, int ofd)
+{
+  char *buf = xmalloc (CACHE_BUFSIZ);
+  ssize_t n;
+
+  while (1)
+    {
+      const char *p = buf;
+
+      EINTRLOOP (n, read (ifd, buf, CACHE_BUFSIZ));
+      if (n <= 0)
+        break;
+
+      while (n > 0)
+        {
+          ssize_t w;
+          EINTRLOOP (w, write (ofd, p, n));
+          if (w < 0)
+            break;
+          p += w;
+          n -= w;
+        }
+      if (n > 0)
+        {
+          n = -1;
+          break;
+        }
+    }
+
+  free (buf);
+
+  return n < 0 ? -1 : 0;
+}
+
+/* Copy the contents and permissions of FROM to TO, replacing TO.  If REFLINK
+   is nonzero and the file system supports it, share the data blocks of FROM
+   rather than copying them.  Return 0 on success, else -1 with errno set.  */
+
+static int
+copy_file (const char *from, const char *to, int reflink)
+{
+  struct stat st;
+  int ifd, ofd;
+  int r;
+  int err;
+
+  EINTRLOOP (ifd, open (from, O_RDONLY | O_BINARY));
+  if (ifd < 0)
+    return -1;
+
+  EINTRLOOP (r, fstat (ifd, &st));
+  if (r == 0 && unlink (to) < 0 && errno != ENOENT)
+    r = -1;
+  if (r < 0)
+    {
+      err = errno;
+      close (ifd);
+      errno = err;
+      return -1;
+    }
+
+  EINTRLOOP (ofd, open (to, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+                        st.st_mode & 0777));
+  if (ofd < 0)
+    {
+      err = errno;
+      close (ifd);
+      errno = err;
+      return -1;
+    }
+
+#if defined(HAVE_LINUX_FS_H) && defined(FICLONE)
+  if (reflink && ioctl (ofd, FICLONE, ifd) == 0)
+    r = 0;
+  else
+#endif
+    r = copy_contents (ifd, ofd);
+
+  err = errno;
+  close (ifd);
+  if (close (ofd) < 0 && r == 0)
+    {
+      err = errno;
+      r = -1;
+    }
+
+  if (r < 0)
+    {
+      unlink (to);
+      errno = err;
+    }
+
+  return r;
+}
+
+/* Return the way outputs of FILE are moved into and out of the cache.  */
+
+static enum cache_link
+cache_link_mode (struct file *file)
+{
+  enum cache_link mode = cl_reflink;
+  char *value;
+  const char *p;
+  const char *w;
+  size_t len;
+
+  value = allocated_expand_variable_for_file (STRING_SIZE_TUPLE (".CACHE_LINK"),
+                                              file);
+  p = value;
+  w = find_next_token (&p, &len);
+  if (w == NULL || (len == 7 && strneq (w, "reflink", 7)))
+    ;
+  else if (len == 4 && strneq (w, "copy", 4))
+    mode = cl_copy;
+  else if (len == 8 && strneq (w, "hardlink", 8))
+    mode = cl_hardlink;
+  else
+    OS (error, NILF, _("invalid .CACHE_LINK value '%s'"), value);
+
+  free (value);
+
+  return mode;
+}
+
+/* Make TO a copy of FROM, using the method given by MODE if possible.
+   Return 0 on success, else -1 with errno set.  */
+
+static int
+place_file (const char *from, const char *to, enum cache_link mode)
+{
+#if defined(HAVE_LINK) && defined(HAVE_UTIME_H)
+  if (mode == cl_hardlink)
+    {
+      if (unlink (to) < 0 && errno != ENOENT)
+        return -1;
+      if (link (from, to) == 0)
+        {
+          /* The link has the time stamp of the cached file: bring it up to
+             date, so that the target is newer than its prerequisites.  */
+          utime (to, NULL);
+          return 0;
+        }
+      /* Fall back to copying, for example across file systems.  */
+    }
+#endif
+
+  return copy_file (from, to, mode != cl_copy);
+}
+
+/* If cache entry ENTRY holds all the outputs of FILE, copy them into place.
+   Return 1 if the outputs were restored, or 0 if the recipe must be run.  */
+
+int
+cache_restore (struct file *file, const char *entry)
+{
+  enum cache_link mode;
+  struct stat st;
+  struct dep *d;
+  unsigned int n;
+  unsigned int i;
+  char *from;
+  int r;
+
+  /* Entries are published atomically, so if it exists it's complete.  But
+     make sure it has the right number of outputs before touching any
+     targets.  */
+  EINTRLOOP (r, stat (entry, &st));
+  for (n = 0, d = NULL; r == 0 && (n == 0 || d != NULL); ++n)
+    {
+      d = n == 0 ? file->also_make : d->next;
+      from = output_name (entry, n);
+      EINTRLOOP (r, stat (from, &st));
+      free (from);
+    }
+  if (r < 0)
+    {
+      DB (DB_JOBS, (_("No cache entry %s for '%s'.\n"), entry, file->name));
+      return 0;
+    }
+
+  mode = cache_link_mode (file);
+
+  for (i = 0, d = NULL; i < n; ++i)
+    {
+      const char *to = i == 0 ? file->name : d->file->name;
+
+      d = i == 0 ? file->also_make : d->next;
+
+      from = output_name (entry, i);
+      r = place_file (from, to, mode);
+      free (from);
+      if (r < 0)
+        {
+          /* Another make may have evicted the entry while we were using it:
+             just run the recipe.  */
+          if (errno == ENOENT)
+            DB (DB_JOBS, (_("Cache entry %s was removed.\n"), entry));
+          else
+            OSS (error, NILF, _("cannot restore '%s' from cache: %s"),
+                 to, strerror (errno));
+          return 0;
+        }
+    }
+
+#ifdef HAVE_UTIME_H
+  /* Remember when the entry was last used, for eviction.  */
+  utime (entry, NULL);
+#endif
+
+  DB (DB_JOBS, (_("Restored '%s' from cache entry %s.\n"), file->name, entry));
+
+  return 1;
+}
+
+/* Remember that we've stored an entry in the cache containing ENTRY.  */
+
+static void
+record_cache_root (const char *entry)
+{
+  struct cache_root *root;
+  const char *end = strrchr (entry, '/');
+  size_t len;
+
+  /* Strip the two hex digits of the key that name the subdirectory.  */
+  while (end > entry && end[-1] != '/')
+    --end;
+  len = end > entry ? (size_t) (end - entry - 1) : 0;
+
+  for (root = cache_roots; root != NULL; root = root->next)
+    if (strlen (root->name) == len && strneq (root->name, entry, len))
+      return;
+
+  root = xmalloc (sizeof (struct cache_root));
+  root->name = xstrndup (entry, len);
+  root->next = cache_roots;
+  cache_roots = root;
+}
+
+/* Save the outputs of FILE, which has just been remade, in cache entry
+   ENTRY.  If any output is missing, nothing is saved.  */
+
+void
+cache_store (struct file *file, const char *entry)
+{
+  enum cache_link mode;
+  struct stat st;
+  struct dep *d;
+  unsigned int i;
+  char *tmp;
+  int r;
+
+  for (i = 0, d = NULL; i == 0 || d != NULL; ++i)
+    {
+      const char *name = i == 0 ? file->name : d->file->name;
+
+      EINTRLOOP (r, stat (name, &st));
+      if (r < 0 || !S_ISREG (st.st_mode))
+        {
+          DB (DB_JOBS, (_("Not caching '%s': '%s' is not a regular file.\n"),
+                        file->name, name));
+          return;
+        }
+      d = i == 0 ? file->also_make : d->next;
+    }
+
+  /* Another make may have stored the same outputs already.  */
+  EINTRLOOP (r, stat (entry, &st));
+  if (r == 0)
+    return;
+
+  /* Fill in a private directory, then rename it into place so that other
+     makes using the same cache never see a partial entry.  */
+  tmp = xmalloc (strlen (entry) + 1 + INTSTR_LENGTH + 4 + 1);
+  sprintf (tmp, "%s.%ld.tmp", entry, (long) getpid ());
+  if (make_dirs (tmp) < 0)
+    {
+      OSS (error, NILF, _("cannot create cache entry %s: %s"),
+           entry, strerror (errno));
+      free (tmp);
+      return;
+    }
+
+  mode = cache_link_mode (file);
+
+  for (i = 0, d = NULL; i == 0 || d != NULL; ++i)
+    {
+      const char *from = i == 0 ? file->name : d->file->name;
+      char *to;
+
+      d = i == 0 ? file->also_make : d->next;
+
+      to = output_name (tmp, i);
+      r = place_file (from, to, mode);
+      free (to);
+      if (r < 0)
+        {
+          OSS (error, NILF, _("cannot store '%s' in cache: %s"),
+               from, strerror (errno));
+          remove_tree (tmp);
+          free (tmp);
+          return;
+        }
+    }
+
+  if (rename (tmp, entry) < 0)
+    {
+      /* If another make published the entry first, use theirs.  */
+      if (errno != EEXIST && errno != ENOTEMPTY)
+        OSS (error, NILF, _("cannot create cache entry %s: %s"),
+             entry, strerror (errno));
+      remove_tree (tmp);
+    }
+  else
+    {
+      record_cache_root (entry);
+      DB (DB_JOBS, (_("Stored '%s' in cache entry %s.\n"), file->name, entry));
+    }
+
+  free (tmp);
+}
+
+
+/* Return the name of the cache entry for the output of a shell function
+   that runs COMMAND_ARGV with the environment ENVP, and depends on the files
+   listed in INPUTS.  COMMAND is the text of the command, used where no
+   argument vector is built.  The result is allocated.  Return NULL if the
+   output can't be cached.  */
+
+char *
+cache_shell_entry (const char *command, char **command_argv,
+                   const char *inputs, char **envp)
+{
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  struct sha256 ctx;
+  const char *p;
+  const char *name;
+  size_t len;
+  char **env;
+  size_t n;
+  size_t i;
+
+  sha256_init (&ctx);
+
+  /* Keep these entries apart from those holding recipe outputs.  */
+  sha256_field (&ctx, STRING_SIZE_TUPLE ("$(shell)"));
+
+  if (command_argv)
+    for (i = 0; command_argv[i] != NULL; ++i)
+      sha256_field (&ctx, command_argv[i], strlen (command_argv[i]));
+  else
+    sha256_field (&ctx, command, strlen (command));
+
+  if (starting_directory)
+    sha256_field (&ctx, starting_directory, strlen (starting_directory));
+
+  /* The order of the environment depends on how it was built, so sort it.
+     MAKEFLAGS and MFLAGS are left out: they can hold jobserver details that
+     are different for every run.  */
+  for (n = 0; envp[n] != NULL; ++n)
+    ;
+  env = xmalloc ((n + 1) * sizeof (char *));
+  memcpy (env, envp, n * sizeof (char *));
+  qsort (env, n, sizeof (char *), alpha_compare);
+  for (i = 0; i < n; ++i)
+    if (!strneq (env[i], "MAKEFLAGS=", 10) && !strneq (env[i], "MFLAGS=", 7))
+      sha256_field (&ctx, env[i], strlen (env[i]));
+  free (env);
+
+  /* Add the contents of the inputs.  A missing input is distinguished from
+     an empty one.  */
+  p = inputs;
+  while ((name = find_next_token (&p, &len)) != NULL)
+    {
+      char *file = xstrndup (name, len);
+      struct stat st;
+      int r;
+
+      sha256_field (&ctx, name, len);
+      if (file_digest (file, digest))
+        sha256_update (&ctx, digest, SHA256_DIGEST_SIZE);
+      else
+        {
+          EINTRLOOP (r, stat (file, &st));
+          if (r == 0 || errno != ENOENT)
+            {
+              DB (DB_VERBOSE, (_("Not caching shell output: cannot read input '%s'.\n"),
+                               file));
+              free (file);
+              return NULL;
+            }
+          sha256_update (&ctx, "", 1);
+        }
+      free (file);
+    }
+
+  sha256_final (&ctx, digest);
+
+  return entry_name (NULL, digest);
+}
+
+/* Return the shell function output saved in cache entry ENTRY, and set
+   *LENGTH to its size.  The result is allocated with room for a trailing
+   nul.  Return NULL if there is no such entry.  */
+
+char *
+cache_shell_restore (const char *entry, size_t *length)
+{
+  char *name = output_name (entry, 0);
+  size_t maxlen = 200;
+  char *buffer;
+  size_t len;
+  int fd;
+
+  EINTRLOOP (fd, open (name, O_RDONLY | O_BINARY));
+  free (name);
+  if (fd < 0)
+    {
+      DB (DB_VERBOSE, (_("No cache entry %s for shell output.\n"), entry));
+      return NULL;
+    }
+
+  buffer = xmalloc (maxlen + 1);
+  for (len = 0; ; )
+    {
+      ssize_t cc;
+
+      if (len == maxlen)
+        {
+          maxlen *= 2;
+          buffer = xrealloc (buffer, maxlen + 1);
+        }
+
+      EINTRLOOP (cc, read (fd, buffer + len, maxlen - len));
+      if (cc < 0)
+        {
+          close (fd);
+          free (buffer);
+          return NULL;
+        }
+      if (cc == 0)
+        break;
+      len += cc;
+    }
+  close (fd);
+
+#ifdef HAVE_UTIME_H
+  utime (entry, NULL);
+#endif
+
+  DB (DB_VERBOSE, (_("Restored shell output from cache entry %s.\n"), entry));
+
+  *length = len;
+  return buffer;
+}
+
+/* Save the LENGTH bytes of shell function output in OUTPUT in cache entry
+   ENTRY.  */
+
+void
+cache_shell_store (const char *entry, const char *output, size_t length)
+{
+  struct stat st;
+  char *tmp;
+  char *name;
+  int fd;
+  int err;
+  int r;
+
+  EINTRLOOP (r, stat (entry, &st));
+  if (r == 0)
+    return;
+
+  tmp = xmalloc (strlen (entry) + 1 + INTSTR_LENGTH + 4 + 1);
+  sprintf (tmp, "%s.%ld.tmp", entry, (long) getpid ());
+  if (make_dirs (tmp) < 0)
+    {
+      OSS (error, NILF, _("cannot create cache entry %s: %s"),
+           entry, strerror (errno));
+      free (tmp);
+      return;
+    }
+
+  name = output_name (tmp, 0);
+  EINTRLOOP (fd, open (name, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666));
+  r = fd < 0 ? -1 : 0;
+  if (r == 0 && writebuf (fd, output, length) != (ssize_t) length)
+    r = -1;
+  err = errno;
+  if (fd >= 0 && close (fd) < 0 && r == 0)
+    {
+      err = errno;
+      r = -1;
+    }
+  free (name);
+
+  if (r < 0)
+    {
+      OSS (error, NILF, _("cannot create cache entry %s: %s"),
+           entry, strerror (err));
+      remove_tree (tmp);
+    }
+  else if (rename (tmp, entry) < 0)
+    {
+      if (errno != EEXIST && errno != ENOTEMPTY)
+        OSS (error, NILF, _("cannot create cache entry %s: %s"),
+             entry, strerror (errno));
+      remove_tree (tmp);
+    }
+  else
+    {
+      record_cache_root (entry);
+      DB (DB_VERBOSE, (_("Stored shell output in cache entry %s.\n"), entry));
+    }
+
+  free (tmp);
+}
+
+#ifdef HAVE_DIRENT_H
+
+/* Parse a cache size limit such as "500M" from STR into *SIZE.
+   Return 0 if STR is not valid.  */
+
+static int
+parse_size (const char *str, uintmax_t *size)
+{
+  const char *p = str;
+  uintmax_t n = 0;
+
+  NEXT_TOKEN (p);
+  if (*p != '\0')
+    {
+      if (!ISDIGIT (*p))
+        return 0;
+      while (ISDIGIT (*p))
+        n = n * 10 + (*(p++) - '0');
+      switch (*p)
+        {
+        case 'k': case 'K': n <<= 10; ++p; break;
+        case 'm': case 'M': n <<= 20; ++p; break;
+        case 'g': case 'G': n <<= 30; ++p; break;
+        default: break;
+        }
+      NEXT_TOKEN (p);
+      if (*p != '\0')
+        return 0;
+    }
+
+  *size = n;
+  return 1;
+}
+
+/* Return the total size of the outputs in cache entry ENTRY.  */
+
+static uintmax_t
+entry_size (const char *entry)
+{
+  uintmax_t size = 0;
+  DIR *dp = opendir (entry);
+  struct dirent *de;
+
+  if (dp == NULL)
+    return 0;
+
+  while ((de = readdir (dp)) != NULL)
+    if (de->d_name[0] != '.')
+      {
+        char *name = path_join (entry, de->d_name);
+        struct stat st;
+        if (stat (name, &st) == 0)
+          size += st.st_size;
+        free (name);
+      }
+  closedir (dp);
+
+  return size;
+}
+
+static int
+cache_use_cmp (const void *x, const void *y)
+{
+  time_t a = ((const struct cache_use *) x)->used;
+  time_t b = ((const struct cache_use *) y)->used;
+  return a < b ? -1 : a > b;
+}
+
+/* Evict the least recently used entries from the cache in ROOT until the
+   outputs it holds total no more than LIMIT bytes.  */
+
+static void
+trim_cache_root (const char *root, uintmax_t limit)
+{
+  struct cache_use *uses = NULL;
+  size_t nuses = 0;
+  size_t max = 0;
+  uintmax_t total = 0;
+  time_t now = time (NULL);
+  struct dirent *rde;
+  DIR *rdp;
+  size_t i;
+
+  rdp = opendir (root);
+  if (rdp == NULL)
+    return;
+
+  while ((rde = readdir (rdp)) != NULL)
+    {
+      struct dirent *de;
+      char *sub;
+      DIR *dp;
+
+      if (strlen (rde->d_name) != 2 || !isxdigit ((unsigned char) rde->d_name[0])
+          || !isxdigit ((unsigned char) rde->d_name[1]))
+        continue;
+
+      sub = path_join (root, rde->d_name);
+      dp = opendir (sub);
+      while (dp != NULL && (de = readdir (dp)) != NULL)
+        {
+          struct stat st;
+          char *name;
+
+          if (de->d_name[0] == '.')
+            continue;
+
+          name = path_join (sub, de->d_name);
+          if (stat (name, &st) < 0 || !S_ISDIR (st.st_mode))
+            free (name);
+          else if (strchr (de->d_name, '.') != NULL)
+            {
+              /* Clean up after makes that were killed while storing or
+                 evicting an entry.  */
+              if (now - st.st_mtime > CACHE_STALE_TIME)
+                remove_tree (name);
+              free (name);
+            }
+          else
+            {
+              if (nuses == max)
+                {
+                  max = max ? max * 2 : 64;
+                  uses = xrealloc (uses, max * sizeof (struct cache_use));
+                }
+              uses[nuses].name = name;
+              uses[nuses].used = st.st_mtime;
+              uses[nuses].size = entry_size (name);
+              total += uses[nuses].size;
+              ++nuses;
+            }
+        }
+      if (dp != NULL)
+        closedir (dp);
+      free (sub);
+    }
+  closedir (rdp);
+
+  if (total > limit)
+    qsort (uses, nuses, sizeof (struct cache_use), cache_use_cmp);
+
+  for (i = 0; i < nuses; ++i)
+    {
+      if (total > limit)
+        {
+          /* Move the entry aside first, so no other make starts restoring
+             from an entry that is half removed.  */
+          char *dead = xmalloc (strlen (uses[i].name) + 1 + INTSTR_LENGTH
+                                + 4 + 1);
+          sprintf (dead, "%s.%ld.del", uses[i].name, (long) getpid ());
+          if (rename (uses[i].name, dead) == 0)
+            {
+              remove_tree (dead);
+              DB (DB_JOBS, (_("Evicted cache entry %s.\n"), uses[i].name));
+            }
+          total -= uses[i].size;
+          free (dead);
+        }
+      free (uses[i].name);
+    }
+  free (uses);
+}
+
+#endif /* HAVE_DIRENT_H */
+
+/* If we stored anything in a cache and .CACHE_SIZE is set, evict the least
+   recently used entries until the cache is no larger than that.  */
+
+void
+cache_trim (void)
+{
+#ifdef HAVE_DIRENT_H
+  struct cache_root *root;
+  uintmax_t limit;
+  char *value;
+
+  if (cache_roots == NULL)
+    return;
+
+  value = allocated_expand_variable (STRING_SIZE_TUPLE (".CACHE_SIZE"));
+  if (!parse_size (value, &limit))
+    {
+      OS (error, NILF, _("invalid .CACHE_SIZE value '%s'"), value);
+      limit = 0;
+    }
+  free (value);
+
+  if (limit > 0)
+    for (root = cache_roots; root != NULL; root = root->next)
+      trim_cache_root (root->name, limit);
+#endif
+}
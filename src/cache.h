@@ -0,0 +1,30 @@
+/* Declarations for the recipe output cache.
+Copyright (C) 2024 Free Software Foundation, Inc.
+This file is part of GNU Make.
+
+GNU Make is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+GNU Make is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+struct file;
+
+/* The default directory holding cached outputs, if .CACHE_DIR is not set.  */
+#define DEFAULT_CACHE_DIR   ".make-cache"
+
+char *cache_entry (struct file *file, char **lines, unsigned int nlines);
+int cache_restore (struct file *file, const char *entry);
+void cache_store (struct file *file, const char *entry);
+void cache_trim (void);
+
+char *cache_shell_entry (const char *command, char **command_argv,
+                         const char *inputs, char **envp);
+char *cache_shell_restore (const char *entry, size_t *length);
+void cache_shell_store (const char *entry, const char *output, size_t length);
@@ -525,6 +525,7 @@ fatal_error_signal (int sig)
   temp_stdin_unlink ();
   osync_clear ();
   jobserver_clear ();
+  coprocess_cleanup ();
 
   /* A termination signal won't be sent to the entire
      process group, but it means we want to kill the children.  */
@@ -533,7 +534,9 @@ fatal_error_signal (int sig)
     {
       struct child *c;
       for (c = children; c != 0; c = c->next)
-        if (!c->remote && c->pid > 0)
+        if (c->worker)
+          worker_kill (c->pid, SIGTERM);
+        else if (!c->remote && c->pid > 0)
           (void) kill (c->pid, SIGTERM);
     }
 
@@ -667,6 +670,24 @@ delete_child_targets (struct child *child)
   child->deleted = 1;
 }
 
+/* Return the number of bytes used by CMDS.  */
+
+unsigned long
+commands_memory_size (const struct commands *cmds)
+{
+  unsigned long bytes = sizeof (struct commands) + strlen (cmds->commands) + 1;
+  unsigned short i;
+
+  if (cmds->command_lines)
+    {
+      bytes += cmds->ncommand_lines * (sizeof (char *) + 1);
+      for (i = 0; i < cmds->ncommand_lines; ++i)
+        bytes += strlen (cmds->command_lines[i]) + 1;
+    }
+
+  return bytes;
+}
+
 /* Print out the commands in CMDS.  */
 
 void
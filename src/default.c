@@ -93,6 +93,13 @@ static struct pspec default_pattern_rules[] =
     { 0, 0, 0 }
   };
 
+#if !MK_OS_VMS
+/* Under .BATCH_ARCHIVES one recipe adds all the out of date members of an
+   archive, so it must use all the changed prerequisites.  */
+static struct pspec batch_archive_rule =
+  { "(%)", "%", "$(AR) $(ARFLAGS) $@ $?" };
+#endif
+
 static struct pspec default_terminal_rules[] =
   {
 #if MK_OS_VMS
@@ -740,7 +747,12 @@ install_default_implicit_rules (void)
     return;
 
   for (p = default_pattern_rules; p->target != 0; ++p)
-    install_pattern_rule (p, 0);
+#if !MK_OS_VMS
+    if (batch_archives && streq (p->target, "(%)"))
+      install_pattern_rule (&batch_archive_rule, 0);
+    else
+#endif
+      install_pattern_rule (p, 0);
 
   for (p = default_terminal_rules; p->target != 0; ++p)
     install_pattern_rule (p, 1);
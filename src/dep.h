@@ -103,32 +103,35 @@ struct nameseq *ar_glob (const char *arname, const char *member_pattern, size_t
 
 #define dep_name(d)       ((d)->name ? (d)->name : (d)->file->name)
 
-#define alloc_seq_elt(_t) xcalloc (sizeof (_t))
+/* Chain elements are allocated from pools.  A struct nameseq is often used
+   as the start of a struct dep, so both come from the same pool.  */
+extern struct objpool dep_pool;
+extern struct objpool goaldep_pool;
+
 void free_ns_chain (struct nameseq *n);
+void free_goal_chain (struct goaldep *g);
 
 #if defined(MAKE_MAINTAINER_MODE) && defined(__GNUC__) && !defined(__STRICT_ANSI__)
 /* Use inline to get real type-checking.  */
 #define SI static inline
-SI struct nameseq *alloc_ns (void)    { return alloc_seq_elt (struct nameseq); }
-SI struct dep *alloc_dep (void)       { return alloc_seq_elt (struct dep); }
-SI struct goaldep *alloc_goaldep (void) { return alloc_seq_elt (struct goaldep); }
+SI struct nameseq *alloc_ns (void)    { return objpool_alloc (&dep_pool); }
+SI struct dep *alloc_dep (void)       { return objpool_alloc (&dep_pool); }
+SI struct goaldep *alloc_goaldep (void) { return objpool_alloc (&goaldep_pool); }
 
-SI void free_ns (struct nameseq *n)      { free (n); }
+SI void free_ns (struct nameseq *n)      { objpool_free (&dep_pool, n); }
 SI void free_dep (struct dep *d)         { free_ns ((struct nameseq *)d); }
-SI void free_goaldep (struct goaldep *g) { free_dep ((struct dep *)g); }
+SI void free_goaldep (struct goaldep *g) { objpool_free (&goaldep_pool, g); }
 SI void free_dep_chain (struct dep *d)   { free_ns_chain((struct nameseq *)d); }
-SI void free_goal_chain (struct goaldep *g) { free_dep_chain((struct dep *)g); }
 #else
-# define alloc_ns()          alloc_seq_elt (struct nameseq)
-# define alloc_dep()         alloc_seq_elt (struct dep)
-# define alloc_goaldep()     alloc_seq_elt (struct goaldep)
+# define alloc_ns()          ((struct nameseq *) objpool_alloc (&dep_pool))
+# define alloc_dep()         ((struct dep *) objpool_alloc (&dep_pool))
+# define alloc_goaldep()     ((struct goaldep *) objpool_alloc (&goaldep_pool))
 
-# define free_ns(_n)         free (_n)
+# define free_ns(_n)         objpool_free (&dep_pool, (_n))
 # define free_dep(_d)        free_ns (_d)
-# define free_goaldep(_g)    free_dep (_g)
+# define free_goaldep(_g)    objpool_free (&goaldep_pool, (_g))
 
 # define free_dep_chain(_d)  free_ns_chain ((struct nameseq *)(_d))
-# define free_goal_chain(_g) free_ns_chain ((struct nameseq *)(_g))
 #endif
 
 struct dep *copy_dep (const struct dep *d);
@@ -1075,6 +1075,39 @@ dir_name (const char *dir)
 {
   return find_directory (dir)->name;
 }
+
+/* Print the memory used by the directory cache for --memory-stats.  */
+
+void
+print_dir_memory_stats (void)
+{
+  unsigned long entries = 0;
+  unsigned long bytes;
+  struct directory_contents **dc_slot;
+  struct directory_contents **dc_end;
+
+  print_memory_usage (_("directories"), directories.ht_fill,
+                      directories.ht_fill * sizeof (struct directory)
+                      + hash_memory_size (&directories));
+
+  bytes = directory_contents.ht_fill * sizeof (struct directory_contents)
+          + hash_memory_size (&directory_contents);
+
+  dc_slot = (struct directory_contents **) directory_contents.ht_vec;
+  dc_end = dc_slot + directory_contents.ht_size;
+  for ( ; dc_slot < dc_end; dc_slot++)
+    {
+      struct directory_contents *dc = *dc_slot;
+      if (! HASH_VACANT (dc))
+        {
+          entries += dc->dirfiles.ht_fill;
+          bytes += dc->dirfiles.ht_fill * sizeof (struct dirfile)
+                   + hash_memory_size (&dc->dirfiles);
+        }
+    }
+
+  print_memory_usage (_("directory entries"), entries, bytes);
+}
 
 /* Print the data base of directories.  */
 
@@ -1182,6 +1215,170 @@ print_dir_data_base (void)
   printf (_(" impossibilities in %lu directories.\n"), directories.ht_fill);
 }
 
+/* Directory stamps.  While recording, the names and modification times
+   of the directories glob reads, or looks up files in, are saved.  The
+   result of a glob can then be reused for as long as those directories
+   don't change.  */
+
+struct dir_stamp
+  {
+    const char *name;           /* The name of the directory.  */
+    FILE_TIMESTAMP mtime;       /* Its modification time when recorded, or
+                                   NONEXISTENT_MTIME.  */
+  };
+
+struct dir_stamps
+  {
+    unsigned long counter;      /* command_count value when last checked.  */
+    int racy;                   /* Nonzero if a directory was modified too
+                                   recently for its time to be trusted.  */
+    unsigned int count;
+    struct dir_stamp *stamps;
+  };
+
+static int recording_stamps = 0;
+static struct dir_stamp *recorded_stamps = NULL;
+static unsigned int recorded_count = 0;
+static unsigned int recorded_max = 0;
+
+static FILE_TIMESTAMP
+dir_stamp_mtime (const char *name)
+{
+  struct stat st;
+  int r;
+
+  EINTRLOOP (r, stat (name, &st));
+  return r == 0 ? FILE_TIMESTAMP_STAT_MODTIME (name, st) : NONEXISTENT_MTIME;
+}
+
+/* Record the directory NAME, which is LEN chars long, if we're recording.  */
+
+static void
+record_dir_stamp (const char *name, size_t len)
+{
+  struct dir_stamp *ds;
+
+  if (!recording_stamps)
+    return;
+
+  /* Glob usually looks in the same directory several times in a row.  */
+  if (recorded_count > 0)
+    {
+      ds = &recorded_stamps[recorded_count - 1];
+      if (strlen (ds->name) == len && strneq (ds->name, name, len))
+        return;
+    }
+
+  if (recorded_count == recorded_max)
+    {
+      recorded_max = recorded_max ? recorded_max * 2 : 16;
+      recorded_stamps = xrealloc (recorded_stamps,
+                                  recorded_max * sizeof (struct dir_stamp));
+    }
+
+  ds = &recorded_stamps[recorded_count++];
+  ds->name = strcache_add_len (name, len);
+  ds->mtime = dir_stamp_mtime (ds->name);
+}
+
+/* Record the directory containing the file PATH.  */
+
+static void
+record_file_dir_stamp (const char *path)
+{
+  const char *p = path + strlen (path);
+
+  while (p > path && !ISDIRSEP (p[-1]))
+    --p;
+
+  if (p == path)
+    record_dir_stamp (".", 1);
+  else if (p == path + 1)
+    record_dir_stamp (path, 1);
+  else
+    record_dir_stamp (path, p - path - 1);
+}
+
+/* Start recording the directories used by glob.  */
+
+void
+dir_stamps_start (void)
+{
+  recording_stamps = 1;
+  recorded_count = 0;
+}
+
+/* Stop recording, and return the stamps of the directories used since
+   dir_stamps_start() was called.  */
+
+struct dir_stamps *
+dir_stamps_finish (void)
+{
+  struct dir_stamps *stamps = xmalloc (sizeof (struct dir_stamps));
+  FILE_TIMESTAMP recent = file_timestamp_cons (NULL, time (NULL) - 1, 0);
+  unsigned int i;
+
+  recording_stamps = 0;
+
+  stamps->counter = command_count;
+  stamps->racy = 0;
+  stamps->count = recorded_count;
+  stamps->stamps = xmalloc (recorded_count * sizeof (struct dir_stamp));
+  memcpy (stamps->stamps, recorded_stamps,
+          recorded_count * sizeof (struct dir_stamp));
+
+  /* A file created in the same second as the directory was last modified
+     may not change the time of a directory on some file systems.  */
+  for (i = 0; i < recorded_count; ++i)
+    if (recorded_stamps[i].mtime >= recent)
+      stamps->racy = 1;
+
+  return stamps;
+}
+
+/* Return nonzero if the directories in STAMPS are unchanged.  Until a
+   command is run they are read from the directory cache, which is only
+   invalidated when a command finishes, so there's nothing to check.  */
+
+int
+dir_stamps_valid (struct dir_stamps *stamps)
+{
+  unsigned int i;
+
+  if (stamps->counter == command_count)
+    return 1;
+
+  if (stamps->racy)
+    return 0;
+
+  for (i = 0; i < stamps->count; ++i)
+    if (dir_stamp_mtime (stamps->stamps[i].name) != stamps->stamps[i].mtime)
+      {
+        DB (DB_VERBOSE, (_("Directory %s has changed.\n"),
+                         stamps->stamps[i].name));
+        return 0;
+      }
+
+  stamps->counter = command_count;
+  return 1;
+}
+
+void
+dir_stamps_free (struct dir_stamps *stamps)
+{
+  free (stamps->stamps);
+  free (stamps);
+}
+
+/* Return the memory used by STAMPS.  */
+
+size_t
+dir_stamps_size (const struct dir_stamps *stamps)
+{
+  return sizeof (struct dir_stamps)
+         + stamps->count * sizeof (struct dir_stamp);
+}
+
 /* Hooks for globbing.  */
 
 /* Structure describing state of iterating through a directory hash table.  */
@@ -1202,6 +1399,8 @@ open_dirstream (const char *directory)
   struct dirstream *new;
   struct directory *dir = find_directory (directory);
 
+  record_dir_stamp (directory, strlen (directory));
+
   if (dir->contents == NULL || dir->contents->dirfiles.ht_vec == NULL)
     /* DIR->contents is nil if the directory could not be stat'd.
        DIR->contents->dirfiles is nil if it could not be opened.  */
@@ -1339,6 +1538,100 @@ local_lstat (const char *path, struct stat *buf)
 }
 #endif
 
+static int
+dirfile_name_cmp (const void *xv, const void *yv)
+{
+  const struct dirfile *x = *(const struct dirfile **) xv;
+  const struct dirfile *y = *(const struct dirfile **) yv;
+  return strcmp (x->name, y->name);
+}
+
+/* Call FUNC with ARG for each file in the directory DIRNAME, other than
+   "." and "..", in sorted order.  ISDIR is nonzero if the file is a
+   directory; symbolic links are not followed.  The directory is read
+   through the directory cache, so later lookups of the files in it don't
+   read it again.  */
+
+void
+dir_contents_foreach (const char *dirname,
+                      void (*func) (const char *name, int isdir, void *arg),
+                      void *arg)
+{
+  struct directory *dir = find_directory (dirname);
+  struct dirfile **files;
+  struct dirfile **dfp;
+  size_t dirlen;
+  char *path = NULL;
+  size_t pathlen = 0;
+
+  if (dir->contents == NULL || dir->contents->dirfiles.ht_vec == NULL)
+    return;
+
+  /* FUNC may change the caller's copy of the name.  */
+  dirname = dir->name;
+  dirlen = strlen (dirname);
+
+  dir_contents_file_exists_p (dir, NULL);
+
+  /* FUNC may read other directories, so work from a copy of the list.  */
+  files = (struct dirfile **) hash_dump (&dir->contents->dirfiles, NULL,
+                                         dirfile_name_cmp);
+
+  for (dfp = files; *dfp != NULL; ++dfp)
+    {
+      struct dirfile *df = *dfp;
+      int isdir = -1;
+
+      if (df->impossible || streq (df->name, ".") || streq (df->name, ".."))
+        continue;
+
+#ifdef HAVE_STRUCT_DIRENT_D_TYPE
+      if (df->type == DT_DIR)
+        isdir = 1;
+      else if (df->type != DT_UNKNOWN)
+        isdir = 0;
+#endif
+      if (isdir < 0)
+        {
+          struct stat st;
+
+          if (dirlen + 1 + df->length + 1 > pathlen)
+            {
+              pathlen = dirlen + 1 + df->length + 1;
+              path = xrealloc (path, pathlen);
+            }
+          memcpy (path, dirname, dirlen);
+          path[dirlen] = '/';
+          memcpy (path + dirlen + 1, df->name, df->length + 1);
+          isdir = local_lstat (path, &st) == 0 && S_ISDIR (st.st_mode);
+        }
+
+      func (df->name, isdir, arg);
+    }
+
+  free (path);
+  free (files);
+}
+
+/* Glob looks up files whose names have no wildcards directly, so record
+   the directories they are in.  */
+
+#if !MK_OS_VMS || !defined(__DECC) || defined(_POSIX_C_SOURCE)
+static int
+glob_stat (const char *path, struct stat *buf)
+{
+  record_file_dir_stamp (path);
+  return local_stat (path, buf);
+}
+#endif
+
+static int
+glob_lstat (const char *path, struct stat *buf)
+{
+  record_file_dir_stamp (path);
+  return local_lstat (path, buf);
+}
+
 void
 dir_setup_glob (glob_t *gl)
 {
@@ -1346,8 +1639,12 @@ dir_setup_glob (glob_t *gl)
   gl->gl_opendir = open_dirstream;
   gl->gl_readdir = read_dirstream;
   gl->gl_closedir = free;
-  gl->gl_lstat = local_lstat;
+  gl->gl_lstat = glob_lstat;
+#if MK_OS_VMS && defined(__DECC) && !defined(_POSIX_C_SOURCE)
   gl->gl_stat = local_stat;
+#else
+  gl->gl_stat = glob_stat;
+#endif
 }
 
 void
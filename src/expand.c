@@ -47,6 +47,15 @@ const floc **expanding_var = &reading_file;
 static size_t variable_buffer_length;
 char *variable_buffer;
 
+/* Print the memory used by the expansion buffer for --memory-stats.  */
+
+void
+print_expand_memory_stats (void)
+{
+  print_memory_usage (_("expansion buffer"), variable_buffer != NULL,
+                      variable_buffer ? variable_buffer_length + 1 : 0);
+}
+
 /* Append LENGTH chars of STRING at PTR which must point into variable_buffer.
    The buffer will always be kept nul-terminated.
    The updated pointer into the buffer is returned as the value.  Thus, the
@@ -40,10 +40,16 @@ int snapped_deps = 0;
 
 /* Hash table of files the makefile knows how to make.  */
 
+/* The names of files in the table are in the strcache, which keeps their
+   hashes, and so are the names we look up when entering files.  */
+
 static unsigned long
 file_hash_1 (const void *key)
 {
-  return_ISTRING_HASH_1 (((struct file const *) key)->hname);
+  struct file const *f = (struct file const *) key;
+  if (f->hname_cached)
+    return strcache_hash (f->hname);
+  return strcache_string_hash (f->hname, strlen (f->hname));
 }
 
 static unsigned long
@@ -55,12 +61,21 @@ file_hash_2 (const void *key)
 static int
 file_hash_cmp (const void *x, const void *y)
 {
-  return_ISTRING_COMPARE (((struct file const *) x)->hname,
-                          ((struct file const *) y)->hname);
+  struct file const *fx = (struct file const *) x;
+  struct file const *fy = (struct file const *) y;
+
+  /* Two different cached names are never the same.  */
+  if (fx->hname_cached && fy->hname_cached)
+    return fx->hname != fy->hname;
+
+  return_ISTRING_COMPARE (fx->hname, fy->hname);
 }
 
 static struct hash_table files;
 
+/* Files are never freed, so they are all allocated from one pool.  */
+static struct objpool file_pool = OBJPOOL_INIT ("file", struct file);
+
 /* We can't free files we take out of the hash table, because they are still
    likely pointed to in various places.  The check_renamed() will be used if
    we come across these, to find the new correct file.  This is mainly to
@@ -133,6 +148,7 @@ lookup_file (const char *name)
 #endif
     }
   file_key.hname = name;
+  file_key.hname_cached = 0;
   f = hash_find_item (&files, &file_key);
 #if MK_OS_VMS && !defined(WANT_CASE_SENSITIVE_TARGETS)
   if (*name != '.')
@@ -177,6 +193,7 @@ enter_file (const char *name)
 #endif
 
   file_key.hname = name;
+  file_key.hname_cached = 1;
   file_slot = (struct file **) hash_find_slot (&files, &file_key);
   f = *file_slot;
   if (! HASH_VACANT (f) && !f->double_colon)
@@ -185,8 +202,9 @@ enter_file (const char *name)
       return f;
     }
 
-  new = xcalloc (sizeof (struct file));
+  new = objpool_alloc (&file_pool);
   new->name = new->hname = name;
+  new->hname_cached = 1;
   new->update_status = us_none;
 
   if (HASH_VACANT (f))
@@ -218,9 +236,12 @@ rehash_file (struct file *from_file, const char *to_hname)
   struct file *deleted_file;
   struct file *f;
 
+  assert (! verify_flag || strcache_iscached (to_hname));
+
   /* If it's already that name, we're done.  */
   from_file->builtin = 0;
   file_key.hname = to_hname;
+  file_key.hname_cached = 1;
   if (! file_hash_cmp (from_file, &file_key))
     return;
 
@@ -382,6 +403,7 @@ remove_intermediates (int sig)
   if (sig && just_print_flag)
     return;
 
+  hash_finish_rehash (&files);
   file_slot = (struct file **) files.ht_vec;
   file_end = file_slot + files.ht_size;
   for ( ; file_slot < file_end; file_slot++)
@@ -801,6 +823,11 @@ snap_deps (void)
       for (f2 = d->file; f2 != 0; f2 = f2->prev)
         f2->precious = 1;
 
+  for (f = lookup_file (".CACHEABLE"); f != 0; f = f->prev)
+    for (d = f->deps; d != 0; d = d->next)
+      for (f2 = d->file; f2 != 0; f2 = f2->prev)
+        f2->cacheable = 1;
+
   for (f = lookup_file (".LOW_RESOLUTION_TIME"); f != 0; f = f->prev)
     for (d = f->deps; d != 0; d = d->next)
       for (f2 = d->file; f2 != 0; f2 = f2->prev)
@@ -868,7 +895,10 @@ snap_deps (void)
 
   f = lookup_file (".EXPORT_ALL_VARIABLES");
   if (f != 0 && f->is_target)
-    export_all_variables = 1;
+    {
+      export_all_variables = 1;
+      variable_exports_changed ();
+    }
 
   f = lookup_file (".IGNORE");
   if (f != 0 && f->is_target)
@@ -892,6 +922,18 @@ snap_deps (void)
             f2->command_flags |= COMMANDS_SILENT;
     }
 
+  f = lookup_file (".MAKE_STATS");
+  if (f != 0 && f->is_target)
+    make_stats = 1;
+
+  f = lookup_file (".SHELL_WORKERS");
+  if (f != 0 && f->is_target)
+    shell_workers = 1;
+
+  f = lookup_file (".BATCH_ARCHIVES");
+  if (f != 0 && f->is_target)
+    batch_archives = 1;
+
   f = lookup_file (".NOTPARALLEL");
   if (f != 0 && f->is_target)
     {
@@ -926,6 +968,86 @@ snap_deps (void)
 #endif
 }
 
+/* Dependencies referenced by renamed files, which must not be moved.  */
+static struct dep **pinned_deps;
+static size_t pinned_deps_len;
+
+static int
+ptr_compare (const void *v1, const void *v2)
+{
+  const struct dep *d1 = *(struct dep *const *) v1;
+  const struct dep *d2 = *(struct dep *const *) v2;
+  return d1 < d2 ? -1 : d1 > d2;
+}
+
+/* Move the dependencies of F, and of its other double-colon entries, into
+   adjacent memory.  */
+
+static void
+freeze_file (const void *item)
+{
+  struct file *f = (struct file *) item;
+
+  for (; f != NULL; f = f->prev)
+    {
+      struct dep *d;
+      struct dep *next;
+      struct dep *new;
+      size_t n = 0;
+      int adjacent = 1;
+
+      for (d = f->deps; d != NULL; d = d->next)
+        {
+          if (d->next && d->next != d + 1)
+            adjacent = 0;
+          if (pinned_deps_len
+              && bsearch (&d, pinned_deps, pinned_deps_len,
+                          sizeof (struct dep *), ptr_compare))
+            break;
+          ++n;
+        }
+
+      if (adjacent || d != NULL)
+        continue;
+
+      new = objpool_alloc_run (&dep_pool, n);
+      for (d = f->deps, n = 0; d != NULL; d = next, ++n)
+        {
+          next = d->next;
+          memcpy (&new[n], d, sizeof (struct dep));
+          new[n].next = next ? &new[n + 1] : NULL;
+          free_dep (d);
+        }
+      f->deps = new;
+    }
+}
+
+/* Once snap_deps is done the prerequisite lists rarely change, but they
+   are walked many times.  Make each list occupy adjacent memory, so that
+   walking it reads memory in order.  Most lists are built that way by
+   parse_file_seq already; only the rest are copied.  */
+
+void
+freeze_deps (void)
+{
+  size_t i;
+
+  /* A renamed file may still point into the list of the file it was
+     merged into.  Leave such lists where they are.  */
+  pinned_deps = xmalloc ((rehashed_files_len + 1) * sizeof (struct dep *));
+  pinned_deps_len = 0;
+  for (i = 0; i < rehashed_files_len; ++i)
+    if (rehashed_files[i]->deps)
+      pinned_deps[pinned_deps_len++] = rehashed_files[i]->deps;
+  qsort (pinned_deps, pinned_deps_len, sizeof (struct dep *), ptr_compare);
+
+  hash_map (&files, freeze_file);
+
+  free (pinned_deps);
+  pinned_deps = NULL;
+  pinned_deps_len = 0;
+}
+
 /* Set the 'command_state' member of FILE and all its 'also_make's.
    Don't decrease the state of also_make's (e.g., don't downgrade a 'running'
    also_make to a 'deps_running' also_make).  */
@@ -1204,6 +1326,85 @@ print_file_data_base (void)
   hash_print_stats (&files, stdout);
 }
 
+/* Totals for print_file_memory_stats.  */
+
+struct file_usage
+  {
+    struct commands **cmds;     /* Recipes seen, possibly more than once.  */
+    unsigned long ncmds;
+    unsigned long var_sets;
+    unsigned long vars;
+    unsigned long var_bytes;
+  };
+
+static void
+add_file_usage (const void *item, void *arg)
+{
+  const struct file *f;
+  struct file_usage *u = arg;
+
+  for (f = item; f != NULL; f = f->prev)
+    {
+      if (f->cmds)
+        u->cmds[u->ncmds++] = f->cmds;
+      if (f->variables)
+        {
+          ++u->var_sets;
+          u->var_bytes += variable_set_memory_size (f->variables->set,
+                                                    &u->vars);
+        }
+      if (f->pat_variables)
+        {
+          ++u->var_sets;
+          u->var_bytes += variable_set_memory_size (f->pat_variables->set,
+                                                    &u->vars);
+        }
+    }
+}
+
+static int
+cmds_compare (const void *v1, const void *v2)
+{
+  const struct commands *c1 = *(struct commands *const *) v1;
+  const struct commands *c2 = *(struct commands *const *) v2;
+  return c1 < c2 ? -1 : c1 > c2;
+}
+
+/* Print the memory used by files, their prerequisites, recipes, and
+   target-specific variables for --memory-stats.  */
+
+void
+print_file_memory_stats (void)
+{
+  struct file_usage u;
+  unsigned long count = 0;
+  unsigned long bytes = 0;
+  unsigned long i;
+
+  memset (&u, '\0', sizeof (u));
+  u.cmds = xmalloc ((file_pool.inuse + 1) * sizeof (struct commands *));
+  hash_map_arg (&files, add_file_usage, &u);
+
+  /* Several files may share one recipe: count each only once.  */
+  qsort (u.cmds, u.ncmds, sizeof (struct commands *), cmds_compare);
+  for (i = 0; i < u.ncmds; ++i)
+    if (i == 0 || u.cmds[i] != u.cmds[i - 1])
+      {
+        ++count;
+        bytes += commands_memory_size (u.cmds[i]);
+      }
+  free (u.cmds);
+
+  print_memory_usage (_("files"), file_pool.inuse,
+                      file_pool.capacity * file_pool.size
+                      + hash_memory_size (&files)
+                      + rehashed_files_len * sizeof (struct file *));
+  objpool_memory_stats (&dep_pool, _("deps"));
+  objpool_memory_stats (&goaldep_pool, _("goal deps"));
+  print_memory_usage (_("recipes"), count, bytes);
+  print_memory_usage (_("target variable sets"), u.var_sets, u.var_bytes);
+}
+
 static void
 print_target (const void *item)
 {
@@ -1249,7 +1450,6 @@ verify_file (const void *item)
 
   VERIFY_CACHED (f, name);
   VERIFY_CACHED (f, hname);
-  VERIFY_CACHED (f, vpath);
   VERIFY_CACHED (f, stem);
 
   /* Check the deps.  */
@@ -1279,8 +1479,12 @@ build_target_list (char *value)
       size_t max = EXPANSION_INCREMENT (strlen (value));
       size_t len;
       char *p;
-      struct file **fp = (struct file **) files.ht_vec;
-      struct file **end = &fp[files.ht_size];
+      struct file **fp;
+      struct file **end;
+
+      hash_finish_rehash (&files);
+      fp = (struct file **) files.ht_vec;
+      end = &fp[files.ht_size];
 
       /* Make sure we have at least MAX bytes in the allocated buffer.  */
       value = xrealloc (value, max);
@@ -1318,6 +1522,7 @@ void
 init_hash_files (void)
 {
   hash_init (&files, 1000, file_hash_1, file_hash_2, file_hash_cmp);
+  hash_set_incremental (&files);
 }
 
 /* EOF */
@@ -28,44 +28,27 @@ struct variable_set_list;
 
 struct file
   {
+    /* The members used while walking the dependency graph come first, so
+       that on most hosts they share a single cache line.  */
+
     const char *name;
-    const char *hname;          /* Hashed filename */
-    const char *vpath;          /* VPATH/vpath pathname */
     struct dep *deps;           /* all dependencies, including duplicates */
     struct commands *cmds;      /* Commands to execute for this target.  */
-    const char *stem;           /* Implicit stem, if an implicit
-                                   rule has been used */
-    struct dep *also_make;      /* Targets that are made by making this.  */
+
+    /* For a double-colon entry, this is the first double-colon entry for
+       the same file.  Otherwise this is null.  */
+    struct file *double_colon;
     struct file *prev;          /* Previous entry for same file name;
                                    used when there are multiple double-colon
                                    entries for the same file.  */
-    struct file *last;          /* Last entry for the same file name.  */
 
     /* File that this file was renamed to.  After any time that a
        file could be renamed, call 'check_renamed' (below).  */
     struct file *renamed;
 
-    /* List of variable sets used for this file.  */
-    struct variable_set_list *variables;
-
-    /* Pattern-specific variable reference for this target, or null if there
-       isn't one.  Also see the pat_searched flag, below.  */
-    struct variable_set_list *pat_variables;
-
-    /* Immediate dependent that caused this target to be remade,
-       or nil if there isn't one.  */
-    struct file *parent;
-
-    /* For a double-colon entry, this is the first double-colon entry for
-       the same file.  Otherwise this is null.  */
-    struct file *double_colon;
-
     FILE_TIMESTAMP last_mtime;  /* File's modtime, if already known.  */
-    FILE_TIMESTAMP mtime_before_update; /* File's modtime before any updating
-                                           has been performed.  */
     unsigned int considered;    /* equal to 'considered' if file has been
                                    considered on current scan of goal chain */
-    int command_flags;          /* Flags OR'd in for cmds; see commands.h.  */
     enum update_status          /* Status of the last attempt to update.  */
       {
         us_success = 0,         /* Successfully updated.  Must be 0!  */
@@ -83,6 +66,7 @@ struct file
 
     unsigned int builtin:1;     /* True if the file is a builtin rule. */
     unsigned int precious:1;    /* Non-0 means don't delete file on quit */
+    unsigned int cacheable:1;   /* Nonzero if a prereq of .CACHEABLE.  */
     unsigned int loaded:1;      /* True if the file is a loaded object. */
     unsigned int unloaded:1;    /* True if this loaded object was unloaded. */
     unsigned int low_resolution_time:1; /* Nonzero if this file's time stamp
@@ -114,6 +98,30 @@ struct file
     unsigned int snapped:1;     /* True if the deps of this file have been
                                    secondary expanded.  */
     unsigned int suffix:1;      /* True if this is a suffix rule. */
+    unsigned int hname_cached:1;/* Nonzero if hname is in the strcache.  */
+
+    /* The rest are only needed when the file is remade, or rarely.  */
+
+    const char *hname;          /* Hashed filename */
+    const char *stem;           /* Implicit stem, if an implicit
+                                   rule has been used */
+    struct dep *also_make;      /* Targets that are made by making this.  */
+    struct file *last;          /* Last entry for the same file name.  */
+
+    /* List of variable sets used for this file.  */
+    struct variable_set_list *variables;
+
+    /* Pattern-specific variable reference for this target, or null if there
+       isn't one.  Also see the pat_searched flag, above.  */
+    struct variable_set_list *pat_variables;
+
+    /* Immediate dependent that caused this target to be remade,
+       or nil if there isn't one.  */
+    struct file *parent;
+
+    FILE_TIMESTAMP mtime_before_update; /* File's modtime before any updating
+                                           has been performed.  */
+    int command_flags;          /* Flags OR'd in for cmds; see commands.h.  */
   };
 
 
@@ -128,6 +136,7 @@ void expand_deps (struct file *f);
 struct dep *expand_extra_prereqs (const struct variable *extra);
 void remove_intermediates (int sig);
 void snap_deps (void);
+void freeze_deps (void);
 void rename_file (struct file *file, const char *name);
 void rehash_file (struct file *file, const char *name);
 void set_command_state (struct file *file, enum cmd_state state);
@@ -136,6 +145,7 @@ void init_hash_files (void);
 void verify_file_data_base (void);
 char *build_target_list (char *old_list);
 void print_file_data_base (void);
+void print_file_memory_stats (void);
 void print_targets (void);
 int try_implicit_rule (struct file *file, unsigned int depth);
 int stemlen_compare (const void *v1, const void *v2);
@@ -21,8 +21,11 @@ this program.  If not, see <https://www.gnu.org/licenses/>.  */
 #include "job.h"
 #include "os.h"
 #include "commands.h"
+#include "cache.h"
 #include "debug.h"
 
+#include <fnmatch.h>
+
 
 struct function_table_entry
   {
@@ -347,6 +350,59 @@ find_next_argument (char startparen, char endparen,
 }
 
 
+/* The results of string_glob, which are reused for as long as the
+   directories they were found in don't change.  */
+
+struct glob_result
+  {
+    const char *line;           /* The names that were globbed.  */
+    char *result;               /* The matching files.  */
+    struct dir_stamps *stamps;  /* The directories that were read.  */
+  };
+
+static struct hash_table glob_results;
+
+static unsigned long
+glob_result_hash_1 (const void *key)
+{
+  return_STRING_HASH_1 (((const struct glob_result *) key)->line);
+}
+
+static unsigned long
+glob_result_hash_2 (const void *key)
+{
+  return_STRING_HASH_2 (((const struct glob_result *) key)->line);
+}
+
+static int
+glob_result_hash_cmp (const void *x, const void *y)
+{
+  return_STRING_COMPARE (((const struct glob_result *) x)->line,
+                         ((const struct glob_result *) y)->line);
+}
+
+void
+print_glob_memory_stats (void)
+{
+  struct glob_result **slot;
+  struct glob_result **end;
+  unsigned long bytes = 0;
+
+  if (glob_results.ht_vec == NULL)
+    return;
+
+  bytes = glob_results.ht_fill * sizeof (struct glob_result)
+          + hash_memory_size (&glob_results);
+
+  slot = (struct glob_result **) glob_results.ht_vec;
+  end = slot + glob_results.ht_size;
+  for (; slot < end; ++slot)
+    if (!HASH_VACANT (*slot))
+      bytes += strlen ((*slot)->result) + 1 + dir_stamps_size ((*slot)->stamps);
+
+  print_memory_usage (_("wildcard results"), glob_results.ht_fill, bytes);
+}
+
 /* Glob-expand LINE.  The returned pointer is
    only good until the next call to string_glob.  */
 
@@ -355,9 +411,38 @@ string_glob (char *line)
 {
   static char *result = 0;
   static size_t length;
+  struct glob_result key;
+  struct glob_result **slot;
+  struct glob_result *gr;
   struct nameseq *chain;
+  const char *p;
+  int keep;
   size_t idx;
 
+  if (glob_results.ht_vec == NULL)
+    hash_init (&glob_results, 64, glob_result_hash_1, glob_result_hash_2,
+               glob_result_hash_cmp);
+
+  key.line = line;
+  slot = (struct glob_result **) hash_find_slot (&glob_results, &key);
+  gr = *slot;
+  if (!HASH_VACANT (gr) && dir_stamps_valid (gr->stamps))
+    return gr->result;
+
+  /* Archive members depend on the contents of the archive, and names
+     starting with "~" on the value of HOME, so don't keep those results.  */
+  keep = strchr (line, '(') == NULL;
+  for (p = line; keep && (p = strchr (p, '~')) != NULL; ++p)
+    if (p == line || ISSPACE (p[-1]))
+      keep = 0;
+
+  if (keep)
+    {
+      if (HASH_VACANT (gr))
+        key.line = strcache_add (line);
+      dir_stamps_start ();
+    }
+
   chain = PARSE_FILE_SEQ (&line, struct nameseq, MAP_NUL, NULL,
                           /* We do not want parse_file_seq to strip './'s.
                              That would break examples like:
@@ -387,7 +472,7 @@ string_glob (char *line)
 
       /* Because we used PARSEFS_NOCACHE above, we have to free() NAME.  */
       free ((char *)chain->name);
-      free (chain);
+      free_ns (chain);
       chain = next;
     }
 
@@ -397,6 +482,25 @@ string_glob (char *line)
   else
     result[idx - 1] = '\0';
 
+  if (keep)
+    {
+      struct dir_stamps *stamps = dir_stamps_finish ();
+
+      if (HASH_VACANT (gr))
+        {
+          gr = xmalloc (sizeof (struct glob_result));
+          gr->line = key.line;
+          hash_insert_at (&glob_results, gr, slot);
+        }
+      else
+        {
+          free (gr->result);
+          dir_stamps_free (gr->stamps);
+        }
+      gr->result = xstrdup (result);
+      gr->stamps = stamps;
+    }
+
   return result;
 }
 
@@ -1527,6 +1631,134 @@ func_wildcard (char *o, char **argv, const char *funcname UNUSED)
    return o;
 }
 
+/*
+  $(wildcard-tree DIRS,PATTERNS)
+
+  Expand to the names of the files at any depth below each of DIRS whose
+  names, without the directory, match one of the wildcard PATTERNS.  The
+  directories are read through the directory cache.
+*/
+
+struct tree_walk
+  {
+    char **patterns;            /* The patterns to match.  */
+    unsigned int npatterns;
+    char *path;                 /* The name of the file being visited.  */
+    size_t pathlen;             /* The length of its directory name.  */
+    size_t pathmax;             /* Space allocated for PATH.  */
+    char **found;               /* The names of matching files.  */
+    unsigned int nfound;
+    unsigned int maxfound;
+  };
+
+static void
+tree_walk_file (const char *name, int isdir, void *arg)
+{
+  struct tree_walk *tw = arg;
+  size_t dirlen = tw->pathlen;
+  size_t len = strlen (name);
+  unsigned int i;
+
+  if (dirlen + 1 + len + 1 > tw->pathmax)
+    {
+      tw->pathmax = (dirlen + 1 + len + 1) * 2;
+      tw->path = xrealloc (tw->path, tw->pathmax);
+    }
+  tw->path[dirlen] = '/';
+  memcpy (tw->path + dirlen + 1, name, len + 1);
+
+  for (i = 0; i < tw->npatterns; ++i)
+    if (fnmatch (tw->patterns[i], name, FNM_PERIOD) == 0)
+      {
+        if (tw->nfound == tw->maxfound)
+          {
+            tw->maxfound = tw->maxfound ? tw->maxfound * 2 : 64;
+            tw->found = xrealloc (tw->found, tw->maxfound * sizeof (char *));
+          }
+        tw->found[tw->nfound++] = xstrdup (tw->path);
+        break;
+      }
+
+  /* Don't search hidden directories, such as those of version control
+     systems.  */
+  if (isdir && name[0] != '.')
+    {
+      tw->pathlen = dirlen + 1 + len;
+      dir_contents_foreach (tw->path, tree_walk_file, tw);
+      tw->pathlen = dirlen;
+    }
+}
+
+static char *
+func_wildcard_tree (char *o, char **argv, const char *funcname UNUSED)
+{
+  struct tree_walk tw = {0};
+  const char *p;
+  const char *dir;
+  size_t len;
+  unsigned int start;
+  unsigned int i;
+  int doneany = 0;
+
+  p = argv[1];
+  while (find_next_token (&p, NULL) != NULL)
+    ++tw.npatterns;
+  if (tw.npatterns == 0)
+    return o;
+
+  tw.patterns = xmalloc (tw.npatterns * sizeof (char *));
+  p = argv[1];
+  for (i = 0; i < tw.npatterns; ++i)
+    {
+      const char *pat = find_next_token (&p, &len);
+      tw.patterns[i] = xstrndup (pat, len);
+    }
+
+  p = argv[0];
+  while ((dir = find_next_token (&p, &len)) != NULL)
+    {
+      /* Don't add a second slash after the directory name.  */
+      while (len > 1 && dir[len-1] == '/')
+        --len;
+
+      if (len + 1 > tw.pathmax)
+        {
+          tw.pathmax = (len + 1) * 2;
+          tw.path = xrealloc (tw.path, tw.pathmax);
+        }
+      memcpy (tw.path, dir, len);
+      tw.path[len] = '\0';
+      tw.pathlen = len == 1 && dir[0] == '/' ? 0 : len;
+
+      start = tw.nfound;
+      dir_contents_foreach (tw.path, tree_walk_file, &tw);
+
+      /* Sort the names found under each directory, as $(wildcard) does.  */
+      qsort (tw.found + start, tw.nfound - start, sizeof (char *),
+             alpha_compare);
+    }
+
+  for (i = 0; i < tw.nfound; ++i)
+    {
+      o = variable_buffer_output (o, tw.found[i], strlen (tw.found[i]));
+      o = variable_buffer_output (o, " ", 1);
+      free (tw.found[i]);
+      doneany = 1;
+    }
+
+  if (doneany)
+    /* Kill last space.  */
+    --o;
+
+  for (i = 0; i < tw.npatterns; ++i)
+    free (tw.patterns[i]);
+  free (tw.patterns);
+  free (tw.found);
+  free (tw.path);
+
+  return o;
+}
+
 /*
   $(eval <makefile string>)
 
@@ -1601,6 +1833,7 @@ fold_newlines (char *buffer, size_t *length, int trim_newlines)
 
 pid_t shell_function_pid = 0;
 static int shell_function_completed;
+static int shell_function_status;
 
 void
 shell_completed (int exit_code, int exit_sig)
@@ -1616,6 +1849,8 @@ shell_completed (int exit_code, int exit_sig)
   if (exit_code == 0 && exit_sig > 0)
     exit_code = 128 + exit_sig;
 
+  shell_function_status = exit_code;
+
   sprintf (buf, "%d", exit_code);
   define_variable_cname (".SHELLSTATUS", buf, o_override, 0);
 }
@@ -1814,7 +2049,8 @@ msdos_openpipe (int* pipedes, int *pidp, char *text)
 /* VMS can't do $(shell ...)  */
 
 char *
-func_shell_base (char *o, char **argv, int trim_newlines)
+func_shell_base (char *o, char **argv, const char *inputs UNUSED,
+                 int trim_newlines)
 {
   fprintf (stderr, "This platform does not support shell\n");
   die (MAKE_TROUBLE);
@@ -1822,13 +2058,15 @@ func_shell_base (char *o, char **argv, int trim_newlines)
 }
 
 #define func_shell 0
+#define func_shell_cached 0
 
 #else
 char *
-func_shell_base (char *o, char **argv, int trim_newlines)
+func_shell_base (char *o, char **argv, const char *inputs, int trim_newlines)
 {
   struct childbase child = {0};
   char *batch_filename = NULL;
+  char *entry = NULL;
   int errfd;
 #if MK_OS_DOS
   FILE *fpipe;
@@ -1848,7 +2086,7 @@ func_shell_base (char *o, char **argv, int trim_newlines)
 
   /* Construct the argument list.  */
   command_argv = construct_command_argv (argv[0], NULL, NULL, 0,
-                                         &batch_filename);
+                                         &batch_filename, NULL, NULL);
   if (command_argv == 0)
     {
 #if MK_OS_W32
@@ -1866,6 +2104,57 @@ func_shell_base (char *o, char **argv, int trim_newlines)
 
   child.environment = target_environment (NULL, 0);
 
+  /* If the caller listed the inputs of the command, use the output of an
+     earlier run with the same command, environment and inputs.  */
+  if (inputs)
+    {
+      entry = cache_shell_entry (argv[0], command_argv, inputs,
+                                 child.environment);
+      if (entry)
+        {
+          size_t len;
+          char *buffer = cache_shell_restore (entry, &len);
+
+          if (buffer)
+            {
+#if MK_OS_W32
+              just_print_flag = j_p_f;
+#endif
+              shell_completed (0, 0);
+              fold_newlines (buffer, &len, trim_newlines);
+              o = variable_buffer_output (o, buffer, len);
+              free (buffer);
+              goto done;
+            }
+        }
+    }
+
+  /* With .SHELL_COPROCESS, try to have the coprocess run the command rather
+     than starting a new shell for it.  Its errors go to our stderr.  */
+  if (shell_coprocess && errfd == FD_STDERR
+      && is_shell_command_argv (command_argv))
+    {
+      char *buffer;
+      size_t len;
+      int status;
+
+      if (coprocess_run (command_argv[0], command_argv[1][1] == 'e',
+                         command_argv[2], child.environment,
+                         &buffer, &len, &status) == 0)
+        {
+          /* The command may have changed files, as if a child had
+             finished.  */
+          ++command_count;
+          shell_completed (status, 0);
+          if (entry && status == 0)
+            cache_shell_store (entry, buffer, len);
+          fold_newlines (buffer, &len, trim_newlines);
+          o = variable_buffer_output (o, buffer, len);
+          free (buffer);
+          goto done;
+        }
+    }
+
 #if MK_OS_DOS
   fpipe = msdos_openpipe (pipedes, &pid, argv[0]);
   if (pipedes[0] < 0)
@@ -1967,6 +2256,10 @@ func_shell_base (char *o, char **argv, int trim_newlines)
     while (shell_function_completed == 0)
       reap_children (1, 0);
 
+    /* Only save the output of commands that succeeded.  */
+    if (entry && shell_function_completed > 0 && shell_function_status == 0)
+      cache_shell_store (entry, buffer, i);
+
     if (batch_filename)
       {
         DB (DB_VERBOSE, (_("Cleaning up temporary batch file %s\n"),
@@ -1992,6 +2285,7 @@ func_shell_base (char *o, char **argv, int trim_newlines)
       free (command_argv);
     }
 
+  free (entry);
   free_childbase (&child);
 
   return o;
@@ -2000,7 +2294,23 @@ func_shell_base (char *o, char **argv, int trim_newlines)
 static char *
 func_shell (char *o, char **argv, const char *funcname UNUSED)
 {
-  return func_shell_base (o, argv, 1);
+  return func_shell_base (o, argv, NULL, 1);
+}
+
+/* $(shell-cached INPUTS,COMMAND)
+
+   Like $(shell COMMAND), but the output is saved in the cache and reused
+   as long as the command, its environment, and the contents of the files
+   named in INPUTS don't change.  */
+static char *
+func_shell_cached (char *o, char **argv, const char *funcname UNUSED)
+{
+  char *args[2];
+
+  args[0] = argv[1];
+  args[1] = NULL;
+
+  return func_shell_base (o, args, argv[0], 1);
 }
 #endif  /* !MK_OS_VMS */
 
@@ -2423,6 +2733,7 @@ static struct function_table_entry function_table_init[] =
   FT_ENTRY ("patsubst",      3,  3,  1,  func_patsubst),
   FT_ENTRY ("realpath",      0,  1,  1,  func_realpath),
   FT_ENTRY ("shell",         0,  1,  1,  func_shell),
+  FT_ENTRY ("shell-cached",  2,  2,  1,  func_shell_cached),
   FT_ENTRY ("sort",          0,  1,  1,  func_sort),
   FT_ENTRY ("strip",         0,  1,  1,  func_strip),
   FT_ENTRY ("subst",         3,  3,  1,  func_subst),
@@ -2430,6 +2741,7 @@ static struct function_table_entry function_table_init[] =
   FT_ENTRY ("value",         0,  1,  1,  func_value),
   FT_ENTRY ("warning",       0,  1,  1,  func_error),
   FT_ENTRY ("wildcard",      0,  1,  1,  func_wildcard),
+  FT_ENTRY ("wildcard-tree", 2,  2,  1,  func_wildcard_tree),
   FT_ENTRY ("word",          2,  2,  1,  func_word),
   FT_ENTRY ("wordlist",      3,  3,  1,  func_wordlist),
   FT_ENTRY ("words",         0,  1,  1,  func_words),
@@ -94,4 +94,104 @@ GMK_EXPORT void gmk_add_function (const char *name, gmk_func_ptr func,
 #define GMK_FUNC_DEFAULT    0x00
 #define GMK_FUNC_NOEXPAND   0x01
 
+/* Define a variable NAME whose value is computed by FUNC the first time the
+   variable is referenced, and then kept.  FUNC is passed the name of the
+   variable and returns its value in a string allocated with gmk_alloc(), or
+   NULL for an empty value.  If the variable is redefined before it is used,
+   FUNC is never called.
+
+   FLAGS is one of the GMK_VAR_* values: a simply-expanded variable has
+   exactly the value FUNC returns, while the value of a recursively-expanded
+   variable is expanded each time it is referenced.  */
+typedef char *(*gmk_var_ptr)(const char *name);
+
+GMK_EXPORT void gmk_add_lazy_variable (const char *name, gmk_var_ptr func,
+                                       unsigned int flags);
+
+#define GMK_VAR_DEFAULT     0x00
+#define GMK_VAR_RECURSIVE   0x01
+
+/* Hooks let a loaded object follow GNU Make as it works.  Each hook is
+   given a pointer to a description of the job or file, which is only valid
+   until the hook returns.  More members may be added at the end of these
+   structures in later versions.
+
+   Hooks registered by the setup method of an object are removed when that
+   object is unloaded.  */
+
+/* A job is the recipe run to remake a target.  */
+typedef struct
+  {
+    const char *target;             /* The target being remade.  */
+    const char *const *commands;    /* The expanded recipe lines.  */
+    unsigned int ncommands;         /* The number of recipe lines.  */
+
+    /* The rest are only set when the job has finished.  */
+    int failed;                     /* Nonzero if the recipe failed.  */
+    int exit_status;                /* Exit status of the last command.  */
+    int exit_signal;                /* Signal that killed it, or 0.  */
+    double elapsed;                 /* Wall clock time, in seconds.  */
+    double user_time;               /* CPU time of the commands, in seconds,
+                                       where the system reports it.  */
+    double system_time;
+    unsigned long max_rss;          /* Largest resident set, in kilobytes.  */
+    unsigned long in_blocks;        /* Block input and output operations.  */
+    unsigned long out_blocks;
+  } gmk_job;
+
+typedef struct
+  {
+    const char *name;
+    int status;                     /* When remade: nonzero if it failed.  */
+    int ran;                        /* When remade: nonzero if a recipe was
+                                       run (or printed, with -n).  */
+  } gmk_file;
+
+typedef void (*gmk_job_hook)(const gmk_job *job);
+typedef void (*gmk_file_hook)(const gmk_file *file);
+
+/* Register HOOK to be called just before the first command of a job is
+   started.  */
+GMK_EXPORT void gmk_add_job_start_hook (gmk_job_hook hook);
+
+/* Register HOOK to be called when the last command of a job has finished.  */
+GMK_EXPORT void gmk_add_job_finish_hook (gmk_job_hook hook);
+
+/* Register HOOK to be called each time GNU Make considers whether a file
+   needs to be remade.  */
+GMK_EXPORT void gmk_add_file_considered_hook (gmk_file_hook hook);
+
+/* Register HOOK to be called when GNU Make has finished remaking a file,
+   or found that nothing needed to be done.  */
+GMK_EXPORT void gmk_add_file_remade_hook (gmk_file_hook hook);
+
+/* A timestamp provider tells GNU Make about files it can answer for more
+   cheaply than the file system, for example files in a virtual file system
+   or a content-addressed store.  It is given an array of queries; for each
+   one it sets RESULT, and SECONDS and NANOSECONDS for GMK_TIME_MODIFIED.  */
+typedef struct
+  {
+    const char *name;               /* The file GNU Make wants to know about.  */
+    int result;                     /* One of GMK_TIME_*, below.  */
+    long long seconds;              /* Last modification time, since the
+                                       epoch.  */
+    long nanoseconds;
+  } gmk_timestamp;
+
+#define GMK_TIME_UNKNOWN      0     /* No answer: ask the file system.  */
+#define GMK_TIME_MODIFIED     1     /* The file was last modified at SECONDS
+                                       and NANOSECONDS.  */
+#define GMK_TIME_UNCHANGED    2     /* The file is unchanged since the last
+                                       build: treat it as if given with -o.  */
+#define GMK_TIME_NONEXISTENT  3     /* The file does not exist.  */
+
+typedef void (*gmk_timestamp_provider)(gmk_timestamp *files,
+                                       unsigned int count);
+
+/* Register PROVIDER to be asked about files whose names start with PREFIX,
+   before GNU Make looks at the file system.  An empty PREFIX matches every
+   file.  */
+GMK_EXPORT void gmk_add_timestamp_provider (const char *prefix,
+                                            gmk_timestamp_provider provider);
+
 #endif  /* _GNUMAKE_H_ */
@@ -18,6 +18,12 @@ this program.  If not, see <https://www.gnu.org/licenses/>.  */
 #include "hash.h"
 #include <assert.h>
 
+#if defined __SSE2__
+# include <emmintrin.h>
+#elif defined __ARM_NEON && defined __aarch64__
+# include <arm_neon.h>
+#endif
+
 #define CALLOC(t, n) ((t *) xcalloc (sizeof (t) * (n)))
 #define MALLOC(t, n) ((t *) xmalloc (sizeof (t) * (n)))
 #define REALLOC(o, t, n) ((t *) xrealloc ((o), sizeof (t) * (n)))
@@ -26,15 +32,171 @@ this program.  If not, see <https://www.gnu.org/licenses/>.  */
 static void hash_rehash __P((struct hash_table* ht));
 static unsigned long round_up_2 __P((unsigned long rough));
 
-/* Implement double hashing with open addressing.  The table size is
-   always a power of two.  The secondary ('increment') hash function
-   is forced to return an odd-value, in order to be relatively prime
-   to the table size.  This guarantees that the increment can
-   potentially hit every slot in the table during collision
-   resolution.  */
+/* Implement open addressing with a control byte for each slot, in the
+   style of the "Swiss table".  The control byte of an occupied slot holds
+   7 bits of the item's hash (its tag); otherwise it marks the slot empty or
+   deleted.  Lookups examine the control bytes of a group of slots at a
+   time, with SIMD instructions where available, and only call the
+   comparison function for items whose tag matches.  The table size is
+   always a power of two, at least one group.  Groups are probed at
+   triangular offsets, which visits every slot in the table.
+
+   The item pointers are kept in ht_vec as before, with hash_deleted_item
+   in deleted slots, so callers may still walk the vector directly.  */
 
 void *hash_deleted_item = &hash_deleted_item;
 
+#define GROUP_SIZE      16
+
+#define CTRL_EMPTY      0x80
+#define CTRL_DELETED    0xFE
+
+/* The number of slots of the old vector that each lookup moves, when a
+   table is growing incrementally.  */
+#define REHASH_STEP     64
+
+/* Mix the value returned by the hash function, whose low bits may be weak
+   (for example when hashing addresses), and take the tag from the top 7
+   bits and the starting slot from the rest.  */
+
+static unsigned int
+hash_mix (unsigned long h)
+{
+  unsigned int x = (unsigned int) h;
+
+#if !defined(HAVE_LIMITS_H) || ULONG_MAX > 4294967295
+  x ^= (unsigned int) (h >> 32);
+#endif
+
+  x *= 0x9E3779B1U;
+  return x ^ (x >> 15);
+}
+
+#define HASH_TAG(_x)    ((unsigned char) (((_x) >> 25) & 0x7F))
+
+/* Return a mask with bit N set for each byte N of the group of control
+   bytes at CTRL that is equal to TAG, or that has its high bit set (that
+   is, the slot is empty or deleted).  */
+
+#if defined __SSE2__
+
+static unsigned int
+group_match (const unsigned char *ctrl, unsigned char tag)
+{
+  __m128i group = _mm_loadu_si128 ((const __m128i *) ctrl);
+  return (unsigned int) _mm_movemask_epi8 (
+    _mm_cmpeq_epi8 (group, _mm_set1_epi8 ((char) tag)));
+}
+
+static unsigned int
+group_match_vacant (const unsigned char *ctrl)
+{
+  return (unsigned int) _mm_movemask_epi8 (
+    _mm_loadu_si128 ((const __m128i *) ctrl));
+}
+
+#elif defined __ARM_NEON && defined __aarch64__
+
+/* NEON has no equivalent of movemask: weight the bytes of the comparison
+   and add up each half.  */
+
+static unsigned int
+neon_mask (uint8x16_t cmp)
+{
+  static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128,
+                                       1, 2, 4, 8, 16, 32, 64, 128 };
+  uint8x16_t bits = vandq_u8 (cmp, vld1q_u8 (weights));
+  return (unsigned int) vaddv_u8 (vget_low_u8 (bits))
+         | ((unsigned int) vaddv_u8 (vget_high_u8 (bits)) << 8);
+}
+
+static unsigned int
+group_match (const unsigned char *ctrl, unsigned char tag)
+{
+  return neon_mask (vceqq_u8 (vld1q_u8 (ctrl), vdupq_n_u8 (tag)));
+}
+
+static unsigned int
+group_match_vacant (const unsigned char *ctrl)
+{
+  return neon_mask (vcltq_s8 (vreinterpretq_s8_u8 (vld1q_u8 (ctrl)),
+                              vdupq_n_s8 (0)));
+}
+
+#else
+
+static unsigned int
+group_match (const unsigned char *ctrl, unsigned char tag)
+{
+  unsigned int mask = 0;
+  int i;
+
+  for (i = 0; i < GROUP_SIZE; ++i)
+    if (ctrl[i] == tag)
+      mask |= 1U << i;
+  return mask;
+}
+
+static unsigned int
+group_match_vacant (const unsigned char *ctrl)
+{
+  unsigned int mask = 0;
+  int i;
+
+  for (i = 0; i < GROUP_SIZE; ++i)
+    if (ctrl[i] & 0x80)
+      mask |= 1U << i;
+  return mask;
+}
+
+#endif
+
+static unsigned int
+group_match_empty (const unsigned char *ctrl)
+{
+  return group_match (ctrl, CTRL_EMPTY);
+}
+
+/* Return the index of the lowest bit set in MASK, which is not zero.  */
+
+static unsigned int
+lowest_bit (unsigned int mask)
+{
+#if defined __GNUC__
+  return (unsigned int) __builtin_ctz (mask);
+#else
+  unsigned int n = 0;
+  while ((mask & 1) == 0)
+    {
+      mask >>= 1;
+      ++n;
+    }
+  return n;
+#endif
+}
+
+/* Set the control byte for slot N of a table of SIZE slots.  The first group
+   of control bytes is repeated after the end, so that a group can be loaded
+   from any slot without wrapping around.  */
+
+static void
+set_ctrl (unsigned char *ctrl, unsigned long size, unsigned long n,
+          unsigned char c)
+{
+  ctrl[n] = c;
+  if (n < GROUP_SIZE)
+    ctrl[size + n] = c;
+}
+
+static void
+alloc_vectors (struct hash_table *ht)
+{
+  ht->ht_vec = CALLOC (void *, ht->ht_size);
+  ht->ht_ctrl = MALLOC (unsigned char, ht->ht_size + GROUP_SIZE);
+  memset (ht->ht_ctrl, CTRL_EMPTY, ht->ht_size + GROUP_SIZE);
+  ht->ht_last_slot = 0;
+}
+
 /* Force the table size to be a power of two, possibly rounding up the
    given size.  */
 
@@ -42,17 +204,11 @@ void
 hash_init (struct hash_table *ht, unsigned long size,
            hash_func_t hash_1, hash_func_t hash_2, hash_cmp_func_t hash_cmp)
 {
-  ht->ht_size = round_up_2 (size);
+  ht->ht_size = round_up_2 (size < GROUP_SIZE ? GROUP_SIZE : size);
   ht->ht_empty_slots = ht->ht_size;
-  ht->ht_vec = CALLOC (void *, ht->ht_size);
-  if (ht->ht_vec == 0)
-    {
-      fprintf (stderr, _("can't allocate %lu bytes for hash table: memory exhausted"),
-               ht->ht_size * (unsigned long) sizeof (void *));
-      exit (MAKE_TROUBLE);
-    }
+  alloc_vectors (ht);
 
-  ht->ht_capacity = ht->ht_size - (ht->ht_size / 16); /* 93.75% loading factor */
+  ht->ht_capacity = ht->ht_size - (ht->ht_size / 8); /* 87.5% loading factor */
   ht->ht_fill = 0;
   ht->ht_collisions = 0;
   ht->ht_lookups = 0;
@@ -60,6 +216,22 @@ hash_init (struct hash_table *ht, unsigned long size,
   ht->ht_hash_1 = hash_1;
   ht->ht_hash_2 = hash_2;
   ht->ht_compare = hash_cmp;
+  ht->ht_incremental = 0;
+  ht->ht_old_vec = 0;
+  ht->ht_old_ctrl = 0;
+  ht->ht_old_size = 0;
+  ht->ht_old_next = 0;
+}
+
+/* Grow HT incrementally: rather than moving every item to the new vector
+   at once, move a few with each lookup, so that no single insertion takes
+   a long time.  Until all have been moved, some items are only in the old
+   vector; call hash_finish_rehash before walking ht_vec directly.  */
+
+void
+hash_set_incremental (struct hash_table *ht)
+{
+  ht->ht_incremental = 1;
 }
 
 /* Load an array of items into 'ht'.  */
@@ -76,44 +248,168 @@ hash_load (struct hash_table *ht, void *item_table,
     }
 }
 
-/* Returns the address of the table slot matching 'key'.  If 'key' is
-   not found, return the address of an empty slot suitable for
-   inserting 'key'.  The caller is responsible for incrementing
-   ht_fill on insertion.  */
+/* Look for KEY, whose mixed hash is HASH, in the vector VEC of SIZE slots
+   with control bytes CTRL.  Return its slot, or null if it's not there.
+   If VACANT is not null, set it to the slot where KEY should be inserted.  */
 
-void **
-hash_find_slot (struct hash_table *ht, const void *key)
+static void **
+probe (struct hash_table *ht, void **vec, const unsigned char *ctrl,
+       unsigned long size, const void *key, unsigned int hash,
+       void ***vacant)
 {
-  void **slot;
   void **deleted_slot = 0;
-  unsigned int hash_2 = 0;
-  unsigned int hash_1 = (*ht->ht_hash_1) (key);
+  unsigned char tag = HASH_TAG (hash);
+  unsigned long mask = size - 1;
+  unsigned long pos = hash & mask;
+  unsigned long stride = 0;
 
-  ht->ht_lookups++;
   for (;;)
     {
-      hash_1 &= (ht->ht_size - 1);
-      slot = &ht->ht_vec[hash_1];
+      const unsigned char *group = &ctrl[pos];
+      unsigned int match = group_match (group, tag);
+      unsigned int empty;
 
-      if (*slot == 0)
-        return (deleted_slot ? deleted_slot : slot);
-      if (*slot == hash_deleted_item)
-        {
-          if (deleted_slot == 0)
-            deleted_slot = slot;
-        }
-      else
+      for (; match; match &= match - 1)
         {
+          void **slot = &vec[(pos + lowest_bit (match)) & mask];
           if (key == *slot)
             return slot;
           if ((*ht->ht_compare) (key, *slot) == 0)
             return slot;
           ht->ht_collisions++;
         }
-      if (!hash_2)
-          hash_2 = (*ht->ht_hash_2) (key) | 1;
-      hash_1 += hash_2;
+
+      /* An empty slot ends the search.  */
+      empty = group_match_empty (group);
+      if (deleted_slot == 0)
+        {
+          unsigned int deleted = group_match_vacant (group) & ~empty;
+          if (deleted)
+            deleted_slot = &vec[(pos + lowest_bit (deleted)) & mask];
+        }
+      if (empty)
+        {
+          if (vacant)
+            *vacant = deleted_slot ? deleted_slot
+                                   : &vec[(pos + lowest_bit (empty)) & mask];
+          return 0;
+        }
+
+      stride += GROUP_SIZE;
+      pos = (pos + stride) & mask;
+    }
+}
+
+/* Put ITEM, with mixed hash HASH, into an empty or deleted slot of the
+   current vector.  It must not be in the table already.  */
+
+static void
+place_item (struct hash_table *ht, void *item, unsigned int hash)
+{
+  unsigned long mask = ht->ht_size - 1;
+  unsigned long pos = hash & mask;
+  unsigned long stride = 0;
+  unsigned int vacant;
+
+  while ((vacant = group_match_vacant (&ht->ht_ctrl[pos])) == 0)
+    {
+      stride += GROUP_SIZE;
+      pos = (pos + stride) & mask;
+    }
+  pos = (pos + lowest_bit (vacant)) & mask;
+
+  if (ht->ht_vec[pos] == 0)
+    ht->ht_empty_slots--;
+  ht->ht_vec[pos] = item;
+  set_ctrl (ht->ht_ctrl, ht->ht_size, pos, HASH_TAG (hash));
+}
+
+/* Move the items in the next COUNT slots of the old vector to the current
+   one, and free the old vector once it has all been moved.  */
+
+static void
+rehash_step (struct hash_table *ht, unsigned long count)
+{
+  unsigned long end = ht->ht_old_next + count;
+
+  if (end > ht->ht_old_size)
+    end = ht->ht_old_size;
+
+  for (; ht->ht_old_next < end; ht->ht_old_next++)
+    {
+      void *item = ht->ht_old_vec[ht->ht_old_next];
+      if (! HASH_VACANT (item))
+        place_item (ht, item, hash_mix ((*ht->ht_hash_1) (item)));
+    }
+
+  if (ht->ht_old_next == ht->ht_old_size)
+    {
+      free (ht->ht_old_vec);
+      free (ht->ht_old_ctrl);
+      ht->ht_old_vec = 0;
+      ht->ht_old_ctrl = 0;
+      ht->ht_old_size = 0;
+      ht->ht_old_next = 0;
+    }
+}
+
+/* Finish moving items from the old vector, so that all of them are in
+   ht_vec.  */
+
+void
+hash_finish_rehash (struct hash_table *ht)
+{
+  if (ht->ht_old_vec)
+    rehash_step (ht, ht->ht_old_size);
+}
+
+/* Returns the address of the table slot matching 'key'.  If 'key' is
+   not found, return the address of an empty slot suitable for
+   inserting 'key'.  The caller is responsible for incrementing
+   ht_fill on insertion.  */
+
+void **
+hash_find_slot (struct hash_table *ht, const void *key)
+{
+  void **slot;
+  void **vacant;
+  unsigned int hash = hash_mix ((*ht->ht_hash_1) (key));
+
+  ht->ht_lookups++;
+
+  if (ht->ht_old_vec)
+    rehash_step (ht, REHASH_STEP);
+
+  slot = probe (ht, ht->ht_vec, ht->ht_ctrl, ht->ht_size, key, hash, &vacant);
+  if (slot)
+    return slot;
+
+  /* If we're still moving items to the current vector, the key may be in
+     the old one.  If so, move it now, so that we can return its slot.  */
+  if (ht->ht_old_vec)
+    {
+      slot = probe (ht, ht->ht_old_vec, ht->ht_old_ctrl, ht->ht_old_size,
+                    key, hash, 0);
+      if (slot)
+        {
+          if (*vacant == 0)
+            ht->ht_empty_slots--;
+          *vacant = *slot;
+          set_ctrl (ht->ht_ctrl, ht->ht_size, vacant - ht->ht_vec,
+                    HASH_TAG (hash));
+          *slot = hash_deleted_item;
+          set_ctrl (ht->ht_old_ctrl, ht->ht_old_size, slot - ht->ht_old_vec,
+                    CTRL_DELETED);
+          return vacant;
+        }
     }
+
+  /* Remember the tag, so that hash_insert_at needn't compute it again if
+     it's given this slot before any other lookup.  */
+  ht->ht_last_slot = vacant;
+  ht->ht_last_tag = HASH_TAG (hash);
+  ht->ht_last_lookup = ht->ht_lookups;
+  return vacant;
 }
 
 void *
@@ -138,6 +434,15 @@ hash_insert_at (struct hash_table *ht, const void *item, const void *slot)
   const void *old_item = *(void **) slot;
   if (HASH_VACANT (old_item))
     {
+      unsigned char tag;
+
+      if (slot == ht->ht_last_slot && ht->ht_last_lookup == ht->ht_lookups)
+        tag = ht->ht_last_tag;
+      else
+        tag = HASH_TAG (hash_mix ((*ht->ht_hash_1) (item)));
+      set_ctrl (ht->ht_ctrl, ht->ht_size, (void **) slot - ht->ht_vec, tag);
+      ht->ht_last_slot = 0;
+
       ht->ht_fill++;
       if (old_item == 0)
         ht->ht_empty_slots--;
@@ -167,6 +472,8 @@ hash_delete_at (struct hash_table *ht, const void *slot)
   if (!HASH_VACANT (item))
     {
       *(void const **) slot = hash_deleted_item;
+      set_ctrl (ht->ht_ctrl, ht->ht_size, (void **) slot - ht->ht_vec,
+                CTRL_DELETED);
       ht->ht_fill--;
       return item;
     }
@@ -177,8 +484,12 @@ hash_delete_at (struct hash_table *ht, const void *slot)
 void
 hash_free_items (struct hash_table *ht)
 {
-  void **vec = ht->ht_vec;
-  void **end = &vec[ht->ht_size];
+  void **vec;
+  void **end;
+
+  hash_finish_rehash (ht);
+  vec = ht->ht_vec;
+  end = &vec[ht->ht_size];
   for (; vec < end; vec++)
     {
       void *item = *vec;
@@ -186,6 +497,8 @@ hash_free_items (struct hash_table *ht)
         free (item);
       *vec = 0;
     }
+  memset (ht->ht_ctrl, CTRL_EMPTY, ht->ht_size + GROUP_SIZE);
+  ht->ht_last_slot = 0;
   ht->ht_fill = 0;
   ht->ht_empty_slots = ht->ht_size;
 }
@@ -193,10 +506,16 @@ hash_free_items (struct hash_table *ht)
 void
 hash_delete_items (struct hash_table *ht)
 {
-  void **vec = ht->ht_vec;
-  void **end = &vec[ht->ht_size];
+  void **vec;
+  void **end;
+
+  hash_finish_rehash (ht);
+  vec = ht->ht_vec;
+  end = &vec[ht->ht_size];
   for (; vec < end; vec++)
     *vec = 0;
+  memset (ht->ht_ctrl, CTRL_EMPTY, ht->ht_size + GROUP_SIZE);
+  ht->ht_last_slot = 0;
   ht->ht_fill = 0;
   ht->ht_collisions = 0;
   ht->ht_lookups = 0;
@@ -216,6 +535,12 @@ hash_free (struct hash_table *ht, int free_items)
     }
   free (ht->ht_vec);
   ht->ht_vec = 0;
+  free (ht->ht_ctrl);
+  ht->ht_ctrl = 0;
+  free (ht->ht_old_vec);
+  ht->ht_old_vec = 0;
+  free (ht->ht_old_ctrl);
+  ht->ht_old_ctrl = 0;
   ht->ht_capacity = 0;
 }
 
@@ -223,8 +548,10 @@ void
 hash_map (struct hash_table *ht, hash_map_func_t map)
 {
   void **slot;
-  void **end = &ht->ht_vec[ht->ht_size];
+  void **end;
 
+  hash_finish_rehash (ht);
+  end = &ht->ht_vec[ht->ht_size];
   for (slot = ht->ht_vec; slot < end; slot++)
     {
       if (!HASH_VACANT (*slot))
@@ -236,8 +563,10 @@ void
 hash_map_arg (struct hash_table *ht, hash_map_arg_func_t map, void *arg)
 {
   void **slot;
-  void **end = &ht->ht_vec[ht->ht_size];
+  void **end;
 
+  hash_finish_rehash (ht);
+  end = &ht->ht_vec[ht->ht_size];
   for (slot = ht->ht_vec; slot < end; slot++)
     {
       if (!HASH_VACANT (*slot))
@@ -250,28 +579,33 @@ hash_map_arg (struct hash_table *ht, hash_map_arg_func_t map, void *arg)
 static void
 hash_rehash (struct hash_table *ht)
 {
-  unsigned long old_ht_size = ht->ht_size;
-  void **old_vec = ht->ht_vec;
-  void **ovp;
+  unsigned long old_ht_size;
+  void **old_vec;
+  unsigned char *old_ctrl;
+
+  /* A table that grows incrementally can't start again until it has
+     finished moving the items of the last rehash.  */
+  hash_finish_rehash (ht);
+
+  old_ht_size = ht->ht_size;
+  old_vec = ht->ht_vec;
+  old_ctrl = ht->ht_ctrl;
 
   if (ht->ht_fill >= ht->ht_capacity)
     {
       ht->ht_size *= 2;
-      ht->ht_capacity = ht->ht_size - (ht->ht_size >> 4);
+      ht->ht_capacity = ht->ht_size - (ht->ht_size >> 3);
     }
   ht->ht_rehashes++;
-  ht->ht_vec = CALLOC (void *, ht->ht_size);
+  alloc_vectors (ht);
+  ht->ht_empty_slots = ht->ht_size;
 
-  for (ovp = old_vec; ovp < &old_vec[old_ht_size]; ovp++)
-    {
-      if (! HASH_VACANT (*ovp))
-        {
-          void **slot = hash_find_slot (ht, *ovp);
-          *slot = *ovp;
-        }
-    }
-  ht->ht_empty_slots = ht->ht_size - ht->ht_fill;
-  free (old_vec);
+  ht->ht_old_vec = old_vec;
+  ht->ht_old_ctrl = old_ctrl;
+  ht->ht_old_size = old_ht_size;
+  ht->ht_old_next = 0;
+
+  rehash_step (ht, ht->ht_incremental ? REHASH_STEP : old_ht_size);
 }
 
 void
@@ -286,6 +620,21 @@ hash_print_stats (struct hash_table *ht, FILE *out_FILE)
             : 0));
 }
 
+/* Return the number of bytes used by the vectors of HT.  */
+
+unsigned long
+hash_memory_size (const struct hash_table *ht)
+{
+  unsigned long bytes = 0;
+
+  if (ht->ht_vec)
+    bytes += ht->ht_size * sizeof (void *) + ht->ht_size + GROUP_SIZE;
+  if (ht->ht_old_vec)
+    bytes += ht->ht_old_size * sizeof (void *) + ht->ht_old_size + GROUP_SIZE;
+
+  return bytes;
+}
+
 /* Dump all items into a NULL-terminated vector.  Use the
    user-supplied vector, or malloc one.  */
 
@@ -294,7 +643,10 @@ hash_dump (struct hash_table *ht, void **vector_0, qsort_cmp_t compare)
 {
   void **vector;
   void **slot;
-  void **end = &ht->ht_vec[ht->ht_size];
+  void **end;
+
+  hash_finish_rehash (ht);
+  end = &ht->ht_vec[ht->ht_size];
 
   if (vector_0 == 0)
     vector_0 = MALLOC (void *, ht->ht_fill + 1);
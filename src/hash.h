@@ -41,8 +41,9 @@ typedef void (*hash_map_arg_func_t) __P((void const *item, void *arg));
 struct hash_table
 {
   void **ht_vec;
+  unsigned char *ht_ctrl;	/* control byte for each slot (see hash.c) */
   hash_func_t ht_hash_1;	/* primary hash function */
-  hash_func_t ht_hash_2;	/* secondary hash function */
+  hash_func_t ht_hash_2;	/* secondary hash function (unused) */
   hash_cmp_func_t ht_compare;	/* comparison function */
   unsigned long ht_size;	/* total number of slots (power of 2) */
   unsigned long ht_capacity;	/* usable slots, limited by loading-factor */
@@ -51,12 +52,22 @@ struct hash_table
   unsigned long ht_collisions;	/* # of failed calls to comparison function */
   unsigned long ht_lookups;	/* # of queries */
   unsigned int ht_rehashes;	/* # of times we've expanded table */
+  void **ht_last_slot;		/* empty slot found by the last lookup... */
+  unsigned long ht_last_lookup;	/* ...and the value of ht_lookups then */
+  unsigned char ht_last_tag;	/* ...and the tag of its key */
+  int ht_incremental;		/* nonzero to grow incrementally */
+  void **ht_old_vec;		/* items not yet moved after growing */
+  unsigned char *ht_old_ctrl;	/* control bytes for ht_old_vec */
+  unsigned long ht_old_size;	/* # of slots in ht_old_vec */
+  unsigned long ht_old_next;	/* next slot of ht_old_vec to move */
 };
 
 typedef int (*qsort_cmp_t) __P((void const *, void const *));
 
 void hash_init __P((struct hash_table *ht, unsigned long size,
                     hash_func_t hash_1, hash_func_t hash_2, hash_cmp_func_t hash_cmp));
+void hash_set_incremental __P((struct hash_table *ht));
+void hash_finish_rehash __P((struct hash_table *ht));
 void hash_load __P((struct hash_table *ht, void *item_table,
                     unsigned long cardinality, unsigned long size));
 void **hash_find_slot __P((struct hash_table *ht, void const *key));
@@ -71,6 +82,7 @@ void hash_free __P((struct hash_table *ht, int free_items));
 void hash_map __P((struct hash_table *ht, hash_map_func_t map));
 void hash_map_arg __P((struct hash_table *ht, hash_map_arg_func_t map, void *arg));
 void hash_print_stats __P((struct hash_table *ht, FILE *out_FILE));
+unsigned long hash_memory_size __P((const struct hash_table *ht));
 void **hash_dump __P((struct hash_table *ht, void **vector_0, qsort_cmp_t compare));
 
 extern unsigned jhash(unsigned char const *key, int n);
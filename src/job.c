@@ -116,6 +116,12 @@ extern int wait3 ();
 # endif /* Have wait3.  */
 #endif /* Have waitpid.  */
 
+/* If we have wait4() we can find out what resources each child used.  */
+#ifdef HAVE_WAIT4
+# include <sys/resource.h>
+# define WAIT_USAGE(status, opts, ru)  wait4 (-1, (status), (opts), (ru))
+#endif
+
 #ifdef USE_POSIX_SPAWN
 # include <spawn.h>
 # include "findprog.h"
@@ -195,6 +201,7 @@ int getloadavg (double loadavg[], int nelem);
 #include "dep.h"
 #include "shuffle.h"
 #include "warning.h"
+#include "cache.h"
 
 /* Different systems have different requirements for pid_t.
    Plus we have to support gettext string translation... Argh.  */
@@ -213,9 +220,15 @@ pid2str (pid_t pid)
 }
 
 static void free_child (struct child *);
+static void account_child_usage (struct child *);
+static void start_job_hooks (struct child *);
+static void finish_job_hooks (struct child *, int exit_code, int exit_sig);
 static void start_job_command (struct child *child);
 static int load_too_high (void);
 static int job_next_command (struct child *);
+#if !MK_OS_DOS && !MK_OS_W32 && !MK_OS_VMS
+static int job_next_list_command (struct child *, int);
+#endif
 static int start_waiting_job (struct child *);
 
 /* Chain of all live (or recently deceased) children.  */
@@ -245,6 +258,17 @@ unsigned long job_counter = 0;
 /* Number of jobserver tokens this instance is currently using.  */
 
 unsigned int jobserver_tokens = 0;
+
+/* Resources used by all the jobs we've reaped so far.  */
+
+static struct job_usage total_usage;
+static unsigned long total_jobs = 0;
+
+/* The targets whose jobs used the most CPU time and memory.  */
+
+static const char *max_cpu_target = NULL;
+static unsigned long long max_cpu_time = 0;
+static const char *max_rss_target = NULL;
 
 
 #if MK_OS_W32
@@ -609,6 +633,26 @@ child_handler (int sig UNUSED)
 
 extern pid_t shell_function_pid;
 
+/* How often, in milliseconds, to look at the output that running children
+   write into memory while we wait for them.  */
+#define SPILL_CHECK_MSECS 100
+
+/* Move large output held in memory by running children to temp files.
+   Return nonzero if some of it is still held in memory, so we must not
+   block for long waiting for them.  */
+
+static int
+spill_children_output (void)
+{
+  struct child *c;
+  int inmem = 0;
+
+  for (c = children; c != 0; c = c->next)
+    inmem |= output_spill (&c->output);
+
+  return inmem;
+}
+
 /* Reap all dead children, storing the returned status and the new command
    state ('cs_finished') in the 'file' member of the 'struct child' for the
    dead child, and removing the child from the chain.  In addition, if BLOCK
@@ -621,6 +665,9 @@ reap_children (int block, int err)
 {
 #if !MK_OS_W32
   WAIT_T status;
+#endif
+#ifdef WAIT_USAGE
+  struct rusage ru;
 #endif
   /* Initially, assume we have some.  */
   int reap_more = 1;
@@ -643,11 +690,12 @@ reap_children (int block, int err)
          && (block || REAP_MORE))
     {
       unsigned int remote = 0;
+      unsigned int worker = 0;
       pid_t pid;
       int exit_code, exit_sig, coredump;
       struct child *lastc, *c;
       int child_failed;
-      int any_remote, any_local;
+      int any_remote, any_local, any_worker, any_inmem;
       int dontcare;
 
       if (err && block)
@@ -682,13 +730,20 @@ reap_children (int block, int err)
       if (dead_children > 0)
         --dead_children;
 
+#ifdef WAIT_USAGE
+      memset (&ru, '\0', sizeof (ru));
+#endif
+
       any_remote = 0;
       any_local = shell_function_pid != 0;
+      any_worker = 0;
+      any_inmem = block && spill_children_output ();
       lastc = 0;
       for (c = children; c != 0; lastc = c, c = c->next)
         {
           any_remote |= c->remote;
           any_local |= ! c->remote;
+          any_worker |= c->worker;
 
           /* If pid < 0, this child never even started.  Handle it.  */
           if (c->pid < 0)
@@ -702,7 +757,8 @@ reap_children (int block, int err)
 
           DB (DB_JOBS, (_("Live child %p (%s) PID %s %s\n"),
                         c, c->file->name, pid2str (c->pid),
-                        c->remote ? _(" (remote)") : ""));
+                        c->remote ? _(" (remote)")
+                        : c->worker ? _(" (worker)") : ""));
 #if MK_OS_VMS
           break;
 #endif
@@ -722,6 +778,11 @@ reap_children (int block, int err)
           /* A remote status command failed miserably.  Punt.  */
           pfatal_with_name ("remote_status");
         }
+      else if (any_worker
+               && (pid = worker_status (&exit_code, &exit_sig,
+                                        &coredump, 0)) > 0)
+        /* A shell worker finished a command.  */
+        worker = 1;
       else
         {
           /* No remote children.  Check for local children.  */
@@ -740,9 +801,16 @@ reap_children (int block, int err)
               /* A Posix failure can be exactly translated */
               if ((c->cstatus & VMS_POSIX_EXIT_MASK) == VMS_POSIX_EXIT_MASK)
                 status = (c->cstatus >> 3 & 255) << 8;
+#elif defined(WAIT_USAGE)
+              /* Shell workers don't exit, so we can't block on them here.
+                 Nor can we while output held in memory is growing.  */
+              if (!block || any_worker || any_inmem)
+                pid = WAIT_USAGE (&status, WNOHANG, &ru);
+              else
+                EINTRLOOP (pid, WAIT_USAGE (&status, 0, &ru));
 #else
 #ifdef WAIT_NOHANG
-              if (!block)
+              if (!block || any_worker || any_inmem)
                 pid = WAIT_NOHANG (&status);
               else
 #endif
@@ -769,20 +837,41 @@ reap_children (int block, int err)
               /* No local children are dead.  */
               reap_more = 0;
 
-              if (!block || !any_remote)
+              if (!block || (!any_remote && !any_worker && !any_inmem))
                 break;
 
-              /* Now try a blocking wait for a remote child.  */
-              pid = remote_status (&exit_code, &exit_sig, &coredump, 1);
-              if (pid < 0)
-                pfatal_with_name ("remote_status");
+              if (any_inmem)
+                {
+                  /* Wake up now and then to move the output to temp files
+                     if it grows too large.  */
+                  os_wait_child (SPILL_CHECK_MSECS);
+                  continue;
+                }
 
-              if (pid == 0)
-                /* No remote children either.  Finally give up.  */
-                break;
+              if (any_worker)
+                {
+                  /* Wait for a shell worker to finish a command.  This
+                     returns 0 when a SIGCHLD arrives: go reap it.  */
+                  pid = worker_status (&exit_code, &exit_sig, &coredump, 1);
+                  if (pid == 0)
+                    continue;
+
+                  worker = 1;
+                }
+              else
+                {
+                  /* Now try a blocking wait for a remote child.  */
+                  pid = remote_status (&exit_code, &exit_sig, &coredump, 1);
+                  if (pid < 0)
+                    pfatal_with_name ("remote_status");
 
-              /* We got a remote child.  */
-              remote = 1;
+                  if (pid == 0)
+                    /* No remote children either.  Finally give up.  */
+                    break;
+
+                  /* We got a remote child.  */
+                  remote = 1;
+                }
             }
 #endif /* !MK_OS_DOS, !MK_OS_W32.  */
 
@@ -869,7 +958,7 @@ reap_children (int block, int err)
       ++command_count;
 
       /* Check if this is the child of the 'shell' function.  */
-      if (!remote && pid == shell_function_pid)
+      if (!remote && !worker && pid == shell_function_pid)
         {
           shell_completed (exit_code, exit_sig);
           break;
@@ -878,7 +967,7 @@ reap_children (int block, int err)
       /* Search for a child matching the deceased one.  */
       lastc = 0;
       for (c = children; c != 0; lastc = c, c = c->next)
-        if (c->pid == pid && c->remote == remote)
+        if (c->pid == pid && c->remote == remote && c->worker == worker)
           break;
 
       if (c == 0)
@@ -891,6 +980,23 @@ reap_children (int block, int err)
                     : _("Reaping losing child %p PID %s %s\n"),
                     c, pid2str (c->pid), c->remote ? _(" (remote)") : ""));
 
+#ifdef WAIT_USAGE
+      if (!remote && !worker)
+        {
+          struct job_usage *u = &c->usage;
+          unsigned long maxrss = (unsigned long) ru.ru_maxrss;
+
+          u->utime += (unsigned long long) ru.ru_utime.tv_sec * 1000000
+                        + ru.ru_utime.tv_usec;
+          u->stime += (unsigned long long) ru.ru_stime.tv_sec * 1000000
+                        + ru.ru_stime.tv_usec;
+          if (maxrss > u->maxrss)
+            u->maxrss = maxrss;
+          u->inblock += (unsigned long) ru.ru_inblock;
+          u->oublock += (unsigned long) ru.ru_oublock;
+        }
+#endif
+
       /* If we have started jobs in this second, remove one.  */
       if (job_counter)
         --job_counter;
@@ -959,6 +1065,15 @@ reap_children (int block, int err)
 
       dontcare = c->dontcare;
 
+#if !MK_OS_DOS && !MK_OS_W32 && !MK_OS_VMS
+      /* If the command is followed by more of an "&&" or "||" list, the
+         list goes on whatever its status if the shell would run another
+         command.  Otherwise the list has the status of this command.  */
+      if (c->list_ptr && !handling_fatal_signal
+          && job_next_list_command (c, exit_sig == 0 && exit_code == 0))
+        child_failed = MAKE_SUCCESS;
+#endif
+
       if (child_failed && !c->noerror && !ignore_errors_flag)
         {
           /* The commands failed.  Write an error message,
@@ -1033,6 +1148,11 @@ reap_children (int block, int err)
 
       /* When we get here, all the commands for c->file are finished.  */
 
+      account_child_usage (c);
+
+      if (job_finish_hooks)
+        finish_job_hooks (c, exit_code, exit_sig);
+
       /* Synchronize any remaining parallel output.  */
       output_dump (&c->output);
 
@@ -1041,6 +1161,11 @@ reap_children (int block, int err)
          ran; notice_finished_file looks for cs_running to tell it that
          it's interesting to check the file's modtime again now.  */
 
+      /* Save the outputs of a cacheable target for next time.  */
+      if (c->cache_entry && c->file->update_status == us_success
+          && ! handling_fatal_signal)
+        cache_store (c->file, c->cache_entry);
+
       if (! handling_fatal_signal)
         /* Notice if the target of the commands has been changed.
            This also propagates its values for command_state and
@@ -1088,18 +1213,137 @@ reap_children (int block, int err)
   return;
 }
 
+/* Add the resources used by the commands of child C to the totals, and
+   report them if we're debugging jobs.  */
+
+static void
+account_child_usage (struct child *c)
+{
+  const struct job_usage *u = &c->usage;
+  unsigned long long cpu = u->utime + u->stime;
+
+  ++total_jobs;
+  total_usage.utime += u->utime;
+  total_usage.stime += u->stime;
+  total_usage.inblock += u->inblock;
+  total_usage.oublock += u->oublock;
+
+  if (u->maxrss > total_usage.maxrss)
+    {
+      total_usage.maxrss = u->maxrss;
+      max_rss_target = c->file->name;
+    }
+  if (cpu > max_cpu_time)
+    {
+      max_cpu_time = cpu;
+      max_cpu_target = c->file->name;
+    }
+
+  DB (DB_JOBS, (_("Resources used by %s: user %.3fs, system %.3fs, "
+                  "max RSS %luK, block in %lu, block out %lu\n"),
+                c->file->name, u->utime / 1e6, u->stime / 1e6,
+                u->maxrss, u->inblock, u->oublock));
+}
+
+/* Return a time in seconds, for measuring how long jobs take.  */
+
+static double
+job_clock (void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+#ifdef HAVE_GETTIMEOFDAY
+  {
+    struct timeval tv;
+    if (gettimeofday (&tv, 0) == 0)
+      return tv.tv_sec + tv.tv_usec / 1e6;
+  }
+#endif
+  {
+    time_t now = time (0);
+    return (double) now;
+  }
+}
+
+/* Describe the job of child C for the hooks of loaded objects.  */
+
+static void
+describe_job (gmk_job *job, const struct child *c)
+{
+  memset (job, 0, sizeof (gmk_job));
+  job->target = c->file->name;
+  job->commands = (const char *const *) c->command_lines;
+  job->ncommands = c->command_lines ? c->file->cmds->ncommand_lines : 0;
+}
+
+/* Tell loaded objects that the first command of child C is starting.  */
+
+static void
+start_job_hooks (struct child *c)
+{
+  gmk_job job;
+
+  c->start_time = job_clock ();
+
+  if (job_start_hooks)
+    {
+      describe_job (&job, c);
+      run_job_hooks (job_start_hooks, &job);
+    }
+}
+
+/* Tell loaded objects that child C has finished.  EXIT_CODE and EXIT_SIG
+   describe how its last command exited.  */
+
+static void
+finish_job_hooks (struct child *c, int exit_code, int exit_sig)
+{
+  const struct job_usage *u = &c->usage;
+  gmk_job job;
+
+  describe_job (&job, c);
+  job.failed = c->file->update_status != us_success;
+  job.exit_status = exit_code;
+  job.exit_signal = exit_sig;
+  job.elapsed = c->start_time ? job_clock () - c->start_time : 0;
+  job.user_time = u->utime / 1e6;
+  job.system_time = u->stime / 1e6;
+  job.max_rss = u->maxrss;
+  job.in_blocks = u->inblock;
+  job.out_blocks = u->oublock;
+
+  run_job_hooks (job_finish_hooks, &job);
+}
+
+/* Print a summary of the resources used by all the jobs we ran.  */
+
+void
+print_job_stats (void)
+{
+  printf (_("\n# Recipe resource usage\n"));
+  printf (_("# Jobs completed: %lu\n"), total_jobs);
+  printf (_("# CPU time: user %.3fs, system %.3fs\n"),
+          total_usage.utime / 1e6, total_usage.stime / 1e6);
+  if (max_cpu_target)
+    printf (_("# Most CPU time: %.3fs (%s)\n"),
+            max_cpu_time / 1e6, max_cpu_target);
+  if (max_rss_target)
+    printf (_("# Largest max RSS: %luK (%s)\n"),
+            total_usage.maxrss, max_rss_target);
+  printf (_("# Block operations: input %lu, output %lu\n"),
+          total_usage.inblock, total_usage.oublock);
+}
+
 /* Free the storage allocated for CHILD.  */
 
 void
 free_childbase (struct childbase *child)
 {
   if (child->environment != 0)
-    {
-      char **ep = child->environment;
-      while (*ep != 0)
-        free (*ep++);
-      free (child->environment);
-    }
+    free_target_environment (child->environment);
 
   free (child->cmd_name);
 }
@@ -1136,12 +1380,60 @@ free_child (struct child *child)
       free (child->command_lines);
     }
 
+  free (child->cache_entry);
+
   free_childbase ((struct childbase*)child);
 
   free (child);
 }
 
 
+/* Return nonzero if ARGV runs one command line with a Bourne shell, as
+   "SHELL -c CMD" (or -ec), so a long-lived shell could run it instead.  */
+
+int
+is_shell_command_argv (char **argv)
+{
+  return (argv[0] && argv[1] && argv[2] && !argv[3]
+          && (streq (argv[1], "-c") || streq (argv[1], "-ec"))
+          && is_bourne_compatible_shell (argv[0]));
+}
+
+#if !MK_OS_DOS && !MK_OS_W32 && !MK_OS_VMS
+/* Try to run the command in ARGV for CHILD using a shell worker.
+   Only commands of the form "SHELL -c CMD" (or -ec) can be handled.
+   Returns nonzero and sets CHILD's PID on success.  */
+
+static int
+start_worker_job (struct child *child, char **argv)
+{
+  int syncout = child->output.syncout;
+  pid_t id;
+
+  if (!is_shell_command_argv (argv))
+    return 0;
+
+  id = worker_start_job (argv[0], argv[1][1] == 'e', argv[2],
+                         child->environment,
+                         syncout ? child->output.out : -1,
+                         syncout ? child->output.err : -1);
+  if (id <= 0)
+    return 0;
+
+  /* Workers never read stdin, so it's free for someone else.  */
+  if (child->good_stdin)
+    {
+      child->good_stdin = 0;
+      good_stdin_used = 0;
+    }
+
+  child->worker = 1;
+  child->pid = id;
+
+  return 1;
+}
+#endif
+
 /* Start a job to run the commands specified in CHILD.
    CHILD is updated to reflect the commands and ID of the child process.
 
@@ -1152,7 +1444,7 @@ free_child (struct child *child)
 static void
 start_job_command (struct child *child)
 {
-  int flags;
+  int flags, in_list;
   char *p;
 #if MK_OS_VMS
 # define FREE_ARGV(_a)
@@ -1160,10 +1452,13 @@ start_job_command (struct child *child)
 #else
 # define FREE_ARGV(_a) do{ if (_a) { free ((_a)[0]); free (_a); } }while(0)
   char **argv;
+  struct redirect redirs[MAX_REDIRECTS + 1];
+
+  redirs[0].fd = -1;
 #endif
 
   /* If we have a completely empty commandset, stop now.  */
-  if (!child->command_ptr)
+  if (!child->command_ptr && !child->list_ptr)
     goto next_command;
 
   /* Combine the flags parsed for the line itself with
@@ -1171,24 +1466,35 @@ start_job_command (struct child *child)
   flags = (child->file->command_flags
            | child->file->cmds->lines_flags[child->command_line - 1]);
 
-  p = child->command_ptr;
-  child->noerror = ANY_SET (flags, COMMANDS_NOERROR);
-
-  while (*p != '\0')
+  /* The rest of an "&&" or "||" list was printed with its first command,
+     and the prefix characters of the line were seen then.  */
+  in_list = child->list_ptr != NULL;
+  if (in_list)
     {
-      if (*p == '@')
-        flags |= COMMANDS_SILENT;
-      else if (*p == '+')
-        flags |= COMMANDS_RECURSE;
-      else if (*p == '-')
-        child->noerror = 1;
-      /* Don't skip newlines.  */
-      else if (!ISBLANK (*p))
-        break;
-      ++p;
+      p = child->list_ptr;
+      child->list_ptr = NULL;
     }
+  else
+    {
+      p = child->command_ptr;
+      child->noerror = ANY_SET (flags, COMMANDS_NOERROR);
 
-  child->recursive = ANY_SET (flags, COMMANDS_RECURSE);
+      while (*p != '\0')
+        {
+          if (*p == '@')
+            flags |= COMMANDS_SILENT;
+          else if (*p == '+')
+            flags |= COMMANDS_RECURSE;
+          else if (*p == '-')
+            child->noerror = 1;
+          /* Don't skip newlines.  */
+          else if (!ISBLANK (*p))
+            break;
+          ++p;
+        }
+
+      child->recursive = ANY_SET (flags, COMMANDS_RECURSE);
+    }
 
   /* Update the file's command flags with any new ones we found.  We only
      keep the COMMANDS_RECURSE setting.  Even this isn't 100% correct; we are
@@ -1256,11 +1562,19 @@ start_job_command (struct child *child)
           }
       }
 #else
-    argv = construct_command_argv (p, &end, child->file,
+    /* Remote jobs can't perform redirections for us, and recursive makes
+       must be run as a whole.  The rest of a list has no newlines.  */
+    argv = construct_command_argv (p, in_list ? NULL : &end, child->file,
                                    child->file->cmds->lines_flags[child->command_line - 1] | child->file->command_flags,
-                                   &child->sh_batch_file);
+                                   &child->sh_batch_file,
+                                   child->remote ? NULL : redirs,
+                                   child->remote || child->recursive
+                                   ? NULL : &child->list_ptr);
 #endif
-    if (end == NULL)
+    if (in_list)
+      /* The rest of the line was found with the first command.  */
+      assert (end == NULL);
+    else if (end == NULL)
       child->command_ptr = NULL;
     else
       {
@@ -1303,6 +1617,8 @@ start_job_command (struct child *child)
 #if MK_OS_DOS
       execute_by_shell = 0;   /* in case construct_command_argv sets it */
 #endif
+      /* Skip the rest of any list, as for the rest of this line.  */
+      child->list_ptr = NULL;
       /* This line has no commands.  Go to the next.  */
       if (job_next_command (child))
         start_job_command (child);
@@ -1333,8 +1649,9 @@ start_job_command (struct child *child)
     output_dump (&child->output);
 
   /* Print the command if appropriate.  */
-  if (just_print_flag || ISDB (DB_PRINT)
-      || (NONE_SET (flags, COMMANDS_SILENT) && !run_silent))
+  if (!in_list
+      && (just_print_flag || ISDB (DB_PRINT)
+          || (NONE_SET (flags, COMMANDS_SILENT) && !run_silent)))
     OS (message, 0, "%s", p);
 
   /* Tell update_goal_chain that a command has been started on behalf of
@@ -1412,8 +1729,9 @@ start_job_command (struct child *child)
 #if !MK_OS_DOS && !MK_OS_W32
 
 #if !MK_OS_VMS
-  /* start_waiting_job has set CHILD->remote if we can start a remote job.  */
-  if (child->remote)
+  /* start_waiting_job has set CHILD->remote if we can start a remote job.
+     A recursive make must run here, where it can use our jobserver.  */
+  if (child->remote && NONE_SET (flags, COMMANDS_RECURSE))
     {
       int is_remote, used_stdin;
       pid_t id;
@@ -1442,19 +1760,26 @@ start_job_command (struct child *child)
       block_sigs ();
 
       child->remote = 0;
+      child->worker = 0;
 
 #if MK_OS_VMS
       child->pid = child_execute_job ((struct childbase *)child, 1, argv);
 
 #else
 
-      jobserver_pre_child (ANY_SET (flags, COMMANDS_RECURSE));
-
-      child->pid = child_execute_job ((struct childbase *)child,
-                                      child->good_stdin, argv);
+      /* Hand simple shell commands to a shell worker, if we can.  */
+      if (!shell_workers || ANY_SET (flags, COMMANDS_RECURSE)
+          || redirs[0].fd >= 0 || !start_worker_job (child, argv))
+        {
+          jobserver_pre_child (ANY_SET (flags, COMMANDS_RECURSE));
 
-      jobserver_post_child (ANY_SET (flags, COMMANDS_RECURSE));
+          child->redirects = redirs[0].fd >= 0 ? redirs : NULL;
+          child->pid = child_execute_job ((struct childbase *)child,
+                                          child->good_stdin, argv);
+          child->redirects = NULL;
 
+          jobserver_post_child (ANY_SET (flags, COMMANDS_RECURSE));
+        }
 #endif /* !MK_OS_VMS */
     }
 
@@ -1609,6 +1934,8 @@ start_waiting_job (struct child *c)
     }
 
   /* Start the first command; reap_children will run later command lines.  */
+  if (job_start_hooks || job_finish_hooks)
+    start_job_hooks (c);
   start_job_command (c);
 
   switch (f->command_state)
@@ -1635,6 +1962,8 @@ start_waiting_job (struct child *c)
       /* FALLTHROUGH */
 
     case cs_finished:
+      if (job_finish_hooks)
+        finish_job_hooks (c, 0, 0);
       notice_finished_file (f);
       free_child (c);
       break;
@@ -1789,6 +2118,30 @@ new_job (struct file *file)
   cmds->fileinfo.offset = 0;
   c->command_lines = lines;
 
+  /* If the outputs of a cacheable target are already in the cache, restore
+     them rather than running the recipe.  We don't need a job slot.  */
+  c->cache_entry = cache_entry (file, lines, cmds->ncommand_lines);
+  if (c->cache_entry && cache_restore (file, c->cache_entry))
+    {
+      OUTPUT_UNSET ();
+      output_close (&c->output);
+
+      /* Count this as running commands, so that we don't claim that
+         a goal restored from the cache was already up to date.  */
+      ++commands_started;
+
+      set_command_state (file, cs_running);
+      file->update_status = us_success;
+      notice_finished_file (file);
+
+      for (i = 0; i < cmds->ncommand_lines; ++i)
+        free (lines[i]);
+      free (lines);
+      free (c->cache_entry);
+      free (c);
+      return;
+    }
+
   /* Fetch the first command line to be run.  */
   job_next_command (c);
 
@@ -1844,7 +2197,8 @@ new_job (struct file *file)
           O (fatal, NILF, "INTERNAL: no children as we go to sleep on read");
 
         /* Get a token.  */
-        got_token = jobserver_acquire (waiting_jobs != NULL);
+        got_token = jobserver_acquire (waiting_jobs != NULL
+                                       || spill_children_output ());
 
         /* If we got one, we're done here.  */
         if (got_token == 1)
@@ -1960,6 +2314,10 @@ new_job (struct file *file)
 static int
 job_next_command (struct child *child)
 {
+  /* Finish any "&&" or "||" list first.  */
+  if (child->list_ptr)
+    return 1;
+
   while (child->command_ptr == 0 || *child->command_ptr == '\0')
     {
       /* There are no more lines in the expansion of this line.  */
@@ -1979,6 +2337,39 @@ job_next_command (struct child *child)
   return 1;
 }
 
+#if !MK_OS_DOS && !MK_OS_W32 && !MK_OS_VMS
+/* CHILD ran a command followed by the rest of an "&&" or "||" list, and it
+   succeeded if OK is nonzero.  Skip the commands in the list that the shell
+   wouldn't run after it.  Returns nonzero if there is one left to run.  */
+
+static int
+job_next_list_command (struct child *child, int ok)
+{
+  while (child->list_ptr)
+    {
+      struct redirect redirs[MAX_REDIRECTS + 1];
+      char **argv;
+
+      /* The operator is the last character before the list.  */
+      if ((child->list_ptr[-1] == '&') == ok)
+        return 1;
+
+      /* We construct ARGV only to find the end of the command.  */
+      argv = construct_command_argv (child->list_ptr, NULL, child->file,
+                                     child->file->cmds->lines_flags[child->command_line - 1] | child->file->command_flags,
+                                     &child->sh_batch_file, redirs,
+                                     &child->list_ptr);
+      if (argv)
+        {
+          free (argv[0]);
+          free (argv);
+        }
+    }
+
+  return 0;
+}
+#endif
+
 /* Determine if the load average on the system is too high to start a new job.
 
    On systems which provide /proc/loadavg (e.g., Linux), we use an idea
@@ -2290,42 +2681,72 @@ child_execute_job (struct childbase *child, int good_stdin, char **argv)
 
 #elif !MK_OS_DOS && !MK_OS_VMS
 
-/* POSIX:
-   Create a child process executing the command in ARGV.
-   Returns the PID or -1.  */
-pid_t
-child_execute_job (struct childbase *child, int good_stdin, char **argv)
-{
-  const int fdin = good_stdin ? FD_STDIN : get_bad_stdin ();
-  int fdout = FD_STDOUT;
-  int fderr = FD_STDERR;
-  pid_t pid = -1;
-  int r;
 #if defined(USE_POSIX_SPAWN)
-  char *cmd;
-  posix_spawnattr_t attr;
-  posix_spawn_file_actions_t fa;
-  short flags = 0;
+/* Return nonzero if CHILD has a redirection that opens a file.  */
+
+static int
+redirects_open_files (const struct childbase *child)
+{
+  const struct redirect *rp;
+
+  if (child->redirects)
+    for (rp = child->redirects; rp->fd >= 0; ++rp)
+      if (rp->file)
+        return 1;
+
+  return 0;
+}
 #endif
 
-  /* Divert child output if we want to capture it.  */
-  if (child->output.syncout)
-    {
-      if (child->output.out >= 0)
-        fdout = child->output.out;
-      if (child->output.err >= 0)
-        fderr = child->output.err;
-    }
+/* Return nonzero if opening a file that CHILD is redirected to or from might
+   block: if it's a FIFO, or some other special file than the null device.  */
 
-#if !defined(USE_POSIX_SPAWN)
+static int
+redirects_may_block (const struct childbase *child)
+{
+  const struct redirect *rp;
+
+  if (child->redirects)
+    for (rp = child->redirects; rp->fd >= 0; ++rp)
+      if (rp->file && !streq (rp->file, "/dev/null"))
+        {
+          struct stat st;
+          int r;
+
+          EINTRLOOP (r, stat (rp->file, &st));
+          if (r == 0 && !S_ISREG (st.st_mode) && !S_ISDIR (st.st_mode))
+            return 1;
+        }
+
+  return 0;
+}
+
+/* Fork a child process executing the command in ARGV, with FDIN, FDOUT
+   and FDERR as its standard descriptors and the redirections of CHILD
+   performed on top of them.  The files named in the redirections are opened
+   by the child, as a shell would: opening a FIFO mustn't block make, and a
+   file that can't be opened fails the command with the shell's status.
+   If opening one might block, the child is created with fork() rather than
+   vfork(), since make is suspended until a vfork() child execs.
+   Returns the PID or -1.  */
+
+static pid_t
+fork_child_job (struct childbase *child, int fdin, int fdout, int fderr,
+                char **argv)
+{
+  const struct redirect *rp;
+  pid_t pid;
+  int r;
 
   {
     /* The child may clobber environ so remember ours and restore it.  */
     char **parent_env = environ;
-    pid = vfork ();
+    pid = redirects_may_block (child) ? fork () : vfork ();
     if (pid != 0)
       {
         environ = parent_env;
+        if (pid < 0)
+          OSS (error, NILF, "%s: %s", argv[0], strerror (errno));
         return pid;
       }
   }
@@ -2348,12 +2769,73 @@ child_execute_job (struct childbase *child, int good_stdin, char **argv)
   if (fderr != FD_STDERR)
     EINTRLOOP (r, dup2 (fderr, FD_STDERR));
 
+  /* Then perform the command's own redirections, in order.  */
+  if (child->redirects)
+    for (rp = child->redirects; rp->fd >= 0; ++rp)
+      {
+        if (rp->file)
+          {
+            int fd;
+
+            EINTRLOOP (fd, open (rp->file, rp->oflags, 0666));
+            if (fd < 0)
+              {
+                OSS (error, NILF, "%s: %s", rp->file, strerror (errno));
+                _exit (2);
+              }
+            if (fd != rp->fd)
+              {
+                EINTRLOOP (r, dup2 (fd, rp->fd));
+                close (fd);
+              }
+          }
+        else
+          EINTRLOOP (r, dup2 (rp->dupfd, rp->fd));
+      }
+
   /* Run the command.  */
   exec_command (argv, child->environment);
   _exit (127);
+}
+
+/* POSIX:
+   Create a child process executing the command in ARGV.
+   Returns the PID or -1.  */
+pid_t
+child_execute_job (struct childbase *child, int good_stdin, char **argv)
+{
+  const int fdin = good_stdin ? FD_STDIN : get_bad_stdin ();
+  int fdout = FD_STDOUT;
+  int fderr = FD_STDERR;
+#if defined(USE_POSIX_SPAWN)
+  const struct redirect *rp;
+  pid_t pid = -1;
+  int r;
+  char *cmd;
+  posix_spawnattr_t attr;
+  posix_spawn_file_actions_t fa;
+  short flags = 0;
+#endif
+
+  /* Divert child output if we want to capture it.  */
+  if (child->output.syncout)
+    {
+      if (child->output.out >= 0)
+        fdout = child->output.out;
+      if (child->output.err >= 0)
+        fderr = child->output.err;
+    }
+
+#if !defined(USE_POSIX_SPAWN)
+
+  return fork_child_job (child, fdin, fdout, fderr, argv);
 
 #else /* USE_POSIX_SPAWN */
 
+  /* posix_spawn() would block make while opening such a file.  */
+  if (redirects_may_block (child))
+    return fork_child_job (child, fdin, fdout, fderr, argv);
+
   if ((r = posix_spawnattr_init (&attr)) != 0)
     goto done;
 
@@ -2392,6 +2874,19 @@ child_execute_job (struct childbase *child, int good_stdin, char **argv)
     if ((r = posix_spawn_file_actions_adddup2 (&fa, fderr, FD_STDERR)) != 0)
       goto cleanup;
 
+  /* Then perform the command's own redirections, in order.  */
+  if (child->redirects)
+    for (rp = child->redirects; rp->fd >= 0; ++rp)
+      {
+        if (rp->file)
+          r = posix_spawn_file_actions_addopen (&fa, rp->fd, rp->file,
+                                                rp->oflags, 0666);
+        else
+          r = posix_spawn_file_actions_adddup2 (&fa, rp->dupfd, rp->fd);
+        if (r != 0)
+          goto cleanup;
+      }
+
   /* We can't use the POSIX_SPAWN_RESETIDS flag: when make is invoked under
      restrictive environments like unshare it will fail with EINVAL.  */
 
@@ -2477,15 +2972,21 @@ child_execute_job (struct childbase *child, int good_stdin, char **argv)
   posix_spawnattr_destroy (&attr);
 
  done:
+  /* posix_spawn() doesn't say whether it was opening a file or running the
+     command that failed.  Fork the command to fail the way the shell would:
+     with status 2 for a file, or 127 for the command.  */
+  if (r != 0 && redirects_open_files (child))
+    return fork_child_job (child, fdin, fdout, fderr, argv);
+
   if (r != 0)
     pid = -1;
 
-#endif /* USE_POSIX_SPAWN */
-
   if (pid < 0)
     OSS (error, NILF, "%s: %s", argv[0], strerror (r));
 
   return pid;
+
+#endif /* USE_POSIX_SPAWN */
 }
 #endif /* !MK_OS_DOS && !MK_OS_VMS */
 #endif /* !MK_OS_W32 */
@@ -2694,6 +3195,17 @@ exec_command (char **argv, char **envp)
    Windows32 port to check whether + or $(MAKE) were found in this command
    line, in which case the effect of just_print_flag is overridden.
 
+   If REDIRS is not NULL it points to an array of MAX_REDIRECTS+1 elements.
+   Simple redirections of the standard file descriptors to or from files are
+   then handled without a shell: they are stored in REDIRS, terminated by an
+   element with an FD of -1.  The file names point into the returned memory.
+
+   If LISTP is not NULL, a list of commands joined by "&&" or "||" is also
+   handled without a shell, as long as each command in it could be.  Only
+   the first command is returned, with its redirections; *LISTP is set to the
+   rest of the list, just after the operator, and *RESTP to the end of the
+   whole list.  Otherwise *LISTP is set to NULL.
+
    The returned value is either NULL if the line was empty, or else a pointer
    to an array of strings.  The fist pointer points to the memory used by all
    the strings, so to free you free the 0'th element then the returned pointer
@@ -2702,7 +3214,8 @@ exec_command (char **argv, char **envp)
 static char **
 construct_command_argv_internal (char *line, char **restp, const char *shell,
                                  const char *shellflags, const char *ifs,
-                                 int flags, char **batch_filename UNUSED)
+                                 int flags, char **batch_filename UNUSED,
+                                 struct redirect *redirs, char **listp)
 {
 #if MK_OS_DOS
   /* MSDOS supports both the stock DOS shell and ports of Unixy shells.
@@ -2830,6 +3343,13 @@ construct_command_argv_internal (char *line, char **restp, const char *shell,
   const char *cap;
   const char *cp;
   int instring, word_has_equals, seen_nonequals, last_argument_was_empty;
+  unsigned int nredirs = 0;
+#if !MK_OS_DOS && !MK_OS_OS2 && !MK_OS_W32
+  struct redirect *rdp = redirs;
+  struct redirect list_redirs[MAX_REDIRECTS + 1];
+#endif
+  size_t cmd_start = 0;         /* The first argument of this command.  */
+  size_t first_args = 0;        /* The arguments of the first of a list.  */
   char **new_argv = 0;
   char *argstr = 0;
 #if MK_OS_W32
@@ -2850,6 +3370,12 @@ construct_command_argv_internal (char *line, char **restp, const char *shell,
   if (restp != NULL)
     *restp = NULL;
 
+  if (redirs != NULL)
+    redirs[0].fd = -1;
+
+  if (listp != NULL)
+    *listp = NULL;
+
   /* Make sure not to bother processing an empty line but stop at newline.  */
   while (ISBLANK (*line))
     ++line;
@@ -2989,6 +3515,120 @@ construct_command_argv_internal (char *line, char **restp, const char *shell,
           else
             *ap++ = *p;
         }
+#if !MK_OS_DOS && !MK_OS_OS2 && !MK_OS_W32
+      else if ((*p == '<' || *p == '>') && redirs != NULL)
+        {
+          /* A redirection.  We can handle it ourselves if it redirects a
+             standard descriptor to a plain file name or to another standard
+             descriptor, and it starts a new word.  */
+          struct redirect *rp;
+          int fd = *p == '<' ? 0 : 1;
+          int dupfd = -1;
+          int oflags = O_RDONLY;
+          char *name = NULL;
+
+          /* A descriptor number must be a single unquoted word.  */
+          if (ap == new_argv[i] + 1 && p[-1] == new_argv[i][0]
+              && (p - 1 == line || ISBLANK (p[-2])))
+            {
+              if (p[-1] < '0' || p[-1] > '2')
+                goto slow;
+              fd = p[-1] - '0';
+              ap = new_argv[i];
+            }
+          else if (ap != new_argv[i] || last_argument_was_empty)
+            goto slow;
+
+          if (nredirs == MAX_REDIRECTS)
+            goto slow;
+
+          if (p[1] == '&')
+            {
+              /* Duplicate a descriptor: it must be a complete word.  */
+              p += 2;
+              if (*p < '0' || *p > '2'
+                  || (p[1] != '\0' && p[1] != '\n' && !ISBLANK (p[1])))
+                goto slow;
+              dupfd = *p - '0';
+            }
+          else
+            {
+              if (*p == '>')
+                {
+                  oflags = O_WRONLY | O_CREAT | O_TRUNC;
+                  if (p[1] == '>')
+                    {
+                      oflags = O_WRONLY | O_CREAT | O_APPEND;
+                      ++p;
+                    }
+                  else if (p[1] == '|')
+                    ++p;
+                }
+
+              /* Open a file: the name must not need any shell processing.  */
+              while (ISBLANK (p[1]))
+                ++p;
+              name = ap;
+              while (p[1] != '\0' && p[1] != '\n' && !ISBLANK (p[1]))
+                {
+                  ++p;
+                  if (*p == '\'' || *p == '\\' || strchr (sh_chars, *p) != 0)
+                    goto slow;
+                  *ap++ = *p;
+                }
+              if (ap == name)
+                goto slow;
+              *ap++ = '\0';
+              new_argv[i] = ap;
+            }
+
+          rp = &rdp[nredirs++];
+          rp->file = name;
+          rp->fd = fd;
+          rp->dupfd = dupfd;
+          rp->oflags = oflags;
+          rdp[nredirs].fd = -1;
+
+          /* Skip whitespace chars, but not newlines.  */
+          while (ISBLANK (p[1]))
+            ++p;
+        }
+      else if ((*p == '&' || *p == '|') && p[1] == *p && listp != NULL)
+        {
+          /* The end of a command in an "&&" or "||" list.  Parse the rest of
+             the list to be sure none of it needs the shell, but return only
+             this first command.  */
+          int j;
+
+          *ap++ = '\0';
+          if (new_argv[i][0] != '\0' || last_argument_was_empty)
+            ++i;
+          new_argv[i] = ap;
+
+          /* A command can't be empty, or a shell builtin.  */
+          if (i == cmd_start)
+            goto slow;
+          for (j = 0; sh_cmds[j] != 0; ++j)
+            if (streq (sh_cmds[j], new_argv[cmd_start]))
+              goto slow;
+
+          if (first_args == 0)
+            {
+              first_args = i;
+              *listp = p + 2;
+              rdp = list_redirs;
+            }
+          cmd_start = i;
+          nredirs = 0;
+          rdp[0].fd = -1;
+          word_has_equals = seen_nonequals = last_argument_was_empty = 0;
+
+          /* Skip the operator and whitespace chars, but not newlines.  */
+          ++p;
+          while (ISBLANK (p[1]))
+            ++p;
+        }
+#endif
       else if (strchr (sh_chars, *p) != 0)
         /* Not inside a string, but it's a special char.  */
         goto slow;
@@ -3106,17 +3746,17 @@ construct_command_argv_internal (char *line, char **restp, const char *shell,
             /* If this argument is the command name,
                see if it is a built-in shell command.
                If so, have the shell handle it.  */
-            if (i == 1)
+            if (i == cmd_start + 1)
               {
                 int j;
                 for (j = 0; sh_cmds[j] != 0; ++j)
                   {
-                    if (streq (sh_cmds[j], new_argv[0]))
+                    if (streq (sh_cmds[j], new_argv[cmd_start]))
                       goto slow;
 #if MK_OS_OS2 || MK_OS_W32
                     /* Non-Unix shells are case insensitive.  */
                     if (!unixy_shell
-                        && strcasecmp (sh_cmds[j], new_argv[0]) == 0)
+                        && strcasecmp (sh_cmds[j], new_argv[cmd_start]) == 0)
                       goto slow;
 #endif
                   }
@@ -3145,16 +3785,28 @@ construct_command_argv_internal (char *line, char **restp, const char *shell,
     ++i;
   new_argv[i] = 0;
 
-  if (i == 1)
+  if (i == cmd_start + 1)
     {
       int j;
       for (j = 0; sh_cmds[j] != 0; ++j)
-        if (streq (sh_cmds[j], new_argv[0]))
+        if (streq (sh_cmds[j], new_argv[cmd_start]))
           goto slow;
     }
 
+  if (first_args > 0)
+    {
+      /* The last command of a list can't be empty either.  */
+      if (i == cmd_start)
+        goto slow;
+      new_argv[first_args] = 0;
+    }
+
   if (new_argv[0] == 0)
     {
+      /* A line with only redirections still opens the files.  */
+      if (nredirs)
+        goto slow;
+
       /* Line was empty.  */
       free (argstr);
       free (new_argv);
@@ -3166,6 +3818,12 @@ construct_command_argv_internal (char *line, char **restp, const char *shell,
  slow:;
   /* We must use the shell.  */
 
+  if (redirs != NULL)
+    redirs[0].fd = -1;
+
+  if (listp != NULL)
+    *listp = NULL;
+
   if (new_argv != 0)
     {
       /* Free the old argument list we were working on.  */
@@ -3375,7 +4033,8 @@ construct_command_argv_internal (char *line, char **restp, const char *shell,
               char **argv;
               char *f = alloca (sflags_len + 1);
               memcpy (f, shellflags, sflags_len + 1);
-              argv = construct_command_argv_internal (f, 0, 0, 0, 0, flags, 0);
+              argv = construct_command_argv_internal (f, 0, 0, 0, 0, flags, 0,
+                                                      NULL, NULL);
               if (argv)
                 {
                   char **a;
@@ -3531,7 +4190,7 @@ construct_command_argv_internal (char *line, char **restp, const char *shell,
 
     if (unixy_shell)
       new_argv = construct_command_argv_internal (new_line, 0, 0, 0, 0,
-                                                  flags, 0);
+                                                  flags, 0, NULL, NULL);
 
 #if MK_OS_OS2
     else if (!unixy_shell)
@@ -3639,11 +4298,16 @@ construct_command_argv_internal (char *line, char **restp, const char *shell,
    If *RESTP is NULL, newlines will be ignored.
 
    FILE is the target whose commands these are.  It is used for
-   variable expansion for $(SHELL) and $(IFS).  */
+   variable expansion for $(SHELL) and $(IFS).
+
+   If REDIRS is not NULL, simple redirections are stored there rather than
+   causing the shell to be used, and if LISTP is not NULL so are "&&" and
+   "||" lists; see construct_command_argv_internal.  */
 
 char **
 construct_command_argv (char *line, char **restp, struct file *file,
-                        int cmd_flags, char **batch_filename)
+                        int cmd_flags, char **batch_filename,
+                        struct redirect *redirs, char **listp)
 {
   char *shell, *ifs;
   char *allocflags = NULL;
@@ -3729,7 +4393,8 @@ construct_command_argv (char *line, char **restp, struct file *file,
   }
 
   argv = construct_command_argv_internal (line, restp, shell, shellflags, ifs,
-                                          cmd_flags, batch_filename);
+                                          cmd_flags, batch_filename, redirs,
+                                          listp);
 
   free (shell);
   free (allocflags);
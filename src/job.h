@@ -31,9 +31,38 @@ this program.  If not, see <https://www.gnu.org/licenses/>.  */
 #define CHILDBASE                                               \
     char *cmd_name;       /* Allocated copy of command run.  */ \
     char **environment;   /* Environment for commands. */       \
+    struct redirect *redirects; /* Redirections to perform.  */ \
     VMSCHILD                                                    \
     struct output output  /* Output for this child.  */
 
+/* A redirection of one of the standard file descriptors of a command that
+   make runs without a shell.  A list of these is terminated by an element
+   with an FD of -1.  */
+
+struct redirect
+  {
+    const char *file;   /* File to open onto FD, or NULL to use DUPFD.  */
+    int fd;             /* The descriptor to redirect.  */
+    int dupfd;          /* The descriptor to duplicate onto FD.  */
+    int oflags;         /* Flags to use when opening FILE.  */
+  };
+
+/* The most redirections we will handle without a shell.  */
+#define MAX_REDIRECTS   4
+
+
+/* Resources consumed by the commands of a job, as reported by the system
+   when each child is reaped.  CPU times are in microseconds and the maximum
+   resident set size is in kilobytes.  */
+
+struct job_usage
+  {
+    unsigned long long utime;   /* User CPU time.  */
+    unsigned long long stime;   /* System CPU time.  */
+    unsigned long maxrss;       /* Largest resident set of any command.  */
+    unsigned long inblock;      /* Block input operations.  */
+    unsigned long oublock;      /* Block output operations.  */
+  };
 
 struct childbase
   {
@@ -51,12 +80,20 @@ struct child
     char *sh_batch_file;        /* Script file for shell commands */
     char **command_lines;       /* Array of variable-expanded cmd lines.  */
     char *command_ptr;          /* Ptr into command_lines[command_line].  */
+    char *list_ptr;             /* Rest of an "&&" or "||" list being run,
+                                   just after its operator.  */
+    char *cache_entry;          /* Cache entry to store outputs in.  */
 
     unsigned int  command_line; /* Index into command_lines.  */
 
     pid_t pid;                  /* Child process's ID number.  */
 
+    struct job_usage usage;     /* Resources used by finished commands.  */
+    double start_time;          /* When the first command started, if any
+                                   loaded object has job hooks.  */
+
     unsigned int  remote:1;     /* Nonzero if executing remotely.  */
+    unsigned int  worker:1;     /* Nonzero if run by a shell worker.  */
     unsigned int  noerror:1;    /* Nonzero if commands contained a '-'.  */
     unsigned int  good_stdin:1; /* Nonzero if this child has a good stdin.  */
     unsigned int  deleted:1;    /* Nonzero if targets have been deleted.  */
@@ -70,13 +107,16 @@ extern struct child *children;
 /* A signal handler for SIGCHLD, if needed.  */
 void child_handler (int sig);
 int is_bourne_compatible_shell(const char *path);
+int is_shell_command_argv (char **argv);
 void new_job (struct file *file);
 void reap_children (int block, int err);
 void start_waiting_jobs (void);
 void free_childbase (struct childbase* child);
+void print_job_stats (void);
 
 char **construct_command_argv (char *line, char **restp, struct file *file,
-                               int cmd_flags, char** batch_file);
+                               int cmd_flags, char** batch_file,
+                               struct redirect *redirs, char **listp);
 
 pid_t child_execute_job (struct childbase *child, int good_stdin, char **argv);
 
@@ -222,10 +222,13 @@ load_file (const floc *flocp, struct file *file, int noerror)
   if (! symp)
     return 0;
 
-  /* Invoke the setup function.  */
+  /* Invoke the setup function.  Any hooks it registers belong to this
+     object.  */
   {
     unsigned int abi = GMK_ABI_VERSION;
+    loading_object = ldname;
     r = (*symp) (abi, flocp);
+    loading_object = NULL;
   }
 
   /* If the load didn't fail, add the file to the .LOADED variable.  */
@@ -255,6 +258,8 @@ unload_file (const char *name)
           if (d->unload)
             (*d->unload) ();
 
+          remove_load_hooks (d->name);
+
           rc = dlclose (d->dlp);
           if (rc)
             perror_with_name ("dlclose: ", d->name);
@@ -281,6 +286,8 @@ unload_all ()
       if (d->unload)
         (*d->unload) ();
 
+      remove_load_hooks (d->name);
+
       if (dlclose (d->dlp))
         perror_with_name ("dlclose: ", d->name);
 
@@ -80,3 +80,130 @@ gmk_add_function (const char *name, gmk_func_ptr func,
 {
   define_new_function (reading_file, name, min, max, flags, func);
 }
+
+/* Define a variable whose value is computed when it is first used.  */
+void
+gmk_add_lazy_variable (const char *name, gmk_var_ptr func, unsigned int flags)
+{
+  define_lazy_variable (name, func, flags & GMK_VAR_RECURSIVE, reading_file);
+}
+
+/* The object whose setup function is running, if any.  */
+const char *loading_object = NULL;
+
+struct load_hook *job_start_hooks = NULL;
+struct load_hook *job_finish_hooks = NULL;
+struct load_hook *file_considered_hooks = NULL;
+struct load_hook *file_remade_hooks = NULL;
+struct load_hook *timestamp_providers = NULL;
+
+/* Add a new hook at the end of LIST, so hooks run in the order they were
+   registered, and return it.  */
+static struct load_hook *
+add_hook (struct load_hook **list)
+{
+  struct load_hook *h = xcalloc (sizeof (struct load_hook));
+
+  h->owner = loading_object;
+  while (*list)
+    list = &(*list)->next;
+  *list = h;
+
+  return h;
+}
+
+void
+gmk_add_job_start_hook (gmk_job_hook hook)
+{
+  add_hook (&job_start_hooks)->func.job = hook;
+}
+
+void
+gmk_add_job_finish_hook (gmk_job_hook hook)
+{
+  add_hook (&job_finish_hooks)->func.job = hook;
+}
+
+void
+gmk_add_file_considered_hook (gmk_file_hook hook)
+{
+  add_hook (&file_considered_hooks)->func.file = hook;
+}
+
+void
+gmk_add_file_remade_hook (gmk_file_hook hook)
+{
+  add_hook (&file_remade_hooks)->func.file = hook;
+}
+
+void
+gmk_add_timestamp_provider (const char *prefix,
+                            gmk_timestamp_provider provider)
+{
+  struct load_hook *h = add_hook (&timestamp_providers);
+
+  h->prefix = xstrdup (prefix ? prefix : "");
+  h->func.timestamp = provider;
+}
+
+void
+run_job_hooks (const struct load_hook *hooks, const gmk_job *job)
+{
+  for (; hooks; hooks = hooks->next)
+    (*hooks->func.job) (job);
+}
+
+void
+run_file_hooks (const struct load_hook *hooks, const char *name, int status,
+                int ran)
+{
+  gmk_file file;
+
+  file.name = name;
+  file.status = status;
+  file.ran = ran;
+
+  for (; hooks; hooks = hooks->next)
+    (*hooks->func.file) (&file);
+}
+
+/* Return the first timestamp provider that answers for NAME, or NULL.  */
+const struct load_hook *
+timestamp_provider (const char *name)
+{
+  const struct load_hook *h;
+
+  for (h = timestamp_providers; h; h = h->next)
+    if (strncmp (name, h->prefix, strlen (h->prefix)) == 0)
+      return h;
+
+  return NULL;
+}
+
+/* Remove the hooks registered by the object OWNER, which is being unloaded.  */
+static void
+remove_hooks (struct load_hook **list, const char *owner)
+{
+  while (*list)
+    {
+      struct load_hook *h = *list;
+      if (h->owner && streq (h->owner, owner))
+        {
+          *list = h->next;
+          free (h->prefix);
+          free (h);
+        }
+      else
+        list = &h->next;
+    }
+}
+
+void
+remove_load_hooks (const char *owner)
+{
+  remove_hooks (&job_start_hooks, owner);
+  remove_hooks (&job_finish_hooks, owner);
+  remove_hooks (&file_considered_hooks, owner);
+  remove_hooks (&file_remade_hooks, owner);
+  remove_hooks (&timestamp_providers, owner);
+}
@@ -31,6 +31,9 @@ this program.  If not, see <https://www.gnu.org/licenses/>.  */
 #ifdef HAVE_FCNTL_H
 # include <fcntl.h>
 #endif
+#if defined(HAVE_GETRUSAGE) && defined(HAVE_SYS_RESOURCE_H)
+# include <sys/resource.h>
+#endif
 
 #if MK_OS_VMS
 int vms_use_mcr_command = 0;
@@ -93,9 +96,12 @@ double atof ();
 #include "getopt.h"
 #include "shuffle.h"
 #include "warning.h"
+#include "cache.h"
 
 static void clean_jobserver (int status);
 static void print_data_base (void);
+static void end_memory_phase (const char *name);
+static void print_memory_stats (void);
 static void print_version (void);
 static void decode_switches (int argc, const char **argv,
                              enum variable_origin origin);
@@ -177,6 +183,15 @@ int print_data_base_flag = 0;
 
 int print_targets_flag = 0;
 
+/* Nonzero means print how much memory make used when it exits
+   (--memory-stats).  */
+
+int memory_stats_flag = 0;
+
+/* Nonzero if close_stdout() is to be called when make exits.  */
+
+static int close_stdout_at_exit = 0;
+
 /* Nonzero means don't remake anything; just return a nonzero status
    if the specified targets are not up to date (-q).  */
 
@@ -367,6 +382,8 @@ static const char *const usage[] =
     N_("\
   -L, --check-symlink-times   Use the latest mtime between symlinks and target.\n"),
     N_("\
+  --memory-stats              Print memory usage when make exits.\n"),
+    N_("\
   -n, --just-print, --dry-run, --recon\n\
                               Don't actually run any recipe; just print them.\n"),
     N_("\
@@ -515,6 +532,7 @@ static struct command_switch switches[] =
     { CHAR_MAX+12, string, &jobserver_style, 1, 0, 0, 0, 0, 0, "jobserver-style", 0 },
     { WARN_OPT, strlist, &warn_flags, 1, 1, 0, 0, "warn", NULL, "warn", NULL },
     { CHAR_MAX+14, flag, &print_targets_flag, 1, 1, 0, 0, 0, 0, "print-targets", 0 },
+    { CHAR_MAX+15, flag, &memory_stats_flag, 1, 1, 0, 0, 0, 0, "memory-stats", 0 },
     { 0, 0, NULL, 0, 0, 0, 0, NULL, NULL, NULL, NULL }
   };
 
@@ -604,6 +622,26 @@ int output_sync = OUTPUT_SYNC_NONE;
 
 int not_parallel;
 
+/* Nonzero if we have seen the '.MAKE_STATS' target.
+   This prints a summary of the resources used by recipes on exit.  */
+
+int make_stats;
+
+/* Nonzero if we have seen the '.SHELL_WORKERS' target.
+   This runs simple recipe lines using persistent shell processes.  */
+
+int shell_workers;
+
+/* Nonzero if we have seen the '.SHELL_COPROCESS' target.
+   This runs $(shell) commands using one persistent shell process.  */
+
+int shell_coprocess;
+
+/* Nonzero if we have seen the '.BATCH_ARCHIVES' target.
+   This remakes the out of date members of an archive with one recipe.  */
+
+int batch_archives;
+
 /* Nonzero if some rule detected clock skew; we keep track so (a) we only
    print one warning about it during the run, and (b) we can print a final
    warning at the end of the run. */
@@ -738,11 +776,21 @@ initialize_stopchar_map (void)
    tools (most notably 'make' and other build-management systems) depend
    on being able to detect failure in other tools via their exit status.  */
 
+static int stdout_closed = 0;
+
 static void
 close_stdout (void)
 {
-  int prev_fail = ferror (stdout);
-  int fclose_fail = fclose (stdout);
+  int prev_fail;
+  int fclose_fail;
+
+  /* We may be called by die() and again by exit().  */
+  if (stdout_closed)
+    return;
+  stdout_closed = 1;
+
+  prev_fail = ferror (stdout);
+  fclose_fail = fclose (stdout);
 
   if (prev_fail || fclose_fail)
     {
@@ -1210,7 +1258,10 @@ main (int argc, char **argv, char **envp)
 
 #ifdef HAVE_ATEXIT
   if (ANY_SET (check_io_state (), IO_STDOUT_OK))
-    atexit (close_stdout);
+    {
+      atexit (close_stdout);
+      close_stdout_at_exit = 1;
+    }
 #endif
 
   output_init (&make_sync);
@@ -2070,6 +2121,7 @@ main (int argc, char **argv, char **envp)
 
     /* Read all the makefiles.  */
     read_files = read_all_makefiles (makefiles == 0 ? 0 : makefiles->list);
+    end_memory_phase (N_("read makefiles"));
 
     arg_job_slots = INVALID_JOB_SLOTS;
 
@@ -2252,6 +2304,12 @@ main (int argc, char **argv, char **envp)
 
   snap_deps ();
 
+  /* The prerequisite lists are complete: lay them out for walking.  */
+
+  freeze_deps ();
+
+  end_memory_phase (N_("snap deps"));
+
   /* Define the file rules for the built-in suffix rules.  These will later
      be converted into pattern rules.  */
 
@@ -2429,6 +2487,7 @@ main (int argc, char **argv, char **envp)
         rebuilding_makefiles = 1;
         status = update_goal_chain (read_files);
         rebuilding_makefiles = 0;
+        end_memory_phase (N_("remake makefiles"));
 
         db_level = orig_db_level;
       }
@@ -2763,6 +2822,7 @@ main (int argc, char **argv, char **envp)
             child.cmd_name = NULL;
             child.output.syncout = 0;
             child.environment = environ;
+            child.redirects = NULL;
 
             pid = child_execute_job (&child, 1, (char **)nargv);
 
@@ -2903,6 +2963,8 @@ main (int argc, char **argv, char **envp)
       O (error, NILF,
          _("warning: clock skew detected: your build may be incomplete"));
 
+    end_memory_phase (N_("update goals"));
+
     /* Exit.  */
     die (makefile_status);
   }
@@ -3781,6 +3843,7 @@ print_data_base (void)
   print_file_data_base ();
   print_vpath_data_base ();
   strcache_print_stats ("#");
+  objpool_print_stats ("#");
 
   file_timestamp_sprintf (buf, file_timestamp_now (&resolution));
   printf (_("\n# Finished Make data base on %s\n\n"), buf);
@@ -3823,6 +3886,95 @@ clean_jobserver (int status)
     }
 }
 
+/* The peak resident set size at the end of each phase of the run, for
+   --memory-stats.  */
+
+#define MAX_MEMORY_PHASES 8
+
+static struct
+  {
+    const char *name;
+    long maxrss;                /* In kilobytes.  */
+  } memory_phases[MAX_MEMORY_PHASES];
+
+static unsigned int memory_phase_count = 0;
+
+static void
+end_memory_phase (const char *name)
+{
+#if defined(HAVE_GETRUSAGE) && defined(HAVE_SYS_RESOURCE_H)
+  struct rusage ru;
+
+  if (!memory_stats_flag || memory_phase_count == MAX_MEMORY_PHASES
+      || getrusage (RUSAGE_SELF, &ru) < 0)
+    return;
+
+  memory_phases[memory_phase_count].name = name;
+# if defined(__APPLE__)
+  /* macOS reports bytes rather than kilobytes.  */
+  memory_phases[memory_phase_count].maxrss = (long) (ru.ru_maxrss / 1024);
+# else
+  memory_phases[memory_phase_count].maxrss = (long) ru.ru_maxrss;
+# endif
+  ++memory_phase_count;
+#else
+  (void) name;
+#endif
+}
+
+/* Print how much memory each part of make is using, and the peak resident
+   set size after each phase.  */
+
+static void
+print_memory_stats (void)
+{
+  unsigned int i;
+
+  printf (_("\n# Memory usage\n"));
+  printf ("# %-24s %12s %14s\n", _("subsystem"), _("objects"), _("bytes"));
+
+  strcache_memory_stats ();
+  print_file_memory_stats ();
+  print_variable_memory_stats ();
+  print_rule_memory_stats ();
+  print_dir_memory_stats ();
+  print_glob_memory_stats ();
+#ifndef NO_ARCHIVES
+  print_ar_memory_stats ();
+#endif
+  print_expand_memory_stats ();
+
+  end_memory_phase (N_("exit"));
+
+  if (memory_phase_count)
+    {
+      printf (_("\n# Peak resident set size\n"));
+      for (i = 0; i < memory_phase_count; ++i)
+        printf ("# %-24s %11ldK\n",
+                _(memory_phases[i].name), memory_phases[i].maxrss);
+    }
+}
+
+/* Once make is done, the C library's exit() only runs the atexit handlers,
+   destroys the loaded shared objects and closes every stream: make never
+   frees its data base, so even after reading a large one this takes little
+   time.  None of it matters to us, so make sure the output is written and
+   leave at once.  Do exit normally when a leak checker wants to examine
+   the heap at exit.  */
+
+#if defined(__has_feature)
+# if __has_feature(address_sanitizer) || __has_feature(leak_sanitizer)
+#  define LEAK_CHECKING
+# endif
+#endif
+#if defined(__SANITIZE_ADDRESS__)
+# define LEAK_CHECKING
+#endif
+
+#if !defined(LEAK_CHECKING) && !MK_OS_DOS && !MK_OS_VMS && !MK_OS_W32
+# define FAST_EXIT
+#endif
+
 /* Exit with STATUS, cleaning up as necessary.  */
 
 void
@@ -3850,12 +4002,25 @@ die (int status)
       /* Let the remote job module clean up its state.  */
       remote_cleanup ();
 
+      /* Stop any shell workers.  */
+      worker_cleanup ();
+      coprocess_cleanup ();
+
       /* Remove the intermediate files.  */
       remove_intermediates (0);
 
+      /* Keep any recipe output caches we've added to within their limit.  */
+      cache_trim ();
+
       if (print_data_base_flag)
         print_data_base ();
 
+      if (make_stats)
+        print_job_stats ();
+
+      if (memory_stats_flag)
+        print_memory_stats ();
+
       if (verify_flag)
         verify_file_data_base ();
 
@@ -3892,6 +4057,13 @@ die (int status)
           int _x UNUSED;
           _x = chdir (directory_before_chdir);
         }
+
+#ifdef FAST_EXIT
+      if (close_stdout_at_exit)
+        close_stdout ();
+      fflush (NULL);
+      _exit (status);
+#endif
     }
 
   exit (status);
@@ -591,6 +591,30 @@ pid_t make_pid (void);
 void *xmalloc (size_t);
 void *xcalloc (size_t);
 void *xrealloc (void *, size_t);
+
+/* A pool of objects of one size, carved out of large blocks.  Freed objects
+   are kept on a free list for reuse and are never returned to malloc.  */
+struct objpool
+  {
+    const char *name;           /* Name shown in the statistics.  */
+    size_t size;                /* Size of each object.  */
+    void *freelist;             /* Chain of freed objects.  */
+    char *next;                 /* Next unused object in the current block.  */
+    char *end;                  /* End of the current block.  */
+    struct objpool *chain;      /* Next pool with memory allocated.  */
+    unsigned long blocks;       /* Blocks allocated.  */
+    unsigned long capacity;     /* Objects in all the blocks.  */
+    unsigned long inuse;        /* Objects currently allocated.  */
+    unsigned long peak;         /* Maximum value of INUSE.  */
+    unsigned long reused;       /* Allocations satisfied from the free list.  */
+  };
+#define OBJPOOL_INIT(_n,_t)  { (_n), sizeof (_t), NULL, NULL, NULL, NULL, 0, 0, 0, 0, 0 }
+void *objpool_alloc (struct objpool *);
+void *objpool_alloc_run (struct objpool *, size_t);
+void objpool_free (struct objpool *, void *);
+void objpool_print_stats (const char *);
+void objpool_memory_stats (const struct objpool *, const char *);
+void print_memory_usage (const char *, unsigned long, unsigned long);
 char *xstrdup (const char *);
 char *xstrndup (const char *, size_t);
 char *find_next_token (const char **, size_t *);
@@ -618,6 +642,8 @@ int ar_name (const char *);
 void ar_parse_name (const char *, char **, char **);
 int ar_touch (const char *);
 time_t ar_member_date (const char *);
+void ar_forget (const char *);
+void print_ar_memory_stats (void);
 
 typedef intmax_t (*ar_member_func_t) (int desc, const char *mem, int truncated,
                                       long int hdrpos, long int datapos,
@@ -639,7 +665,17 @@ int file_impossible_p (const char *);
 void file_impossible (const char *);
 const char *dir_name (const char *);
 void print_dir_data_base (void);
+void print_dir_memory_stats (void);
+void print_glob_memory_stats (void);
 void dir_setup_glob (glob_t *);
+void dir_contents_foreach (const char *,
+                          void (*) (const char *, int, void *), void *);
+struct dir_stamps;
+void dir_stamps_start (void);
+struct dir_stamps *dir_stamps_finish (void);
+int dir_stamps_valid (struct dir_stamps *);
+void dir_stamps_free (struct dir_stamps *);
+size_t dir_stamps_size (const struct dir_stamps *);
 void hash_init_directories (void);
 
 void define_default_variables (void);
@@ -663,9 +699,12 @@ void show_goal_error (void);
 /* String caching  */
 void strcache_init (void);
 void strcache_print_stats (const char *prefix);
+void strcache_memory_stats (void);
 int strcache_iscached (const char *str);
 const char *strcache_add (const char *str);
 const char *strcache_add_len (const char *str, size_t len);
+unsigned long strcache_hash (const char *str);
+unsigned long strcache_string_hash (const char *str, size_t len);
 
 /* Guile support  */
 int guile_gmake_setup (const floc *flocp);
@@ -675,6 +714,33 @@ int load_file (const floc *flocp, struct file *file, int noerror);
 int unload_file (const char *name);
 void unload_all (void);
 
+/* Hooks registered by loaded objects, in loadapi.c.  */
+struct load_hook
+  {
+    struct load_hook *next;
+    const char *owner;          /* Object whose setup registered it.  */
+    char *prefix;               /* Files a timestamp provider answers for.  */
+    union
+      {
+        gmk_job_hook job;
+        gmk_file_hook file;
+        gmk_timestamp_provider timestamp;
+      } func;
+  };
+
+extern const char *loading_object;
+extern struct load_hook *job_start_hooks;
+extern struct load_hook *job_finish_hooks;
+extern struct load_hook *file_considered_hooks;
+extern struct load_hook *file_remade_hooks;
+extern struct load_hook *timestamp_providers;
+
+void run_job_hooks (const struct load_hook *hooks, const gmk_job *job);
+void run_file_hooks (const struct load_hook *hooks, const char *name,
+                     int status, int ran);
+const struct load_hook *timestamp_provider (const char *name);
+void remove_load_hooks (const char *owner);
+
 /* Maintainer mode support */
 #ifdef MAKE_MAINTAINER_MODE
 # define SPIN(_s) spin (_s)
@@ -740,7 +806,10 @@ extern int just_print_flag, run_silent, ignore_errors_flag, keep_going_flag;
 extern int print_data_base_flag, question_flag, touch_flag, always_make_flag;
 extern int env_overrides, no_builtin_rules_flag, no_builtin_variables_flag;
 extern int print_version_flag, check_symlink_flag, posix_pedantic;
-extern int not_parallel, second_expansion, clock_skew_detected;
+extern int not_parallel, make_stats, shell_workers, batch_archives;
+extern int shell_coprocess;
+extern int second_expansion;
+extern int clock_skew_detected;
 extern int rebuilding_makefiles, one_shell, output_sync, verify_flag;
 extern int export_all_variables;
 extern unsigned long command_count;
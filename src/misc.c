@@ -316,6 +316,148 @@ xrealloc (void *ptr, size_t size)
 }
 
 
+/* Fixed-size object pools.
+   The data base holds a very large number of small nodes (files and
+   dependencies) which live for most of the run.  Allocating them from
+   large blocks saves the per-allocation overhead of malloc and keeps nodes
+   created together close together in memory.  */
+
+#define OBJPOOL_BLOCK   (64 * 1024)
+
+/* Pools which have allocated memory, for objpool_print_stats.  */
+static struct objpool *objpools = NULL;
+
+/* Start a new block in POOL with room for at least N objects.  */
+
+static void
+objpool_new_block (struct objpool *pool, size_t n)
+{
+  size_t per_block = OBJPOOL_BLOCK / pool->size;
+
+  if (n < per_block)
+    n = per_block;
+
+  /* Every object in a block is aligned because the block is, and the size
+     of a type is a multiple of its alignment.  */
+  pool->next = xmalloc (n * pool->size);
+  pool->end = pool->next + n * pool->size;
+  pool->capacity += n;
+  if (pool->blocks++ == 0)
+    {
+      pool->chain = objpools;
+      objpools = pool;
+    }
+}
+
+/* Return a zeroed object from POOL.  */
+
+void *
+objpool_alloc (struct objpool *pool)
+{
+  void *obj;
+
+  if (pool->freelist)
+    {
+      obj = pool->freelist;
+      memcpy (&pool->freelist, obj, sizeof (void *));
+      ++pool->reused;
+    }
+  else
+    {
+      if (pool->next == pool->end)
+        objpool_new_block (pool, 1);
+      obj = pool->next;
+      pool->next += pool->size;
+    }
+
+  if (++pool->inuse > pool->peak)
+    pool->peak = pool->inuse;
+
+  return memset (obj, '\0', pool->size);
+}
+
+/* Return N adjacent objects from POOL, which are not initialized.  Each one
+   may be freed separately.  */
+
+void *
+objpool_alloc_run (struct objpool *pool, size_t n)
+{
+  void *objs;
+
+  if ((size_t) (pool->end - pool->next) < n * pool->size)
+    {
+      /* Keep what is left of the current block for objpool_alloc.  */
+      while (pool->next != pool->end)
+        {
+          memcpy (pool->next, &pool->freelist, sizeof (void *));
+          pool->freelist = pool->next;
+          pool->next += pool->size;
+        }
+      objpool_new_block (pool, n);
+    }
+
+  objs = pool->next;
+  pool->next += n * pool->size;
+
+  pool->inuse += n;
+  if (pool->inuse > pool->peak)
+    pool->peak = pool->inuse;
+
+  return objs;
+}
+
+/* Return OBJ, which was allocated from POOL, to POOL.  */
+
+void
+objpool_free (struct objpool *pool, void *obj)
+{
+  if (obj == NULL)
+    return;
+
+  assert (pool->inuse > 0);
+  --pool->inuse;
+  memcpy (obj, &pool->freelist, sizeof (void *));
+  pool->freelist = obj;
+}
+
+/* Print the statistics of all the pools for the data base output.  */
+
+void
+objpool_print_stats (const char *prefix)
+{
+  const struct objpool *pool;
+
+  for (pool = objpools; pool != NULL; pool = pool->chain)
+    {
+      printf (_("\n%s %s pool: object size = %lu B / blocks = %lu / storage = %lu B\n"),
+              prefix, pool->name, (unsigned long) pool->size, pool->blocks,
+              pool->capacity * pool->size);
+      printf (_("%s in use = %lu / peak = %lu / reused = %lu / free = %lu\n"),
+              prefix, pool->inuse, pool->peak, pool->reused,
+              pool->capacity - pool->inuse);
+    }
+}
+
+/* Print the objects in use in POOL, and the memory it has allocated, for
+   the --memory-stats output.  */
+
+void
+objpool_memory_stats (const struct objpool *pool, const char *what)
+{
+  print_memory_usage (what, pool->inuse, pool->capacity * pool->size);
+}
+
+/* Print a line of the --memory-stats output: WHAT uses BYTES bytes of
+   memory for COUNT objects.  */
+
+void
+print_memory_usage (const char *what, unsigned long count,
+                    unsigned long bytes)
+{
+  printf ("# %-24s %12lu %14lu\n", what, count, bytes);
+}
+
+
 char *
 xstrdup (const char *ptr)
 {
@@ -537,7 +679,7 @@ copy_dep (const struct dep *d)
 
   if (d)
     {
-      new = xmalloc (sizeof (struct dep));
+      new = alloc_dep ();
       memcpy (new, d, sizeof (struct dep));
 
       if (new->need_2nd_expansion)
@@ -571,6 +713,9 @@ copy_dep_chain (const struct dep *d)
   return firstnew;
 }
 
+struct objpool dep_pool = OBJPOOL_INIT ("dep", struct dep);
+struct objpool goaldep_pool = OBJPOOL_INIT ("goaldep", struct goaldep);
+
 /* Free a chain of struct nameseq.
    For struct dep chains use free_dep_chain.  */
 
@@ -584,6 +729,19 @@ free_ns_chain (struct nameseq *ns)
       free_ns (t);
     }
 }
+
+/* Free a chain of struct goaldep.  */
+
+void
+free_goal_chain (struct goaldep *g)
+{
+  while (g != NULL)
+    {
+      struct goaldep *t = g;
+      g = g->next;
+      free_goaldep (t);
+    }
+}
 
 
 #ifdef MAKE_MAINTAINER_MODE
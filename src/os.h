@@ -47,6 +47,14 @@ void fd_reset_append (int fd, int flags);
 int os_anontmp (void);
 #endif
 
+/* Return a file descriptor for a new anonymous file kept in memory, or -1.
+   Its memory can be released with fallocate() while it's in use.  */
+#if MK_OS_VMS || MK_OS_DOS || MK_OS_W32
+# define os_memtmp()            (-1)
+#else
+int os_memtmp (void);
+#endif
+
 /* This section provides OS-specific functions to support the jobserver.  */
 
 #ifdef MAKE_JOBSERVER
@@ -92,12 +100,20 @@ void jobserver_post_child (int);
 void jobserver_pre_acquire (void);
 
 /* Wait until we can acquire a jobserver token.
-   TIMEOUT is 1 if we have other jobs waiting for the load to go down;
-   in this case we won't wait forever, so we can check the load.
+   TIMEOUT is 1 if we have other jobs waiting for the load to go down, or
+   output held in memory to check; in this case we won't wait forever.
    Returns 1 if we got a token, or 0 if we stopped waiting due to a child
    exiting or a timeout.    */
 unsigned int jobserver_acquire (int timeout);
 
+#ifdef HAVE_PSELECT
+/* Wait until a child exits, a shell worker finishes a job, or MSECS
+   milliseconds pass.  */
+void os_wait_child (unsigned int msecs);
+#else
+#define os_wait_child(_msecs)           (void)(0)
+#endif
+
 #else
 
 #define jobserver_enabled()             (0)
@@ -113,6 +129,7 @@ unsigned int jobserver_acquire (int timeout);
 #define jobserver_post_child(_r)        (void)(0)
 #define jobserver_pre_acquire()         (void)(0)
 #define jobserver_acquire(_tmout)       (0)
+#define os_wait_child(_msecs)           (void)(0)
 
 #endif  /* MAKE_JOBSERVER */
 
@@ -155,6 +172,58 @@ void osync_release (void);
 
 #endif  /* NO_OUTPUT_SYNC */
 
+/* Shell workers are long-lived shells which run recipe commands.  */
+#if MK_OS_VMS || MK_OS_W32 || MK_OS_DOS
+# define worker_start_job(_sh,_e,_cmd,_env,_o,_r)   (-1)
+# define worker_status(_code,_sig,_core,_block)     (0)
+# define worker_kill(_id,_sig)                       (void)(0)
+# define worker_cleanup()                           (void)(0)
+#else
+
+/* Run the shell command CMD with environment ENVP using a worker running
+   SHELL.  If ERREXIT is nonzero the shell's -e option is enabled.  If OUTFD
+   or ERRFD are not -1 the command's output is sent there.  Returns an ID for
+   the job which is never the ID of another running job, or -1 if no worker
+   could run it.  */
+pid_t worker_start_job (const char *shell, int errexit, const char *cmd,
+                        char **envp, int outfd, int errfd);
+
+/* Return the ID of a worker job which has finished and set its exit status
+   as remote_status() does, or return 0 if none has finished.  If BLOCK is
+   nonzero wait until a job finishes or a SIGCHLD is received.  */
+pid_t worker_status (int *exit_code_ptr, int *signal_ptr, int *coredump_ptr,
+                     int block);
+
+/* Send signal SIG to the worker job ID.  This might be called from a signal
+   handler.  */
+void worker_kill (pid_t id, int sig);
+
+/* Shut down all the workers.  */
+void worker_cleanup (void);
+#endif
+
+/* The $(shell) coprocess is a long-lived shell which runs the commands of
+   $(shell) functions.  */
+#if MK_OS_VMS || MK_OS_W32 || MK_OS_DOS
+# define coprocess_run(_sh,_e,_cmd,_env,_out,_len,_st)  (-1)
+# define coprocess_cleanup()                            (void)(0)
+#else
+
+/* Run the shell command CMD with environment ENVP using the coprocess,
+   which runs SHELL.  If ERREXIT is nonzero the shell's -e option is enabled.
+   On success, store the command's standard output in a new string *OUTPUT,
+   its length in *LENGTH and its exit status in *STATUS, and return 0.
+   If the coprocess dies once it has been sent the command, the command
+   failed: its status is 128 plus the signal that killed the coprocess, or
+   127.  Return -1 if the command could not be sent, so it may be run some
+   other way.  */
+int coprocess_run (const char *shell, int errexit, const char *cmd,
+                   char **envp, char **output, size_t *length, int *status);
+
+/* Stop the coprocess.  This might be called from a signal handler.  */
+void coprocess_cleanup (void);
+#endif
+
 /* Create a "bad" file descriptor for stdin when parallel jobs are run.  */
 #if MK_OS_VMS || MK_OS_W32 || MK_OS_DOS
 # define get_bad_stdin() (-1)
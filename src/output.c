@@ -40,6 +40,10 @@ this program.  If not, see <https://www.gnu.org/licenses/>.  */
 # include "sub_proc.h"
 #endif
 
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
+
 struct output *output_context = NULL;
 unsigned int stdio_traced = 0;
 
@@ -47,6 +51,10 @@ unsigned int stdio_traced = 0;
 
 #define OUTPUT_ISSET(_out) ((_out)->out >= 0 || (_out)->err >= 0)
 
+/* Bits in struct output's inmem.  */
+#define OUTPUT_INMEM_OUT 0x1
+#define OUTPUT_INMEM_ERR 0x2
+
 /* Write a string to the current STDOUT or STDERR.  */
 static void
 _outputs (struct output *out, int is_err, const char *msg)
@@ -145,11 +153,58 @@ log_working_directory (int entering)
 
 #ifndef NO_OUTPUT_SYNC
 
-/* Support routine for output_sync() */
+/* Output kept in memory is moved to a temp file once it grows this large.  */
+#ifndef OUTPUT_SPILL_SIZE
+# define OUTPUT_SPILL_SIZE (4 * 1024 * 1024)
+#endif
+
+/* Try to have the system copy the contents of the temp file FROM, starting
+   at offset OFF, to the file descriptor TO without passing it through our
+   buffers.  Returns the offset in FROM reached.  This may not be its end,
+   for example if TO doesn't support this (or is in append mode).  */
+static off_t
+copy_from_tmp (int from, off_t off, int to)
+{
+#if defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SENDFILE)
+  struct stat st;
+
+  if (fstat (from, &st) < 0)
+    return off;
+
+# ifdef HAVE_COPY_FILE_RANGE
+  while (off < st.st_size)
+    {
+      ssize_t r;
+      EINTRLOOP (r, copy_file_range (from, &off, to, NULL,
+                                     st.st_size - off, 0));
+      if (r <= 0)
+        break;
+    }
+# endif
+
+# ifdef HAVE_SENDFILE
+  while (off < st.st_size)
+    {
+      ssize_t r;
+      EINTRLOOP (r, sendfile (to, from, &off, st.st_size - off));
+      if (r <= 0)
+        break;
+    }
+# endif
+#else
+  (void) from;
+  (void) to;
+#endif
+
+  return off;
+}
+
+/* Support routine for output_sync(): copy FROM, starting at offset OFF.  */
 static void
-pump_from_tmp (int from, FILE *to)
+pump_from_tmp (int from, off_t off, FILE *to)
 {
   static char buffer[8192];
+  off_t done;
 
 #if MK_OS_W32
   int prev_mode;
@@ -159,7 +214,10 @@ pump_from_tmp (int from, FILE *to)
   prev_mode = _setmode (fileno (to), _O_BINARY);
 #endif
 
-  if (lseek (from, 0, SEEK_SET) == -1)
+  fflush (to);
+  done = copy_from_tmp (from, off, fileno (to));
+
+  if (lseek (from, done, SEEK_SET) == -1)
     perror ("lseek()");
 
   while (1)
@@ -195,6 +253,91 @@ output_tmpfd (void)
   return fd;
 }
 
+/* Returns a file descriptor for capturing output, kept in memory if possible.
+   If it is, sets the bit INMEM in OUT->inmem.  */
+static int
+output_memfd (struct output *out, unsigned int inmem)
+{
+  int fd = os_memtmp ();
+  if (fd < 0)
+    return output_tmpfd ();
+
+  out->inmem |= inmem;
+  fd_set_append (fd);
+  return fd;
+}
+
+/* If the output held in memory for OUT has grown too large, move it into
+   temp files.  A job may still be writing to the memory file, so it is
+   kept: its contents are copied out and the memory they used is freed by
+   punching a hole in it, and the job's output carries on at its end.  */
+int
+output_spill (struct output *out)
+{
+  int i;
+
+  for (i = 0; i < 2; ++i)
+    {
+      int fd = i ? out->err : out->out;
+      unsigned int bit = i ? OUTPUT_INMEM_ERR : OUTPUT_INMEM_OUT;
+      struct stat st;
+      off_t done;
+      int r = 0;
+
+      if (!(out->inmem & bit) || fstat (fd, &st) < 0
+          || st.st_size - out->spilled[i] < OUTPUT_SPILL_SIZE)
+        continue;
+
+      if (out->spill[i] < 0)
+        {
+          out->spill[i] = get_tmpfd (NULL);
+          if (out->spill[i] < 0)
+            continue;
+          fd_noinherit (out->spill[i]);
+        }
+
+      /* The temp file isn't in append mode so we can use copy_from_tmp:
+         write anything left over ourselves.  */
+      done = copy_from_tmp (fd, out->spilled[i], out->spill[i]);
+      r = lseek (fd, done, SEEK_SET) == -1 ? -1 : 0;
+      while (r == 0 && done < st.st_size)
+        {
+          char buffer[8192];
+          ssize_t len, w = 0;
+
+          EINTRLOOP (len, read (fd, buffer, sizeof (buffer)));
+          if (len <= 0)
+            break;
+          while (w < len && r == 0)
+            {
+              ssize_t n;
+              EINTRLOOP (n, write (out->spill[i], buffer + w, len - w));
+              if (n < 0)
+                r = -1;
+              else
+                w += n;
+            }
+          done += len;
+        }
+
+      if (r < 0)
+        {
+          /* Forget the partial copy: the memory file still has it all.  */
+          EINTRLOOP (r, ftruncate (out->spill[i], out->spilled[i]));
+          lseek (out->spill[i], out->spilled[i], SEEK_SET);
+          continue;
+        }
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE)
+      EINTRLOOP (r, fallocate (fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+                               out->spilled[i], done - out->spilled[i]));
+#endif
+      out->spilled[i] = done;
+    }
+
+  return out->inmem != 0;
+}
+
 /* Adds file descriptors to the child structure to support output_sync; one
    for stdout and one for stderr as long as they are open.  If stdout and
    stderr share a device they can share a temp file too.
@@ -222,7 +365,7 @@ setup_tmpfile (struct output *out)
 
   if (ANY_SET (io_state, IO_STDOUT_OK))
     {
-      int fd = output_tmpfd ();
+      int fd = output_memfd (out, OUTPUT_INMEM_OUT);
       if (fd < 0)
         goto error;
       fd_noinherit (fd);
@@ -235,7 +378,7 @@ setup_tmpfile (struct output *out)
         out->err = out->out;
       else
         {
-          int fd = output_tmpfd ();
+          int fd = output_memfd (out, OUTPUT_INMEM_ERR);
           if (fd < 0)
             goto error;
           fd_noinherit (fd);
@@ -269,6 +412,7 @@ output_dump (struct output *out)
 
   int outfd_not_empty = FD_NOT_EMPTY (out->out);
   int errfd_not_empty = FD_NOT_EMPTY (out->err);
+  int i;
 
   if (outfd_not_empty || errfd_not_empty)
     {
@@ -290,9 +434,17 @@ output_dump (struct output *out)
         traced = log_working_directory (1);
 
       if (outfd_not_empty)
-        pump_from_tmp (out->out, stdout);
+        {
+          if (out->spill[0] >= 0)
+            pump_from_tmp (out->spill[0], 0, stdout);
+          pump_from_tmp (out->out, out->spilled[0], stdout);
+        }
       if (errfd_not_empty && out->err != out->out)
-        pump_from_tmp (out->err, stderr);
+        {
+          if (out->spill[1] >= 0)
+            pump_from_tmp (out->spill[1], 0, stderr);
+          pump_from_tmp (out->err, out->spilled[1], stderr);
+        }
 
       if (traced)
         log_working_directory (0);
@@ -313,6 +465,14 @@ output_dump (struct output *out)
           lseek (out->err, 0, SEEK_SET);
           EINTRLOOP (e, ftruncate (out->err, 0));
         }
+      for (i = 0; i < 2; ++i)
+        if (out->spill[i] >= 0)
+          {
+            int e;
+            lseek (out->spill[i], 0, SEEK_SET);
+            EINTRLOOP (e, ftruncate (out->spill[i], 0));
+            out->spilled[i] = 0;
+          }
     }
 }
 #endif /* NO_OUTPUT_SYNC */
@@ -327,7 +487,10 @@ output_init (struct output *out)
   if (out)
     {
       out->out = out->err = OUTPUT_NONE;
+      out->spill[0] = out->spill[1] = OUTPUT_NONE;
+      out->spilled[0] = out->spilled[1] = 0;
       out->syncout = !!output_sync;
+      out->inmem = 0;
       return;
     }
 
@@ -357,6 +520,10 @@ output_close (struct output *out)
     close (out->out);
   if (out->err >= 0 && out->err != out->out)
     close (out->err);
+  if (out->spill[0] >= 0)
+    close (out->spill[0]);
+  if (out->spill[1] >= 0)
+    close (out->spill[1]);
 
   output_init (out);
 }
@@ -368,8 +535,12 @@ output_start (void)
 #ifndef NO_OUTPUT_SYNC
   /* If we're syncing output make sure the temporary file is set up.  */
   if (output_context && output_context->syncout)
-    if (! OUTPUT_ISSET(output_context))
-      setup_tmpfile (output_context);
+    {
+      if (! OUTPUT_ISSET(output_context))
+        setup_tmpfile (output_context);
+      else if (output_context->inmem)
+        output_spill (output_context);
+    }
 #endif
 
   /* If we're not syncing this output per-line or per-target, make sure we emit
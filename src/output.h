@@ -18,7 +18,10 @@ struct output
   {
     int out;
     int err;
+    int spill[2];               /* Output of out and err moved from memory.  */
+    off_t spilled[2];           /* How much of out and err was moved.  */
     unsigned int syncout:1;     /* True if we want to synchronize output.  */
+    unsigned int inmem:2;       /* Which output is kept in memory.  */
  };
 
 extern struct output *output_context;
@@ -52,7 +55,12 @@ void outputs (int is_err, const char *msg);
 
 #if defined(NO_OUTPUT_SYNC)
 # define output_dump(_o) (void)(0)
+# define output_spill(_o) (0)
 #else
 /* Dump any child output content to stdout, and reset it.  */
 void output_dump (struct output *out);
+
+/* Move child output held in memory to temp files if it has grown large.
+   Returns nonzero if any of it is still held in memory.  */
+int output_spill (struct output *out);
 #endif
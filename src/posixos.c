@@ -37,6 +37,21 @@ this program.  If not, see <https://www.gnu.org/licenses/>.  */
 # include <sys/select.h>
 #endif
 
+#if defined(HAVE_PSELECT) && defined(HAVE_SYS_SOCKET_H)
+# include <sys/socket.h>
+#endif
+
+#if defined(HAVE_SYS_WAIT_H)
+# include <sys/wait.h>
+#endif
+
+#ifdef HAVE_MEMFD_CREATE
+# include <sys/mman.h>
+#endif
+#ifndef WCOREDUMP
+# define WCOREDUMP(x) 0
+#endif
+
 #include "debug.h"
 #include "job.h"
 #include "os.h"
@@ -449,6 +464,8 @@ jobserver_pre_acquire ()
 
 #ifdef HAVE_PSELECT
 
+static int worker_fdset (fd_set *readfds);
+
 /* Use pselect() to atomically wait for both a signal and a file descriptor.
    It also provides a timeout facility so we don't need to use SIGALRM.
 
@@ -476,13 +493,19 @@ jobserver_acquire (int timeout)
   while (1)
     {
       fd_set readfds;
+      int maxfd;
       int r;
       char intake;
 
+      /* Shell workers don't exit when they finish a job, so also wake up
+         when one of them reports a status.  */
       FD_ZERO (&readfds);
+      maxfd = worker_fdset (&readfds);
       FD_SET (job_fds[0], &readfds);
+      if (job_fds[0] > maxfd)
+        maxfd = job_fds[0];
 
-      r = pselect (job_fds[0]+1, &readfds, NULL, NULL, specp, &empty);
+      r = pselect (maxfd+1, &readfds, NULL, NULL, specp, &empty);
       if (r < 0)
         switch (errno)
           {
@@ -499,8 +522,8 @@ jobserver_acquire (int timeout)
             pfatal_with_name (_("pselect jobs pipe"));
           }
 
-      if (r == 0)
-        /* Timeout.  */
+      if (r == 0 || !FD_ISSET (job_fds[0], &readfds))
+        /* Timeout, or a shell worker finished.  */
         return 0;
 
       /* The read FD is ready: read it!  This is non-blocking.  */
@@ -521,6 +544,30 @@ jobserver_acquire (int timeout)
     }
 }
 
+/* Wait until a child exits, a shell worker finishes a job, or MSECS
+   milliseconds pass.  */
+void
+os_wait_child (unsigned int msecs)
+{
+  struct timespec spec;
+  sigset_t empty;
+  fd_set readfds;
+  int maxfd;
+  int r;
+
+  sigemptyset (&empty);
+  spec.tv_sec = msecs / 1000;
+  spec.tv_nsec = (msecs % 1000) * 1000000L;
+
+  FD_ZERO (&readfds);
+  maxfd = worker_fdset (&readfds);
+
+  /* SIGCHLD will show up as an EINTR.  */
+  r = pselect (maxfd + 1, &readfds, NULL, NULL, &spec, &empty);
+  if (r < 0 && errno != EINTR)
+    pfatal_with_name ("pselect");
+}
+
 #else
 
 /* This method uses a "traditional" UNIX model for waiting on both a signal
@@ -759,6 +806,1004 @@ osync_release ()
 
 #endif
 
+/* This section provides OS-specific functions to support shell workers.
+
+   A worker is a shell started with no arguments and an empty environment,
+   reading commands from a socket on its standard input.  Each command is run
+   in a subshell, so changes it makes to the directory, variables, traps, etc.
+   don't affect later commands.  The subshell writes its process ID to
+   descriptor 3, so make can signal it, then resets the directory and traps
+   and runs the command; then the worker writes the exit status of the
+   subshell to descriptor 3.  Waiting for workers relies on SIGCHLD being
+   blocked everywhere except within pselect(), as the jobserver does.  */
+
+#if defined(MAKE_JOBSERVER) && defined(HAVE_PSELECT) && defined(MSG_NOSIGNAL)
+
+struct worker
+  {
+    const char *shell;          /* The shell this worker is running.  */
+    pid_t pid;                  /* The worker's process ID.  */
+    int cmd_fd;                 /* Send commands to the worker here.  */
+    int status_fd;              /* Read exit statuses from the worker here.  */
+    pid_t job_pid;              /* The subshell running the command.  */
+    int killed;                 /* The signal we sent it, or 0.  */
+    unsigned int busy:1;        /* Nonzero if a command is running.  */
+    unsigned int started:1;     /* Nonzero once job_pid has been read.  */
+    unsigned int status_len;    /* Length of the status read so far.  */
+    char status[32];            /* The status read so far.  */
+  };
+
+static struct worker *workers = NULL;
+static unsigned int num_workers = 0;
+
+/* Stop worker W.  It will exit when it sees EOF on its input.  */
+
+static void
+worker_close (struct worker *w)
+{
+  close (w->cmd_fd);
+  close (w->status_fd);
+  w->cmd_fd = w->status_fd = -1;
+  w->pid = -1;
+  w->busy = 0;
+  w->started = 0;
+  w->killed = 0;
+}
+
+/* Start a worker running SHELL in W.  Returns 0 on success, else -1.  */
+
+static int
+worker_spawn (struct worker *w, const char *shell)
+{
+  char *env[] = { NULL };
+  int cmd[2], status[2];
+  pid_t pid;
+
+  if (access (shell, X_OK) != 0)
+    return -1;
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, cmd) < 0)
+    return -1;
+  if (pipe (status) < 0)
+    {
+      close (cmd[0]);
+      close (cmd[1]);
+      return -1;
+    }
+
+  fd_noinherit (cmd[0]);
+  fd_noinherit (cmd[1]);
+  fd_noinherit (status[0]);
+  fd_noinherit (status[1]);
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      int fd;
+
+      /* We are the worker.  dup2() clears close-on-exec on the copies.
+         Keep make's standard error on descriptor 4 for the commands, and
+         discard the worker's own messages, such as for commands killed by
+         a signal.  */
+      unblock_all_sigs ();
+      if (dup2 (cmd[1], 0) < 0 || dup2 (status[1], 3) < 0
+          || dup2 (FD_STDERR, 4) < 0)
+        _exit (127);
+      fd = open ("/dev/null", O_WRONLY);
+      if (fd < 0 || dup2 (fd, 2) < 0)
+        _exit (127);
+      close (fd);
+      execle (shell, shell, (char *) NULL, env);
+      _exit (127);
+    }
+
+  close (cmd[1]);
+  close (status[1]);
+
+  if (pid < 0)
+    {
+      close (cmd[0]);
+      close (status[0]);
+      return -1;
+    }
+
+  set_blocking (status[0], 0);
+
+  w->shell = strcache_add (shell);
+  w->pid = pid;
+  w->cmd_fd = cmd[0];
+  w->status_fd = status[0];
+  w->busy = 0;
+  w->started = 0;
+  w->killed = 0;
+  w->status_len = 0;
+
+  DB (DB_JOBS, (_("Started shell worker %ld (%s)\n"), (long) pid, shell));
+
+  return 0;
+}
+
+/* Add the status descriptor of each busy worker to READFDS.
+   Returns the highest descriptor added, or -1 if there were none.  */
+
+static int
+worker_fdset (fd_set *readfds)
+{
+  struct worker *w;
+  int maxfd = -1;
+
+  for (w = workers; w < workers + num_workers; ++w)
+    if (w->busy)
+      {
+        FD_SET (w->status_fd, readfds);
+        if (w->status_fd > maxfd)
+          maxfd = w->status_fd;
+      }
+
+  return maxfd;
+}
+
+/* Find an idle worker running SHELL, starting one if needed.  */
+
+static struct worker *
+worker_find (const char *shell)
+{
+  struct worker *w;
+  struct worker *idle = NULL;
+
+  for (w = workers; w < workers + num_workers; ++w)
+    if (!w->busy)
+      {
+        if (w->pid > 0 && streq (w->shell, shell))
+          return w;
+        if (!idle || w->pid < 0)
+          idle = w;
+      }
+
+  /* If there is an idle worker running the wrong shell, replace it.  */
+  if (idle)
+    {
+      if (idle->pid > 0)
+        worker_close (idle);
+      w = idle;
+    }
+  else
+    {
+      workers = xrealloc (workers, (num_workers + 1) * sizeof (*workers));
+      w = &workers[num_workers++];
+      w->pid = -1;
+    }
+
+  return worker_spawn (w, shell) == 0 ? w : NULL;
+}
+
+/* Append STR to the buffer at P as a single-quoted shell word.
+   The buffer needs room for four bytes for each byte of STR, plus two.  */
+
+static char *
+quote_word (char *p, const char *str)
+{
+  *(p++) = '\'';
+  for (; *str != '\0'; ++str)
+    if (*str == '\'')
+      p = mempcpy (p, "'\\''", 4);
+    else
+      *(p++) = *str;
+  *(p++) = '\'';
+
+  return p;
+}
+
+pid_t
+worker_start_job (const char *shell, int errexit, const char *cmd,
+                  char **envp, int outfd, int errfd)
+{
+  static int have_proc = -1;
+  struct worker *w;
+  char **ep;
+  char *buf, *p;
+  size_t len;
+
+  /* The subshell finds its process ID, and the names of make's descriptors
+     to send output somewhere else, in /proc.  */
+  if (have_proc < 0)
+    have_proc = access ("/proc/self/fd", X_OK) == 0;
+  if (!have_proc)
+    return -1;
+
+  /* The shell can only export variables with valid names.  */
+  len = strlen (cmd) * 4 + 300;
+  if (starting_directory)
+    len += strlen (starting_directory) * 4;
+  for (ep = envp; *ep != NULL; ++ep)
+    {
+      const char *cp = *ep;
+
+      if (ISDIGIT (*cp))
+        return -1;
+      while (*cp == '_' || isalnum ((unsigned char) *cp))
+        ++cp;
+      if (cp == *ep)
+        return -1;
+      if (*cp != '=')
+        return -1;
+
+      len += strlen (*ep) * 4 + 3;
+    }
+
+  w = worker_find (shell);
+  if (!w)
+    return -1;
+
+  /* Construct:
+       (read -r P X </proc/self/stat; echo "$P" >&3; exec 3>&-; unset P X
+        trap - EXIT HUP INT QUIT TERM; cd 'DIR' || exit 127
+        export 'N=V'...; set -e; eval 'CMD') </dev/null >>OUT 2>>ERR 4>&-
+       echo $? >&3
+
+     The read is done by the subshell itself, as it's a built-in command.
+     We keep the value of PWD set by cd since make's may be out of date.  */
+  p = buf = xmalloc (len);
+  p = stpcpy (p, "(read -r GMK_PID GMK_X </proc/self/stat; "
+              "echo \"$GMK_PID\" >&3; exec 3>&-; unset GMK_PID GMK_X; "
+              "trap - EXIT HUP INT QUIT TERM; ");
+  if (starting_directory)
+    {
+      p = stpcpy (p, "cd ");
+      p = quote_word (p, starting_directory);
+      p = stpcpy (p, " || exit 127; ");
+    }
+  for (ep = envp; *ep != NULL; ++ep)
+    if (strneq (*ep, "PWD=", 4))
+      p = stpcpy (p, "export PWD; ");
+    else
+      {
+        p = stpcpy (p, "export ");
+        p = quote_word (p, *ep);
+        p = stpcpy (p, "; ");
+      }
+  if (errexit)
+    p = stpcpy (p, "set -e; ");
+  p = stpcpy (p, "eval ");
+  p = quote_word (p, cmd);
+  p = stpcpy (p, ") </dev/null");
+  if (outfd >= 0)
+    p += sprintf (p, " >>/proc/%ld/fd/%d", (long) getpid (), outfd);
+  if (errfd >= 0 && errfd == outfd)
+    p = stpcpy (p, " 2>&1");
+  else if (errfd >= 0)
+    p += sprintf (p, " 2>>/proc/%ld/fd/%d", (long) getpid (), errfd);
+  else
+    p = stpcpy (p, " 2>&4");
+  p = stpcpy (p, " 4>&-\necho $? >&3\n");
+
+  /* If the worker has gone away, forget it and let the caller run the
+     command some other way.  */
+  len = p - buf;
+  p = buf;
+  while (len > 0)
+    {
+      ssize_t r = send (w->cmd_fd, p, len, MSG_NOSIGNAL);
+      if (r < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          free (buf);
+          worker_close (w);
+          return -1;
+        }
+      p += r;
+      len -= r;
+    }
+
+  free (buf);
+
+  w->busy = 1;
+  w->started = 0;
+  w->killed = 0;
+  w->status_len = 0;
+
+  return w->pid;
+}
+
+/* Read what worker W has written to its status channel.  Returns 1 once the
+   exit status has arrived, 0 if it hasn't yet, or -1 if the channel closed
+   or something is badly wrong.  This might be called from a signal
+   handler.  */
+
+static int
+worker_read (struct worker *w)
+{
+  char *nl;
+  ssize_t n;
+
+  EINTRLOOP (n, read (w->status_fd, w->status + w->status_len,
+                      sizeof (w->status) - 1 - w->status_len));
+  if (n < 0 && errno == EAGAIN)
+    return 0;
+  if (n <= 0)
+    return -1;
+
+  w->status_len += n;
+  w->status[w->status_len] = '\0';
+
+  /* The first line is the process ID of the subshell.  */
+  nl = strchr (w->status, '\n');
+  if (nl && !w->started)
+    {
+      long pid = atol (w->status);
+
+      w->job_pid = (pid_t) pid;
+      w->started = 1;
+      w->status_len -= nl + 1 - w->status;
+      memmove (w->status, nl + 1, w->status_len + 1);
+      nl = strchr (w->status, '\n');
+    }
+
+  if (nl)
+    return 1;
+
+  /* A status can't be this long.  */
+  if (w->status_len == sizeof (w->status) - 1)
+    {
+      kill (w->pid, SIGKILL);
+      return -1;
+    }
+
+  return 0;
+}
+
+/* Finish the job of worker W, whose status channel has closed.  */
+
+static void
+worker_died (struct worker *w, int *exit_code_ptr, int *signal_ptr,
+             int *coredump_ptr)
+{
+  pid_t pid;
+  int status;
+
+  /* It has closed its end so it should be gone, unless reap_children()
+     has already collected it.  */
+  EINTRLOOP (pid, waitpid (w->pid, &status, 0));
+  if (pid == w->pid && WIFSIGNALED (status))
+    {
+      *exit_code_ptr = 0;
+      *signal_ptr = WTERMSIG (status);
+      *coredump_ptr = WCOREDUMP (status);
+    }
+  else
+    {
+      *exit_code_ptr = 127;
+      *signal_ptr = 0;
+      *coredump_ptr = 0;
+    }
+
+  DB (DB_JOBS, (_("Shell worker %ld exited\n"), (long) w->pid));
+
+  worker_close (w);
+}
+
+pid_t
+worker_status (int *exit_code_ptr, int *signal_ptr, int *coredump_ptr,
+               int block)
+{
+  struct timespec zero = { 0, 0 };
+  sigset_t empty;
+
+  sigemptyset (&empty);
+
+  while (1)
+    {
+      struct worker *w;
+      fd_set readfds;
+      int maxfd;
+      int r;
+
+      FD_ZERO (&readfds);
+      maxfd = worker_fdset (&readfds);
+      if (maxfd < 0)
+        return 0;
+
+      /* SIGCHLD will show up as an EINTR: let the caller reap it.  */
+      r = pselect (maxfd + 1, &readfds, NULL, NULL, block ? NULL : &zero,
+                   &empty);
+      if (r < 0)
+        {
+          if (errno == EINTR)
+            return 0;
+          pfatal_with_name ("pselect");
+        }
+
+      for (w = workers; r > 0 && w < workers + num_workers; ++w)
+        if (w->busy && FD_ISSET (w->status_fd, &readfds))
+          {
+            pid_t id = w->pid;
+            int s = worker_read (w);
+
+            if (s < 0)
+              {
+                worker_died (w, exit_code_ptr, signal_ptr, coredump_ptr);
+                return id;
+              }
+            if (s > 0)
+              {
+                *exit_code_ptr = atoi (w->status);
+                *signal_ptr = 0;
+                *coredump_ptr = 0;
+
+                /* Report a subshell we killed as the shell reports it.  */
+                if (w->killed && *exit_code_ptr == 128 + w->killed)
+                  {
+                    *exit_code_ptr = 0;
+                    *signal_ptr = w->killed;
+                  }
+
+                w->busy = 0;
+                return id;
+              }
+          }
+
+      if (!block)
+        return 0;
+    }
+}
+
+void
+worker_kill (pid_t id, int sig)
+{
+  struct worker *w;
+
+  for (w = workers; w < workers + num_workers; ++w)
+    if (w->busy && w->pid == id)
+      {
+        /* The subshell writes its ID as soon as it starts: if we haven't
+           read it yet, give it a moment.  */
+        while (!w->started)
+          {
+            struct timeval tv = { 1, 0 };
+            fd_set readfds;
+
+            FD_ZERO (&readfds);
+            FD_SET (w->status_fd, &readfds);
+            if (select (w->status_fd + 1, &readfds, NULL, NULL, &tv) <= 0
+                || worker_read (w) < 0)
+              break;
+          }
+
+        w->killed = sig;
+        kill (w->started && w->job_pid > 0 ? w->job_pid : w->pid, sig);
+        return;
+      }
+}
+
+void
+worker_cleanup ()
+{
+  struct worker *w;
+
+  for (w = workers; w < workers + num_workers; ++w)
+    if (w->pid > 0)
+      worker_close (w);
+
+  free (workers);
+  workers = NULL;
+  num_workers = 0;
+}
+
+/* The $(shell) coprocess is a single shell, started like a worker, which runs
+   the commands of $(shell) functions.  Its environment is kept in step with
+   make's exported variables by sending it export and unset commands only
+   when they change.  Each command is run in a subshell whose standard output
+   is a FIFO that make reads; then the shell writes the exit status to
+   descriptor 3.  The shell doesn't keep the FIFO open itself, so make reads
+   the output until EOF, waiting for any background commands which still
+   have it open, just as it does for other $(shell) calls.  The command's
+   standard input is make's, which the shell keeps on descriptor 5.  */
+
+static struct
+  {
+    const char *shell;          /* The shell the coprocess is running.  */
+    pid_t pid;                  /* Its process ID, or -1.  */
+    int cmd_fd;                 /* Send commands to it here.  */
+    int status_fd;              /* Read exit statuses from it here.  */
+    int out_fd;                 /* Read the output of commands here.  */
+    char *fifo;                 /* The name of the FIFO for their output.  */
+    char **env;                 /* The environment it has, sorted by name.  */
+    unsigned int env_count;
+    unsigned int failed:1;      /* Nonzero if it died: don't start another.  */
+  } coproc = { NULL, -1, -1, -1, -1, NULL, NULL, 0, 0 };
+
+/* Stop the coprocess.  It will exit when it sees EOF on its input.
+   This might be called from a signal handler.  */
+
+static void
+coproc_close (void)
+{
+  unsigned int i;
+
+  if (coproc.pid > 0)
+    {
+      close (coproc.cmd_fd);
+      close (coproc.status_fd);
+      close (coproc.out_fd);
+    }
+  coproc.cmd_fd = coproc.status_fd = coproc.out_fd = -1;
+  coproc.pid = -1;
+
+  if (coproc.fifo)
+    {
+      int r;
+      EINTRLOOP (r, unlink (coproc.fifo));
+    }
+
+  if (handling_fatal_signal)
+    return;
+
+  free (coproc.fifo);
+  coproc.fifo = NULL;
+
+  for (i = 0; i < coproc.env_count; ++i)
+    free (coproc.env[i]);
+  free (coproc.env);
+  coproc.env = NULL;
+  coproc.env_count = 0;
+}
+
+/* Start a coprocess running SHELL.  Returns 0 on success, else -1.  */
+
+static int
+coproc_spawn (const char *shell)
+{
+#define COPROC_PREFIX "GmSHELL"
+  char *env[] = { NULL };
+  const char *tmpdir;
+  int cmd[2], status[2], out;
+  pid_t pid;
+  int r;
+
+  if (access (shell, X_OK) != 0)
+    return -1;
+
+  /* The template in misc.c uses 6 X's so this name cannot conflict with
+     it, nor with the jobserver's.  */
+  tmpdir = get_tmpdir ();
+  coproc.fifo = xmalloc (strlen (tmpdir) + CSTRLEN (COPROC_PREFIX)
+                         + INTSTR_LENGTH + 2);
+  sprintf (coproc.fifo, "%s/" COPROC_PREFIX "%03" MK_PRI64_PREFIX "d",
+           tmpdir, (long long)make_pid ());
+
+  EINTRLOOP (r, mkfifo (coproc.fifo, 0600));
+  if (r < 0)
+    {
+      free (coproc.fifo);
+      coproc.fifo = NULL;
+      return -1;
+    }
+
+  /* Open the read side in non-blocking mode, else it will hang until the
+     write side is open.  */
+  EINTRLOOP (out, open (coproc.fifo, O_RDONLY|O_NONBLOCK));
+  if (out < 0)
+    goto error;
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, cmd) < 0)
+    {
+      close (out);
+      goto error;
+    }
+  if (pipe (status) < 0)
+    {
+      close (out);
+      close (cmd[0]);
+      close (cmd[1]);
+      goto error;
+    }
+
+  fd_noinherit (cmd[0]);
+  fd_noinherit (cmd[1]);
+  fd_noinherit (status[0]);
+  fd_noinherit (status[1]);
+  fd_noinherit (out);
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      int c, st;
+
+      /* We are the coprocess.  Move our ends of the channels out of the way
+         before putting them in place; dup2() clears close-on-exec.  */
+      unblock_all_sigs ();
+      c = fcntl (cmd[1], F_DUPFD, 6);
+      st = fcntl (status[1], F_DUPFD, 6);
+      if (c < 0 || st < 0)
+        _exit (127);
+      if (dup2 (FD_STDIN, 5) < 0)
+        {
+          int fd = open ("/dev/null", O_RDONLY);
+          if (fd < 0 || dup2 (fd, 5) < 0)
+            _exit (127);
+        }
+      if (dup2 (c, 0) < 0 || dup2 (st, 3) < 0)
+        _exit (127);
+      close (c);
+      close (st);
+      execle (shell, shell, (char *) NULL, env);
+      _exit (127);
+    }
+
+  close (cmd[1]);
+  close (status[1]);
+
+  if (pid < 0)
+    {
+      close (cmd[0]);
+      close (status[0]);
+      close (out);
+      goto error;
+    }
+
+  set_blocking (status[0], 0);
+
+  coproc.shell = strcache_add (shell);
+  coproc.pid = pid;
+  coproc.cmd_fd = cmd[0];
+  coproc.status_fd = status[0];
+  coproc.out_fd = out;
+
+  DB (DB_JOBS, (_("Started shell coprocess %ld (%s)\n"), (long) pid, shell));
+
+  return 0;
+
+ error:
+  EINTRLOOP (r, unlink (coproc.fifo));
+  free (coproc.fifo);
+  coproc.fifo = NULL;
+  return -1;
+}
+
+/* Compare two environment strings by the names of their variables.  */
+
+static int
+env_name_cmp (const void *x, const void *y)
+{
+  const unsigned char *a = *(const unsigned char **) x;
+  const unsigned char *b = *(const unsigned char **) y;
+
+  for (; *a == *b; ++a, ++b)
+    if (*a == '=')
+      return 0;
+
+  return (*a == '=' ? 0 : *a) - (*b == '=' ? 0 : *b);
+}
+
+/* Append to the buffer at P the commands that give the coprocess the
+   environment ENV, which has COUNT entries sorted by name, and remember it.
+   The buffer needs room for four bytes for each byte of ENV and of the
+   coprocess's current environment, plus twenty for each entry.  */
+
+static char *
+coproc_sync_env (char *p, char **env, unsigned int count)
+{
+  char *start = p;
+  unsigned int i = 0;
+  unsigned int j = 0;
+
+  while (i < coproc.env_count || j < count)
+    {
+      int c;
+
+      if (i == coproc.env_count)
+        c = 1;
+      else if (j == count)
+        c = -1;
+      else
+        c = env_name_cmp (&coproc.env[i], &env[j]);
+
+      if (c < 0)
+        {
+          const char *eq = strchr (coproc.env[i], '=');
+          p = stpcpy (p, "unset ");
+          p = mempcpy (p, coproc.env[i], eq - coproc.env[i]);
+          *(p++) = '\n';
+          ++i;
+          continue;
+        }
+
+      if (c > 0 || !streq (coproc.env[i], env[j]))
+        {
+          /* Keep the shell's own value of PWD, as workers do.  */
+          if (strneq (env[j], "PWD=", 4))
+            p = stpcpy (p, "export PWD\n");
+          else
+            {
+              p = stpcpy (p, "export ");
+              p = quote_word (p, env[j]);
+              *(p++) = '\n';
+            }
+        }
+      if (c == 0)
+        ++i;
+      ++j;
+    }
+
+  if (p != start)
+    {
+      for (i = 0; i < coproc.env_count; ++i)
+        free (coproc.env[i]);
+      coproc.env = xrealloc (coproc.env, count * sizeof (char *));
+      for (j = 0; j < count; ++j)
+        coproc.env[j] = xstrdup (env[j]);
+      coproc.env_count = count;
+    }
+
+  return p;
+}
+
+/* Read from FD, which is non-blocking, onto the end of the buffer *BUFP of
+   size *MAXP which holds *LENP bytes.  Returns the result of the last
+   read(), or 1 if there was nothing more to read.  */
+
+static ssize_t
+coproc_read (int fd, char **bufp, size_t *lenp, size_t *maxp)
+{
+  while (1)
+    {
+      ssize_t n;
+
+      if (*lenp == *maxp)
+        {
+          *maxp += 512;
+          *bufp = xrealloc (*bufp, *maxp + 1);
+        }
+
+      EINTRLOOP (n, read (fd, *bufp + *lenp, *maxp - *lenp));
+      if (n < 0 && errno == EAGAIN)
+        return 1;
+      if (n <= 0)
+        return n;
+      *lenp += n;
+    }
+}
+
+int
+coprocess_run (const char *shell, int errexit, const char *cmd, char **envp,
+               char **output, size_t *length, int *status)
+{
+  char **env;
+  char *buf, *p, *out, *st;
+  size_t len, outlen, outmax, stlen, stmax;
+  unsigned int count, i;
+  int wfd, sig = 0;
+
+  if (coproc.failed)
+    return -1;
+
+  /* The shell can only export variables with valid names.  */
+  len = strlen (cmd) * 4 + 100;
+  for (count = 0; envp[count] != NULL; ++count)
+    {
+      const char *cp = envp[count];
+
+      if (ISDIGIT (*cp))
+        return -1;
+      while (*cp == '_' || isalnum ((unsigned char) *cp))
+        ++cp;
+      if (cp == envp[count] || *cp != '=')
+        return -1;
+
+      len += strlen (envp[count]) * 4 + 20;
+    }
+  for (i = 0; i < coproc.env_count; ++i)
+    len += strlen (coproc.env[i]) + 20;
+
+  if (coproc.pid > 0 && !streq (coproc.shell, shell))
+    coproc_close ();
+  if (coproc.pid < 0 && coproc_spawn (shell) < 0)
+    {
+      coproc.failed = 1;
+      return -1;
+    }
+  len += strlen (coproc.fifo) * 4;
+
+  /* Hold the FIFO open for writing until the command has finished, so we
+     don't see EOF before the command opens it.  */
+  EINTRLOOP (wfd, open (coproc.fifo, O_WRONLY|O_NONBLOCK));
+  if (wfd < 0)
+    goto died;
+  fd_noinherit (wfd);
+
+  env = xmalloc ((count + 1) * sizeof (char *));
+  memcpy (env, envp, count * sizeof (char *));
+  qsort (env, count, sizeof (char *), env_name_cmp);
+
+  /* Construct:
+       export 'N=V'... / unset N...
+       (set -e; eval 'CMD') <&5 >'FIFO' 3>&- 5>&-
+       echo $? >&3  */
+  p = buf = xmalloc (len);
+  p = coproc_sync_env (p, env, count);
+  free (env);
+  p = stpcpy (p, "(");
+  if (errexit)
+    p = stpcpy (p, "set -e; ");
+  p = stpcpy (p, "eval ");
+  p = quote_word (p, cmd);
+  p = stpcpy (p, ") <&5 >");
+  p = quote_word (p, coproc.fifo);
+  p = stpcpy (p, " 3>&- 5>&-\necho $? >&3\n");
+
+  len = p - buf;
+  p = buf;
+  while (len > 0)
+    {
+      ssize_t r = send (coproc.cmd_fd, p, len, MSG_NOSIGNAL);
+      if (r < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          free (buf);
+          close (wfd);
+          goto died;
+        }
+      p += r;
+      len -= r;
+    }
+  free (buf);
+
+  /* Read the output until the status arrives, then until EOF.  */
+  outlen = stlen = 0;
+  outmax = 200;
+  out = xmalloc (outmax + 1);
+  stmax = 16;
+  st = xmalloc (stmax + 1);
+  while (1)
+    {
+      fd_set readfds;
+      int maxfd = coproc.out_fd;
+      int r;
+
+      FD_ZERO (&readfds);
+      FD_SET (coproc.out_fd, &readfds);
+      if (wfd >= 0)
+        {
+          FD_SET (coproc.status_fd, &readfds);
+          if (coproc.status_fd > maxfd)
+            maxfd = coproc.status_fd;
+        }
+
+      r = pselect (maxfd + 1, &readfds, NULL, NULL, NULL, NULL);
+      if (r < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          pfatal_with_name ("pselect");
+        }
+
+      if (FD_ISSET (coproc.out_fd, &readfds))
+        {
+          /* We only see EOF once we've closed our end.  */
+          r = coproc_read (coproc.out_fd, &out, &outlen, &outmax);
+          if (r < 0 || (r == 0 && wfd >= 0))
+            break;
+          if (r == 0)
+            {
+              out[outlen] = '\0';
+              *output = out;
+              *length = outlen;
+              *status = atoi (st);
+              free (st);
+              return 0;
+            }
+        }
+
+      if (wfd >= 0 && FD_ISSET (coproc.status_fd, &readfds))
+        {
+          r = coproc_read (coproc.status_fd, &st, &stlen, &stmax);
+          if (r == 0)
+            {
+              /* The shell exited: find out whether it was killed.  */
+              pid_t pid;
+              int wst;
+
+              EINTRLOOP (pid, waitpid (coproc.pid, &wst, 0));
+              if (pid == coproc.pid && WIFSIGNALED (wst))
+                sig = WTERMSIG (wst);
+              break;
+            }
+          if (r < 0 || stlen > 15)
+            break;
+          st[stlen] = '\0';
+          if (strchr (st, '\n'))
+            {
+              close (wfd);
+              wfd = -1;
+            }
+        }
+    }
+
+  /* The command was sent so it may have run, or be running still: don't let
+     the caller run it again.  Report that it failed, with whatever output
+     we've seen.  */
+  if (wfd >= 0)
+    close (wfd);
+  free (st);
+  OS (error, NILF, _("%s: the shell coprocess died"), coproc.shell);
+  DB (DB_JOBS, (_("Shell coprocess %ld exited\n"), (long) coproc.pid));
+  coproc_close ();
+  coproc.failed = 1;
+
+  out[outlen] = '\0';
+  *output = out;
+  *length = outlen;
+  *status = sig ? 128 + sig : 127;
+  return 0;
+
+ died:
+  /* It died before the command was sent, most likely while its environment
+     was being set: let the caller run the command some other way.  */
+  DB (DB_JOBS, (_("Shell coprocess %ld exited\n"), (long) coproc.pid));
+  coproc_close ();
+  coproc.failed = 1;
+  return -1;
+}
+
+void
+coprocess_cleanup ()
+{
+  coproc_close ();
+}
+
+#else /* !MAKE_JOBSERVER || !HAVE_PSELECT || !MSG_NOSIGNAL */
+
+#if defined(MAKE_JOBSERVER) && defined(HAVE_PSELECT)
+static int
+worker_fdset (fd_set *readfds UNUSED)
+{
+  return -1;
+}
+#endif
+
+pid_t
+worker_start_job (const char *shell UNUSED, int errexit UNUSED,
+                  const char *cmd UNUSED, char **envp UNUSED,
+                  int outfd UNUSED, int errfd UNUSED)
+{
+  return -1;
+}
+
+pid_t
+worker_status (int *exit_code_ptr UNUSED, int *signal_ptr UNUSED,
+               int *coredump_ptr UNUSED, int block UNUSED)
+{
+  return 0;
+}
+
+void
+worker_kill (pid_t id UNUSED, int sig UNUSED)
+{
+}
+
+void
+worker_cleanup ()
+{
+}
+
+int
+coprocess_run (const char *shell UNUSED, int errexit UNUSED,
+               const char *cmd UNUSED, char **envp UNUSED,
+               char **output UNUSED, size_t *length UNUSED,
+               int *status UNUSED)
+{
+  return -1;
+}
+
+void
+coprocess_cleanup ()
+{
+}
+
+#endif
+
 /* Create a "bad" file descriptor for stdin when parallel jobs are run.  */
 int
 get_bad_stdin ()
@@ -865,6 +1910,40 @@ fd_reset_append (int fd, int flags)
 #endif
 }
 
+/* Output kept in memory is moved to temp files while jobs are still writing
+   to it: that needs a way to free the memory it used, and to wake up now and
+   then while waiting for the jobs.  */
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_FALLOCATE) \
+    && defined(FALLOC_FL_PUNCH_HOLE) && defined(MAKE_JOBSERVER) \
+    && defined(HAVE_PSELECT) && !defined(MK_OS_ZOS)
+# define USE_MEMTMP 1
+#endif
+
+/* Return a file descriptor for a new anonymous file kept in memory, or -1.
+   Unlike a temp file this never causes disk I/O, unless it's swapped out.  */
+int
+os_memtmp ()
+{
+  int fd = -1;
+
+#ifdef USE_MEMTMP
+  static unsigned int memfd_works = 1;
+
+  if (memfd_works)
+    {
+      EINTRLOOP (fd, memfd_create ("make", MFD_CLOEXEC));
+      if (fd >= 0)
+        return fd;
+
+      DB (DB_BASIC, (_("Cannot create memory file: %s.\n"),
+                     strerror (errno)));
+      memfd_works = 0;
+    }
+#endif
+
+  return fd;
+}
+
 /* Return a file descriptor for a new anonymous temp file, or -1.  */
 int
 os_anontmp ()
@@ -801,7 +801,10 @@ eval (struct ebuffer *ebuf, int set_default)
 
           /* (un)export by itself causes everything to be (un)exported. */
           if (*p2 == '\0')
-            export_all_variables = exporting;
+            {
+              export_all_variables = exporting;
+              variable_exports_changed ();
+            }
           else
             {
               size_t l;
@@ -820,6 +823,7 @@ eval (struct ebuffer *ebuf, int set_default)
                     v = define_variable_global (p, l, "", o_file, 0, fstart);
                   v->export = exporting ? v_export : v_noexport;
                 }
+              variable_exports_changed ();
 
               free (ap);
             }
@@ -1900,6 +1904,12 @@ check_specials (struct nameseq *files, int set_default)
         }
 #endif
 
+      if (!shell_coprocess && streq (nm, ".SHELL_COPROCESS"))
+        {
+          shell_coprocess = 1;
+          continue;
+        }
+
       /* Determine if this target should be made default.  */
 
       if (set_default && default_goal_var->value[0] == '\0')
@@ -3087,7 +3097,7 @@ parse_file_seq (char **stringp, size_t size, int stopmap,
   struct nameseq *new = 0;
   struct nameseq **newp = &new;
 #define NEWELT(_n)  do { \
-                        struct nameseq *_ns = xcalloc (size);       \
+                        struct nameseq *_ns = alloc_ns ();          \
                         const char *__n = (_n);                     \
                         _ns->name = (cachep ? strcache_add (__n) : xstrdup (__n)); \
                         if (found_wait) {                           \
@@ -3110,8 +3120,9 @@ parse_file_seq (char **stringp, size_t size, int stopmap,
   /* Always stop on NUL.  */
   stopmap |= MAP_NUL;
 
-  if (size < sizeof (struct nameseq))
-    size = sizeof (struct nameseq);
+  /* Elements come from the pool for struct dep, which is big enough for
+     any of the types that can be requested.  */
+  assert (size <= sizeof (struct dep));
 
   if (NONE_SET (flags, PARSEFS_NOGLOB))
     dir_setup_glob (&gl);
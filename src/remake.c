@@ -77,13 +77,40 @@ static struct dep **dropped_list = NULL;
 static size_t dropped_list_len = 0;
 #define DROPPED_LIST_INCR 5
 
+#ifndef NO_ARCHIVES
+/* Under .BATCH_ARCHIVES, the archive members found out of date on a pass of
+   the goal chain, grouped by archive and recipe.  The recipe of the leader
+   remakes the other members too.  */
+struct archive_batch
+  {
+    struct archive_batch *next;
+    const char *arname;         /* Name of the archive, in the strcache.  */
+    struct commands *cmds;
+    struct file *leader;
+    struct dep *members;        /* The other members, in order.  */
+    struct dep *last;
+  };
+
+static struct archive_batch *archive_batches = NULL;
+
+/* The batches whose recipes have been started.  No other recipe is started
+   for their archives until they finish.  */
+static struct archive_batch *running_batches = NULL;
+
+static void start_archive_batches (void);
+#endif
+
 static enum update_status update_file (struct file *file, unsigned int depth);
 static enum update_status update_file_1 (struct file *file, unsigned int depth);
 static enum update_status check_dep (struct file *file, unsigned int depth,
                                      FILE_TIMESTAMP this_mtime, int *must_make);
 static enum update_status touch_file (struct file *file);
 static void remake_file (struct file *file);
+#ifndef NO_ARCHIVES
+static int batch_archive_member (struct file *file);
+#endif
 static FILE_TIMESTAMP name_mtime (const char *name);
+static void prefetch_mtimes (const struct dep *deps);
 static const char *library_search (const char *lib, FILE_TIMESTAMP *mtime_ptr);
 
 
@@ -300,6 +327,11 @@ update_goal_chain (struct goaldep *goaldeps)
           gu = gu->next;
         }
 
+#ifndef NO_ARCHIVES
+      /* Remake the archive members found out of date on this pass.  */
+      start_archive_batches ();
+#endif
+
       /* If we reached the end of the dependency graph update CONSIDERED
          for the next pass.  In the case of waiting, increment CONSIDERED to
          prevent the same file from getting pruned over and over again.  */
@@ -486,6 +518,9 @@ update_file_1 (struct file *file, unsigned int depth)
 
   DBF (DB_VERBOSE, _("Considering target file '%s'.\n"));
 
+  if (file_considered_hooks)
+    run_file_hooks (file_considered_hooks, file->name, 0, 0);
+
   if (file->updated)
     {
       if (file->update_status > us_none)
@@ -544,6 +579,21 @@ update_file_1 (struct file *file, unsigned int depth)
 
   this_mtime = file_mtime (file);
   check_renamed (file);
+
+  /* A timestamp provider said this file is unchanged since the last build:
+     treat it like a file given with -o, and don't consider remaking it.  */
+  if (this_mtime == OLD_MTIME)
+    {
+      DBF (DB_BASIC, _("File '%s' is unchanged.\n"));
+      file->mtime_before_update = OLD_MTIME;
+      file->updated = 1;
+      file->update_status = us_success;
+      set_command_state (file, cs_finished);
+      finish_updating (file);
+      finish_updating (ofile);
+      return us_success;
+    }
+
   noexist = this_mtime == NONEXISTENT_MTIME;
   if (noexist)
     {
@@ -627,6 +677,9 @@ update_file_1 (struct file *file, unsigned int depth)
       du = ad->file->deps;
       ad = ad->next;
 
+      if (timestamp_providers)
+        prefetch_mtimes (du);
+
       while (du)
         {
           enum update_status new;
@@ -987,6 +1040,142 @@ update_file_1 (struct file *file, unsigned int depth)
   return file->update_status;
 }
 
+#ifndef NO_ARCHIVES
+/* Put archive member FILE, which must be remade, in the batch for its
+   archive and recipe.  Return nonzero if we did, or zero if FILE isn't an
+   archive member and must be remade now.  */
+
+static int
+batch_archive_member (struct file *file)
+{
+  struct archive_batch *b;
+  char *arname, *memname;
+  const char *name;
+
+  if (!ar_name (file->name))
+    return 0;
+
+  ar_parse_name (file->name, &arname, &memname);
+  name = strcache_add (arname);
+  free (arname);
+
+  for (b = archive_batches; b != 0; b = b->next)
+    if (b->arname == name && b->cmds == file->cmds)
+      break;
+
+  if (b == 0)
+    {
+      b = xcalloc (sizeof (struct archive_batch));
+      b->arname = name;
+      b->cmds = file->cmds;
+      b->leader = file;
+      b->next = archive_batches;
+      archive_batches = b;
+    }
+  else
+    {
+      struct dep *d = alloc_dep ();
+      d->file = file;
+      if (b->last)
+        b->last->next = d;
+      else
+        b->members = d;
+      b->last = d;
+    }
+
+  DB (DB_VERBOSE, (_("Adding '%s' to the batch for its archive.\n"),
+                   file->name));
+
+  set_command_state (file, cs_running);
+
+  /* Its recipe will be started at the end of this pass; count it now, to
+     suppress the "is up to date" message for the goal.  */
+  commands_started++;
+
+  return 1;
+}
+
+/* Return nonzero if the recipe of a batch for archive ARNAME is running.  */
+
+static int
+archive_batch_running (const char *arname)
+{
+  const struct archive_batch *b;
+
+  for (b = running_batches; b != 0; b = b->next)
+    if (b->arname == arname)
+      return 1;
+
+  return 0;
+}
+
+/* Start the recipe of each batch of archive members.  The leader's recipe
+   sees the prerequisites of all the members in its automatic variables, and
+   it makes the other members as well.  A batch for an archive whose recipe
+   is still running waits for a later pass, collecting more members.  */
+
+static void
+start_archive_batches (void)
+{
+  struct archive_batch **bp;
+
+  /* Forget the batches that have finished.  */
+  for (bp = &running_batches; *bp != 0; )
+    {
+      struct archive_batch *b = *bp;
+
+      if (b->leader->command_state == cs_finished)
+        {
+          *bp = b->next;
+          free (b);
+        }
+      else
+        bp = &b->next;
+    }
+
+  bp = &archive_batches;
+  while (*bp != 0)
+    {
+      struct archive_batch *b = *bp;
+      struct file *leader = b->leader;
+
+      if (archive_batch_running (b->arname))
+        {
+          DB (DB_VERBOSE, (_("Waiting for the batch of '%s' members.\n"),
+                           b->arname));
+          bp = &b->next;
+          continue;
+        }
+
+      *bp = b->next;
+
+      if (b->members)
+        {
+          struct dep *d, **dp;
+
+          DB (DB_JOBS, (_("Remaking the batch of '%s' members with '%s'.\n"),
+                        b->arname, leader->name));
+
+          for (dp = &leader->deps; *dp != 0; dp = &(*dp)->next)
+            ;
+          for (d = b->members; d != 0; d = d->next)
+            {
+              *dp = copy_dep_chain (d->file->deps);
+              while (*dp != 0)
+                dp = &(*dp)->next;
+            }
+
+          b->last->next = leader->also_make;
+          leader->also_make = b->members;
+        }
+
+      b->next = running_batches;
+      running_batches = b;
+      execute_file_commands (leader);
+    }
+}
+#endif
+
 /* Set FILE's 'updated' flag and re-check its mtime and the mtime's of all
    files listed in its 'also_make' member.  Under -t, this function also
    touches FILE.
@@ -1069,6 +1258,19 @@ notice_finished_file (struct file *file)
         i = 1;
 
       file->last_mtime = i == 0 ? UNKNOWN_MTIME : NEW_MTIME;
+
+#ifndef NO_ARCHIVES
+      /* A recipe for an archive member has most likely changed the
+         archive, perhaps within its timestamp resolution.  */
+      if (ran && file->cmds && file->cmds->ncommand_lines
+          && ar_name (file->name))
+        {
+          char *arname, *memname;
+          ar_parse_name (file->name, &arname, &memname);
+          ar_forget (arname);
+          free (arname);
+        }
+#endif
     }
 
   if (file->double_colon)
@@ -1134,6 +1336,16 @@ notice_finished_file (struct file *file)
     /* Nothing was done for FILE, but it needed nothing done.
        So mark it now as "succeeded".  */
     file->update_status = us_success;
+
+  if (file_remade_hooks)
+    {
+      run_file_hooks (file_remade_hooks, file->name,
+                      file->update_status != us_success, ran || touched);
+      if (ran)
+        for (d = file->also_make; d != 0; d = d->next)
+          run_file_hooks (file_remade_hooks, d->file->name,
+                          d->file->update_status != us_success, 1);
+    }
 }
 
 /* Check whether another file (whose mtime is THIS_MTIME) needs updating on
@@ -1374,6 +1586,10 @@ remake_file (struct file *file)
       /* The normal case: start some commands.  */
       if (!touch_flag || file->cmds->any_recurse)
         {
+#ifndef NO_ARCHIVES
+          if (batch_archives && batch_archive_member (file))
+            return;
+#endif
           execute_file_commands (file);
           return;
         }
@@ -1599,11 +1815,180 @@ f_mtime (struct file *file, int search)
 }
 
 
+/* Timestamps that loaded objects have given us ahead of time, when asked
+   about all the prerequisites of a target at once.  Each is used once, by
+   the next name_mtime() of that file.  */
+
+struct provided_mtime
+  {
+    const char *name;
+    FILE_TIMESTAMP mtime;
+  };
+
+static struct hash_table provided_mtimes;
+
+static unsigned long
+provided_mtime_hash_1 (const void *key)
+{
+  return_STRING_HASH_1 (((const struct provided_mtime *) key)->name);
+}
+
+static unsigned long
+provided_mtime_hash_2 (const void *key)
+{
+  return_STRING_HASH_2 (((const struct provided_mtime *) key)->name);
+}
+
+static int
+provided_mtime_hash_cmp (const void *x, const void *y)
+{
+  return_STRING_COMPARE (((const struct provided_mtime *) x)->name,
+                         ((const struct provided_mtime *) y)->name);
+}
+
+/* Convert the answer Q of a timestamp provider into *MTIME.
+   Return 0 if the provider did not know.  */
+
+static int
+provided_timestamp (const gmk_timestamp *q, FILE_TIMESTAMP *mtime)
+{
+  switch (q->result)
+    {
+    case GMK_TIME_MODIFIED:
+      *mtime = file_timestamp_cons (q->name, (time_t) q->seconds,
+                                    q->nanoseconds);
+      return 1;
+    case GMK_TIME_UNCHANGED:
+      *mtime = OLD_MTIME;
+      return 1;
+    case GMK_TIME_NONEXISTENT:
+      *mtime = NONEXISTENT_MTIME;
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+/* Ask the timestamp provider for NAME, if there is one, when it was last
+   modified.  Return 0 if there is no answer and the file system must be
+   asked instead.  */
+
+static int
+provided_mtime (const char *name, FILE_TIMESTAMP *mtime)
+{
+  const struct load_hook *h = timestamp_provider (name);
+  gmk_timestamp q;
+
+  if (!h)
+    return 0;
+
+  if (provided_mtimes.ht_fill)
+    {
+      struct provided_mtime key, *pm;
+
+      key.name = name;
+      pm = hash_delete (&provided_mtimes, &key);
+      if (pm)
+        {
+          int known = pm->mtime != UNKNOWN_MTIME;
+          *mtime = pm->mtime;
+          free (pm);
+          return known;
+        }
+    }
+
+  memset (&q, 0, sizeof (q));
+  q.name = name;
+  (*h->func.timestamp) (&q, 1);
+
+  return provided_timestamp (&q, mtime);
+}
+
+/* Ask each timestamp provider, in one call, about all of DEPS whose
+   modification times are not yet known, so they need not be asked one at a
+   time as each is considered.  */
+
+static void
+prefetch_mtimes (const struct dep *deps)
+{
+  const struct load_hook *h;
+  gmk_timestamp *q = NULL;
+  unsigned int max = 0;
+
+  if (provided_mtimes.ht_vec == NULL)
+    hash_init (&provided_mtimes, 256, provided_mtime_hash_1,
+               provided_mtime_hash_2, provided_mtime_hash_cmp);
+
+  for (h = timestamp_providers; h; h = h->next)
+    {
+      const struct dep *d;
+      unsigned int n = 0;
+      unsigned int i;
+
+      for (d = deps; d; d = d->next)
+        {
+          const struct file *f = d->file;
+          struct provided_mtime key;
+
+          if (f->last_mtime != UNKNOWN_MTIME
+#ifndef NO_ARCHIVES
+              || ar_name (f->name)
+#endif
+              || timestamp_provider (f->name) != h)
+            continue;
+
+          key.name = f->name;
+          if (hash_find_item (&provided_mtimes, &key))
+            continue;
+
+          if (n == max)
+            {
+              max = max ? max * 2 : 16;
+              q = xrealloc (q, max * sizeof (gmk_timestamp));
+            }
+          memset (&q[n], 0, sizeof (gmk_timestamp));
+          q[n++].name = f->name;
+        }
+
+      /* A single file will be asked about when it is considered.  */
+      if (n < 2)
+        continue;
+
+      DB (DB_VERBOSE, (_("Asking for the timestamps of %u files.\n"), n));
+      (*h->func.timestamp) (q, n);
+
+      for (i = 0; i < n; ++i)
+        {
+          struct provided_mtime key, **slot;
+          FILE_TIMESTAMP mtime;
+
+          /* Remember that there was no answer too, so that the provider
+             isn't asked again.  */
+          if (!provided_timestamp (&q[i], &mtime))
+            mtime = UNKNOWN_MTIME;
+
+          key.name = q[i].name;
+          slot = (struct provided_mtime **) hash_find_slot (&provided_mtimes,
+                                                            &key);
+          if (HASH_VACANT (*slot))
+            {
+              struct provided_mtime *pm = xmalloc (sizeof (*pm));
+              pm->name = q[i].name;
+              pm->mtime = mtime;
+              hash_insert_at (&provided_mtimes, pm, slot);
+            }
+        }
+    }
+
+  free (q);
+}
+
 /* Return the mtime of the file or archive-member reference NAME.  */
 
-/* First, we check with stat().  If the file does not exist, then we return
-   NONEXISTENT_MTIME.  If it does, and the symlink check flag is set, then
-   examine each indirection of the symlink and find the newest mtime.
+/* If a loaded object provides timestamps for NAME, we ask it first.
+   Otherwise we check with stat().  If the file does not exist, then we
+   return NONEXISTENT_MTIME.  If it does, and the symlink check flag is set,
+   then examine each indirection of the symlink and find the newest mtime.
    This causes one duplicate stat() when -L is being used, but the code is
    much cleaner.  */
 
@@ -1618,6 +2003,9 @@ name_mtime (const char *name)
 #endif
   int e;
 
+  if (timestamp_providers && provided_mtime (name, &mtime))
+    return mtime;
+
 #if MK_OS_W32
   {
     char tem[MAX_PATH+1], *tstart, *tend;
@@ -0,0 +1,404 @@
+/* Protocol between GNU Make and remote job workers.
+Copyright (C) 2024 Free Software Foundation, Inc.
+This file is part of GNU Make.
+
+GNU Make is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+GNU Make is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* This file is used both by make and by the reference worker, make-worker,
+   so it doesn't use any of make's own facilities.  */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+#include "remote-proto.h"
+
+void
+rp_put_u32 (unsigned char *buf, unsigned long val)
+{
+  buf[0] = (unsigned char) (val >> 24);
+  buf[1] = (unsigned char) (val >> 16);
+  buf[2] = (unsigned char) (val >> 8);
+  buf[3] = (unsigned char) val;
+}
+
+unsigned long
+rp_get_u32 (const unsigned char *buf)
+{
+  return ((unsigned long) buf[0] << 24) | ((unsigned long) buf[1] << 16)
+         | ((unsigned long) buf[2] << 8) | (unsigned long) buf[3];
+}
+
+static int
+write_all (int fd, const void *data, size_t len)
+{
+  const char *p = data;
+
+  while (len > 0)
+    {
+      ssize_t n = write (fd, p, len);
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          /* The timeout set by rp_set_timeout() expired.  */
+          if (errno == EAGAIN)
+            errno = ETIMEDOUT;
+          return -1;
+        }
+      p += n;
+      len -= n;
+    }
+
+  return 0;
+}
+
+/* Read exactly LEN bytes from FD.  Return 1 on success, 0 if FD is at EOF
+   before any bytes are read, or -1 on error.  */
+
+static int
+read_all (int fd, void *data, size_t len)
+{
+  char *p = data;
+  size_t got = 0;
+
+  while (got < len)
+    {
+      ssize_t n = read (fd, p + got, len - got);
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          if (errno == EAGAIN)
+            errno = ETIMEDOUT;
+          return -1;
+        }
+      if (n == 0)
+        {
+          if (got == 0)
+            return 0;
+          errno = EIO;
+          return -1;
+        }
+      got += n;
+    }
+
+  return 1;
+}
+
+/* Send a message of type TYPE with the LEN bytes at DATA as its payload.
+   Return 0 on success, or -1 with errno set.  */
+
+int
+rp_send (int fd, int type, const void *data, size_t len)
+{
+  unsigned char hdr[RP_HEADER_SIZE];
+
+  hdr[0] = (unsigned char) type;
+  rp_put_u32 (hdr + 1, (unsigned long) len);
+
+  if (write_all (fd, hdr, sizeof (hdr)) < 0)
+    return -1;
+  return len ? write_all (fd, data, len) : 0;
+}
+
+/* Receive a message into *TYPE, *DATA, and *LEN.  The payload is allocated
+   and nul-terminated.  Return 1 on success, 0 at EOF, or -1 with errno set
+   if the connection failed or the message is invalid.  */
+
+int
+rp_recv (int fd, int *type, char **data, size_t *len)
+{
+  unsigned char hdr[RP_HEADER_SIZE];
+  unsigned long size;
+  char *buf;
+  int r;
+
+  r = read_all (fd, hdr, sizeof (hdr));
+  if (r <= 0)
+    return r;
+
+  size = rp_get_u32 (hdr + 1);
+  if (size > RP_MAX_SIZE)
+    {
+      errno = EPROTO;
+      return -1;
+    }
+
+  buf = malloc (size + 1);
+  if (buf == NULL)
+    return -1;
+
+  if (size > 0 && (r = read_all (fd, buf, size)) <= 0)
+    {
+      if (r == 0)
+        errno = EIO;
+      free (buf);
+      return -1;
+    }
+  buf[size] = '\0';
+
+  *type = hdr[0];
+  *data = buf;
+  *len = size;
+  return 1;
+}
+
+/* Make sending and receiving on FD fail with ETIMEDOUT if they take more
+   than SECS seconds, or wait for ever if SECS is 0.  Return 0 on success, or
+   -1 with errno set.  */
+
+int
+rp_set_timeout (int fd, int secs)
+{
+  struct timeval tv;
+
+  tv.tv_sec = secs;
+  tv.tv_usec = 0;
+  if (setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv)) < 0
+      || setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv)) < 0)
+    return -1;
+
+  return 0;
+}
+
+/* Look up ADDR, which is either "unix:PATH" for a Unix domain socket, or
+   "HOST:PORT" for TCP.  If SERVER is nonzero the addresses are to listen on,
+   and HOST may be empty for all addresses.  Return a list of addresses to
+   free with rp_free_addr(), or NULL with errno set.  */
+
+struct rp_addr *
+rp_resolve (const char *addr, int server)
+{
+  struct addrinfo hints;
+  struct addrinfo *res;
+  struct addrinfo *ai;
+  struct rp_addr *list = NULL;
+  struct rp_addr **tail = &list;
+  const char *colon;
+  char *host;
+
+  if (strncmp (addr, "unix:", 5) == 0)
+    {
+      struct sockaddr_un *sun;
+      const char *path = addr + 5;
+
+      if (strlen (path) >= sizeof (sun->sun_path))
+        {
+          errno = ENAMETOOLONG;
+          return NULL;
+        }
+
+      list = calloc (1, sizeof (struct rp_addr));
+      if (list == NULL)
+        return NULL;
+
+      sun = (struct sockaddr_un *) &list->sa;
+      sun->sun_family = AF_UNIX;
+      strcpy (sun->sun_path, path);
+      list->len = sizeof (struct sockaddr_un);
+      return list;
+    }
+
+  colon = strrchr (addr, ':');
+  if (colon == NULL || colon[1] == '\0')
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  host = malloc (colon - addr + 1);
+  if (host == NULL)
+    return NULL;
+  memcpy (host, addr, colon - addr);
+  host[colon - addr] = '\0';
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = server ? AI_PASSIVE : 0;
+
+  if (getaddrinfo (host[0] ? host : NULL, colon + 1, &hints, &res) != 0)
+    {
+      free (host);
+      errno = EHOSTUNREACH;
+      return NULL;
+    }
+  free (host);
+
+  for (ai = res; ai != NULL; ai = ai->ai_next)
+    {
+      if (ai->ai_addrlen > sizeof (list->sa))
+        continue;
+
+      *tail = calloc (1, sizeof (struct rp_addr));
+      if (*tail == NULL)
+        {
+          freeaddrinfo (res);
+          rp_free_addr (list);
+          return NULL;
+        }
+      memcpy (&(*tail)->sa, ai->ai_addr, ai->ai_addrlen);
+      (*tail)->len = ai->ai_addrlen;
+      tail = &(*tail)->next;
+    }
+
+  freeaddrinfo (res);
+
+  if (list == NULL)
+    errno = EHOSTUNREACH;
+  return list;
+}
+
+void
+rp_free_addr (struct rp_addr *addr)
+{
+  while (addr != NULL)
+    {
+      struct rp_addr *next = addr->next;
+      free (addr);
+      addr = next;
+    }
+}
+
+/* Connect to a socket at FD, waiting at most SECS seconds.  */
+
+static int
+connect_timeout (int fd, const struct rp_addr *addr, int secs)
+{
+  int flags = fcntl (fd, F_GETFL);
+  struct pollfd pfd;
+  socklen_t len;
+  int err;
+  int r;
+
+  if (flags < 0 || fcntl (fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    return -1;
+
+  r = connect (fd, (const struct sockaddr *) &addr->sa, addr->len);
+  if (r < 0 && errno != EINPROGRESS && errno != EINTR)
+    return -1;
+
+  if (r < 0)
+    {
+      pfd.fd = fd;
+      pfd.events = POLLOUT;
+      do
+        r = poll (&pfd, 1, secs * 1000);
+      while (r < 0 && errno == EINTR);
+      if (r == 0)
+        errno = ETIMEDOUT;
+      if (r <= 0)
+        return -1;
+
+      len = sizeof (err);
+      if (getsockopt (fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        return -1;
+      if (err != 0)
+        {
+          errno = err;
+          return -1;
+        }
+    }
+
+  return fcntl (fd, F_SETFL, flags);
+}
+
+/* Open a connection to a worker at one of the addresses in ADDR, waiting
+   at most SECS seconds for each.  Return the socket, or -1 with errno set.  */
+
+int
+rp_connect (const struct rp_addr *addr, int secs)
+{
+  int err = EHOSTUNREACH;
+
+  for (; addr != NULL; addr = addr->next)
+    {
+      int family = addr->sa.ss_family;
+      int fd = socket (family, SOCK_STREAM, 0);
+
+      if (fd < 0)
+        {
+          err = errno;
+          continue;
+        }
+
+      if (connect_timeout (fd, addr, secs) == 0)
+        {
+          /* Output is sent in small messages: don't delay them.  */
+          if (family != AF_UNIX)
+            {
+              int on = 1;
+              setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof (on));
+            }
+          return fd;
+        }
+
+      err = errno;
+      close (fd);
+    }
+
+  errno = err;
+  return -1;
+}
+
+/* Listen for connections on the first of the addresses in ADDR that we can.
+   Return the socket, or -1 with errno set.  */
+
+int
+rp_listen (const struct rp_addr *addr)
+{
+  int err = EHOSTUNREACH;
+
+  for (; addr != NULL; addr = addr->next)
+    {
+      int family = addr->sa.ss_family;
+      int fd = socket (family, SOCK_STREAM, 0);
+      int on = 1;
+
+      if (fd < 0)
+        {
+          err = errno;
+          continue;
+        }
+
+      if (family == AF_UNIX)
+        unlink (((const struct sockaddr_un *) &addr->sa)->sun_path);
+      else
+        setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+
+      if (bind (fd, (const struct sockaddr *) &addr->sa, addr->len) == 0
+          && listen (fd, SOMAXCONN) == 0)
+        return fd;
+
+      err = errno;
+      close (fd);
+    }
+
+  errno = err;
+  return -1;
+}
@@ -0,0 +1,61 @@
+/* Protocol between GNU Make and remote job workers.
+Copyright (C) 2024 Free Software Foundation, Inc.
+This file is part of GNU Make.
+
+GNU Make is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+GNU Make is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Each job uses its own connection to a worker.  All traffic is a sequence
+   of messages: a one-byte type, a four-byte big-endian payload length, and
+   the payload.  make sends RP_CWD, then RP_ARG for each element of argv and
+   RP_ENV for each element of the environment, then RP_RUN.  The worker
+   answers RP_STARTED or RP_FAILED.  After that make sends RP_STDIN and
+   RP_KILL messages and the worker sends RP_STDOUT and RP_STDERR messages,
+   until the worker sends RP_EXIT and closes the connection.  */
+
+/* Messages sent by make.  */
+#define RP_CWD          'D'     /* Directory to run the command in.  */
+#define RP_ARG          'A'     /* One element of the command's argv.  */
+#define RP_ENV          'V'     /* One element of its environment.  */
+#define RP_RUN          'R'     /* Start the command.  */
+#define RP_STDIN        'I'     /* Standard input data; empty at EOF.  */
+#define RP_KILL         'K'     /* Send the signal in the payload.  */
+
+/* Messages sent by the worker.  */
+#define RP_STARTED      'S'     /* The command is running.  */
+#define RP_FAILED       'F'     /* It could not be started: why.  */
+#define RP_STDOUT       'O'     /* Standard output data.  */
+#define RP_STDERR       'E'     /* Standard error data.  */
+#define RP_EXIT         'X'     /* Exit code and signal of the command.  */
+
+#define RP_HEADER_SIZE  5
+
+/* The largest payload we accept.  */
+#define RP_MAX_SIZE     (1024 * 1024)
+
+/* The addresses a worker can be reached at, or listen on.  */
+struct rp_addr
+  {
+    struct rp_addr *next;       /* The next address to try.  */
+    socklen_t len;              /* The size of SA.  */
+    struct sockaddr_storage sa;
+  };
+
+void rp_put_u32 (unsigned char *buf, unsigned long val);
+unsigned long rp_get_u32 (const unsigned char *buf);
+int rp_send (int fd, int type, const void *data, size_t len);
+int rp_recv (int fd, int *type, char **data, size_t *len);
+int rp_set_timeout (int fd, int secs);
+struct rp_addr *rp_resolve (const char *addr, int server);
+void rp_free_addr (struct rp_addr *addr);
+int rp_connect (const struct rp_addr *addr, int secs);
+int rp_listen (const struct rp_addr *addr);
@@ -0,0 +1,359 @@
+/* GNU Make remote job exportation interface to socket workers.
+Copyright (C) 2024 Free Software Foundation, Inc.
+This file is part of GNU Make.
+
+GNU Make is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+GNU Make is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* The workers to use are listed in the MAKE_REMOTE_WORKERS variable, which
+   is normally taken from the environment.  Each job is sent to the next
+   worker in turn; see remote-proto.h for the protocol.  As with Customs, we
+   start a local process for each remote job, "make-worker --relay", which
+   relays its standard input to the worker and its output and exit status
+   back, so the rest of make treats it just like a local child.  See
+   README.remote.  */
+
+#include "makeint.h"
+
+#include "filedef.h"
+#include "job.h"
+#include "commands.h"
+#include "debug.h"
+#include "variable.h"
+#include "os.h"
+
+#include <sys/socket.h>
+
+#include "remote-proto.h"
+
+static char sockets_description[] = "sockets";
+char *remote_description = sockets_description;
+
+/* Seconds to wait before trying a worker again after it failed.  */
+#define WORKER_RETRY_TIME   30
+
+/* Seconds to wait for a worker to accept a connection, or to answer while
+   a job is being started.  */
+#define WORKER_TIMEOUT      10
+
+/* The program to relay a job's input and output, if the MAKE_REMOTE_RELAY
+   variable doesn't give one.  */
+#ifdef BINDIR
+# define RELAY_PROGRAM      BINDIR "/make-worker"
+#else
+# define RELAY_PROGRAM      "make-worker"
+#endif
+
+struct remote_worker
+  {
+    char *addr;                 /* Address as given in MAKE_REMOTE_WORKERS.  */
+    struct rp_addr *addrs;      /* What ADDR resolves to.  */
+    time_t retry;               /* Don't use it before this time.  */
+  };
+
+static struct remote_worker *workers;
+static unsigned int worker_count;
+static unsigned int next_worker;
+
+/* The directory to run jobs in.  */
+static char *remote_cwd;
+
+/* The program run for each remote job to relay its input and output.  */
+static char *relay_program;
+
+/* Set by start_remote_job_p when it first looks for workers: 1 if there
+   are any, -1 if not.  */
+static int inited = 0;
+
+/* Call once at startup even if no commands are run.  */
+
+void
+remote_setup (void)
+{
+}
+
+/* Called before exit.  */
+
+void
+remote_cleanup (void)
+{
+}
+
+static void
+init_workers (void)
+{
+  struct variable *v;
+  char *value;
+  const char *p;
+  const char *w;
+  size_t len;
+
+  inited = -1;
+
+  v = lookup_variable (STRING_SIZE_TUPLE ("MAKE_REMOTE_WORKERS"));
+  if (v == NULL)
+    return;
+
+  /* Look up the workers now, so that each job doesn't have to.  */
+  value = allocated_expand_variable (STRING_SIZE_TUPLE ("MAKE_REMOTE_WORKERS"));
+  p = value;
+  while ((w = find_next_token (&p, &len)) != NULL)
+    {
+      char *addr = xstrndup (w, len);
+      struct rp_addr *addrs = rp_resolve (addr, 0);
+
+      if (addrs == NULL)
+        {
+          OSS (error, NILF, _("worker %s: %s"), addr, strerror (errno));
+          free (addr);
+          continue;
+        }
+
+      workers = xrealloc (workers,
+                          (worker_count + 1) * sizeof (struct remote_worker));
+      workers[worker_count].addr = addr;
+      workers[worker_count].addrs = addrs;
+      workers[worker_count].retry = 0;
+      ++worker_count;
+    }
+  free (value);
+
+  if (worker_count == 0)
+    return;
+
+  value = allocated_expand_variable (STRING_SIZE_TUPLE ("MAKE_REMOTE_RELAY"));
+  if (value[0] == '\0')
+    {
+      free (value);
+      value = xstrdup (RELAY_PROGRAM);
+    }
+  relay_program = value;
+
+  /* Without the relay the jobs would run but make couldn't see them.  */
+  if (strchr (relay_program, '/') != NULL && access (relay_program, X_OK) < 0)
+    {
+      perror_with_name ("", relay_program);
+      return;
+    }
+
+  remote_cwd = xmalloc (GET_PATH_MAX);
+  if (getcwd (remote_cwd, GET_PATH_MAX) == NULL)
+    {
+      perror_with_name ("getcwd", "");
+      return;
+    }
+
+  inited = 1;
+}
+
+/* Return nonzero if the next job should be done remotely.  */
+
+int
+start_remote_job_p (int first_p UNUSED)
+{
+  time_t now;
+  unsigned int i;
+
+  if (!inited)
+    init_workers ();
+
+  if (inited < 0)
+    return 0;
+
+  now = time (NULL);
+  for (i = 0; i < worker_count; ++i)
+    if (workers[i].retry <= now)
+      return 1;
+
+  return 0;
+}
+
+/* Send the command ARGV, with environment ENVP, to the worker on SOCK and
+   wait for it to start.  Return 0 on success.  */
+
+static int
+send_job (const struct remote_worker *w, int sock, char **argv, char **envp)
+{
+  char **pp;
+  char *data;
+  size_t len;
+  int type;
+  int r;
+
+  r = rp_send (sock, RP_CWD, remote_cwd, strlen (remote_cwd));
+  for (pp = argv; r == 0 && *pp != NULL; ++pp)
+    r = rp_send (sock, RP_ARG, *pp, strlen (*pp));
+  for (pp = envp; r == 0 && *pp != NULL; ++pp)
+    r = rp_send (sock, RP_ENV, *pp, strlen (*pp));
+  if (r == 0)
+    r = rp_send (sock, RP_RUN, NULL, 0);
+
+  if (r == 0)
+    {
+      r = rp_recv (sock, &type, &data, &len);
+      if (r > 0)
+        {
+          r = type == RP_STARTED ? 0 : -1;
+          if (type == RP_FAILED)
+            OSS (error, NILF, _("worker %s: %s"), w->addr, data);
+          free (data);
+          return r;
+        }
+      if (r == 0)
+        errno = ECONNRESET;
+    }
+
+  OSS (error, NILF, _("worker %s: %s"), w->addr, strerror (errno));
+  return -1;
+}
+
+/* Start a remote job running the command in ARGV, with environment from
+   ENVP.  It gets standard input from STDIN_FD.  On failure, return
+   nonzero.  On success, return zero, and set *USED_STDIN to nonzero if it
+   will actually use STDIN_FD, zero if not, set *ID_PTR to a unique
+   identification, and set *IS_REMOTE to nonzero if the job is remote, zero
+   if it is local (meaning *ID_PTR is a process ID).  */
+
+int
+start_remote_job (char **argv, char **envp, int stdin_fd,
+                  int *is_remote, pid_t *id_ptr, int *used_stdin)
+{
+  time_t now = time (NULL);
+  struct remote_worker *w = NULL;
+  struct childbase child;
+  struct redirect redirs[2];
+  char *relay_argv[3];
+  unsigned int i;
+  int sock = -1;
+  pid_t pid;
+
+  /* Try each worker in turn, starting after the one used last.  */
+  for (i = 0; i < worker_count && sock < 0; ++i)
+    {
+      w = &workers[next_worker];
+      next_worker = (next_worker + 1) % worker_count;
+
+      if (w->retry > now)
+        continue;
+
+      sock = rp_connect (w->addrs, WORKER_TIMEOUT);
+      if (sock < 0)
+        DB (DB_JOBS, (_("Cannot connect to worker %s: %s\n"),
+                      w->addr, strerror (errno)));
+      else if (rp_set_timeout (sock, WORKER_TIMEOUT) < 0
+               || send_job (w, sock, argv, envp) < 0
+               || rp_set_timeout (sock, 0) < 0)
+        {
+          close (sock);
+          sock = -1;
+        }
+
+      if (sock < 0)
+        w->retry = now + WORKER_RETRY_TIME;
+    }
+
+  if (sock < 0)
+    return 1;
+
+  DB (DB_JOBS, (_("Running on worker %s: %s\n"), w->addr, argv[0]));
+
+  /* The relay gets the connection as descriptor 3.  If the socket is
+     already 3, dup2() would leave it close-on-exec, so move it.  */
+  if (sock == 3)
+    {
+      int fd;
+      EINTRLOOP (fd, dup (sock));
+      close (sock);
+      sock = fd;
+      if (sock < 0)
+        {
+          perror_with_name ("dup", "");
+          return 1;
+        }
+    }
+  fd_noinherit (sock);
+
+  /* Start a local relay process for the job, which sends it our standard
+     input and writes its output where the output of a local job would go,
+     so the rest of make treats it just like a local child.  */
+  memset (&child, 0, sizeof (child));
+  child.environment = environ;
+  child.output.out = child.output.err = -1;
+  if (output_context)
+    {
+      child.output.syncout = 1;
+      child.output.out = output_context->out;
+      child.output.err = output_context->err;
+    }
+  redirs[0].file = NULL;
+  redirs[0].fd = 3;
+  redirs[0].dupfd = sock;
+  redirs[0].oflags = 0;
+  redirs[1].fd = -1;
+  child.redirects = redirs;
+
+  relay_argv[0] = relay_program;
+  relay_argv[1] = (char *) "--relay";
+  relay_argv[2] = NULL;
+
+  pid = child_execute_job (&child, stdin_fd == 0, relay_argv);
+  free (child.cmd_name);
+  close (sock);
+
+  if (pid < 0)
+    return 1;
+
+  *is_remote = 0;
+  *id_ptr = pid;
+  *used_stdin = 1;
+  return 0;
+}
+
+/* Get the status of a dead remote child.  Block waiting for one to die
+   if BLOCK is nonzero.  Set *EXIT_CODE_PTR to the exit status, *SIGNAL_PTR
+   to the termination signal or zero if it exited normally, and *COREDUMP_PTR
+   nonzero if it dumped core.  Return the ID of the child that died,
+   0 if we would have to block and !BLOCK, or < 0 if there were none.  */
+
+int
+remote_status (int *exit_code_ptr UNUSED, int *signal_ptr UNUSED,
+               int *coredump_ptr UNUSED, int block UNUSED)
+{
+  /* Our remote jobs look like local children to make.  */
+  errno = ECHILD;
+  return -1;
+}
+
+/* Block asynchronous notification of remote child death.
+   If this notification is done by raising the child termination
+   signal, do not block that signal.  */
+void
+block_remote_children (void)
+{
+  return;
+}
+
+/* Restore asynchronous notification of remote child death.
+   If this is done by raising the child termination signal,
+   do not unblock that signal.  */
+void
+unblock_remote_children (void)
+{
+  return;
+}
+
+/* Send signal SIG to child ID.  Return 0 if successful, -1 if not.  */
+int
+remote_kill (pid_t id UNUSED, int sig UNUSED)
+{
+  return -1;
+}
@@ -0,0 +1,553 @@
+/* Reference worker for running GNU Make jobs remotely.
+Copyright (C) 2024 Free Software Foundation, Inc.
+This file is part of GNU Make.
+
+GNU Make is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+GNU Make is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* make-worker listens on a Unix domain or TCP socket and runs the jobs that
+   make sends it when built with the socket remote backend (see
+   remote-proto.h and README.remote).  It forks a process for each
+   connection, which runs the command in its own process group and relays
+   its standard input, output, and exit status.  The command runs as the
+   user running make-worker, in the directory make was run in, so the hosts
+   must share a file system.
+
+   make also runs "make-worker --relay" locally for each remote job, with
+   the connection to the worker as descriptor 3.  It relays the job's
+   standard input and signals to the worker, and its output and exit status
+   back to make, so make can treat the job like a local child.  */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#if HAVE_SYS_SELECT_H
+# include <sys/select.h>
+#endif
+
+#include "remote-proto.h"
+
+extern char **environ;
+
+static const char *program;
+static int verbose = 0;
+
+/* The descriptor make gives the relay the connection to the worker on.  */
+#define RELAY_FD        3
+
+static void
+usage (void)
+{
+  fprintf (stderr, "Usage: %s [-v] ADDRESS\n", program);
+  fprintf (stderr,
+           "Run jobs for GNU Make.  ADDRESS is unix:PATH or [HOST]:PORT.\n");
+  exit (2);
+}
+
+/* Append STR to the null-terminated vector *VEC of *COUNT elements.  */
+
+static int
+push (char ***vec, size_t *count, char *str)
+{
+  char **v = realloc (*vec, (*count + 2) * sizeof (char *));
+  if (v == NULL)
+    return -1;
+  v[(*count)++] = str;
+  v[*count] = NULL;
+  *vec = v;
+  return 0;
+}
+
+static void
+send_failure (int sock, const char *what, int err)
+{
+  char msg[1024];
+  snprintf (msg, sizeof (msg), "%s: %s", what, strerror (err));
+  rp_send (sock, RP_FAILED, msg, strlen (msg));
+}
+
+/* Forward everything that can be read from *FD to SOCK as messages of type
+   TYPE.  Close *FD and set it to -1 at EOF.  */
+
+static void
+forward_output (int *fd, int sock, int type)
+{
+  char buf[16384];
+  ssize_t n;
+
+  do
+    n = read (*fd, buf, sizeof (buf));
+  while (n < 0 && errno == EINTR);
+
+  if (n > 0)
+    rp_send (sock, type, buf, n);
+  else
+    {
+      close (*fd);
+      *fd = -1;
+    }
+}
+
+/* Handle one connection from make on SOCK.  */
+
+static void
+serve (int sock)
+{
+  char **argv = NULL;
+  char **envp = NULL;
+  size_t argc = 0;
+  size_t envc = 0;
+  char *cwd = NULL;
+  int in[2], out[2], err[2], status[2];
+  char *pending = NULL;         /* Standard input not yet written.  */
+  size_t pending_len = 0;
+  char *pending_buf = NULL;
+  int sock_open = 1;
+  int wstatus;
+  unsigned char result[8];
+  pid_t pid;
+  ssize_t n;
+  int execerr;
+
+  /* Read the request.  */
+  while (1)
+    {
+      char *data;
+      size_t len;
+      int type;
+
+      if (rp_recv (sock, &type, &data, &len) <= 0)
+        return;
+
+      if (type == RP_RUN)
+        {
+          free (data);
+          break;
+        }
+      else if (type == RP_CWD)
+        {
+          free (cwd);
+          cwd = data;
+        }
+      else if (type == RP_ARG)
+        push (&argv, &argc, data);
+      else if (type == RP_ENV)
+        push (&envp, &envc, data);
+      else
+        free (data);
+    }
+
+  if (argc == 0)
+    {
+      rp_send (sock, RP_FAILED, "no command", 10);
+      return;
+    }
+  if (envp == NULL)
+    envp = calloc (1, sizeof (char *));
+
+  if (cwd != NULL && chdir (cwd) < 0)
+    {
+      send_failure (sock, cwd, errno);
+      return;
+    }
+
+  if (pipe (in) < 0 || pipe (out) < 0 || pipe (err) < 0 || pipe (status) < 0)
+    {
+      send_failure (sock, "pipe", errno);
+      return;
+    }
+  fcntl (status[1], F_SETFD, FD_CLOEXEC);
+
+  pid = fork ();
+  if (pid < 0)
+    {
+      send_failure (sock, "fork", errno);
+      return;
+    }
+
+  if (pid == 0)
+    {
+      /* Put the command in its own process group, so we can kill it and
+         anything it started.  */
+      setpgid (0, 0);
+      signal (SIGPIPE, SIG_DFL);
+
+      dup2 (in[0], 0);
+      dup2 (out[1], 1);
+      dup2 (err[1], 2);
+      close (in[0]);
+      close (in[1]);
+      close (out[0]);
+      close (out[1]);
+      close (err[0]);
+      close (err[1]);
+      close (status[0]);
+      close (sock);
+
+      /* Use the command's PATH to find it, as make would.  */
+      environ = envp;
+      execvp (argv[0], argv);
+
+      execerr = errno;
+      n = write (status[1], &execerr, sizeof (execerr));
+      _exit (127);
+    }
+
+  close (in[0]);
+  close (out[1]);
+  close (err[1]);
+  close (status[1]);
+
+  /* If the exec failed, report it and let make run the command itself.  */
+  do
+    n = read (status[0], &execerr, sizeof (execerr));
+  while (n < 0 && errno == EINTR);
+  close (status[0]);
+  if (n == sizeof (execerr))
+    {
+      send_failure (sock, argv[0], execerr);
+      waitpid (pid, NULL, 0);
+      return;
+    }
+
+  if (verbose)
+    fprintf (stderr, "%s: [%ld] %s\n", program, (long) pid, argv[0]);
+
+  rp_send (sock, RP_STARTED, NULL, 0);
+
+  /* Don't block writing standard input the command isn't reading.  */
+  fcntl (in[1], F_SETFL, fcntl (in[1], F_GETFL) | O_NONBLOCK);
+
+  while (out[0] >= 0 || err[0] >= 0)
+    {
+      fd_set readable, writable;
+      int maxfd = sock;
+
+      FD_ZERO (&readable);
+      FD_ZERO (&writable);
+      if (sock_open && pending_len == 0)
+        FD_SET (sock, &readable);
+      if (pending_len > 0)
+        {
+          FD_SET (in[1], &writable);
+          if (in[1] > maxfd)
+            maxfd = in[1];
+        }
+      if (out[0] >= 0)
+        {
+          FD_SET (out[0], &readable);
+          if (out[0] > maxfd)
+            maxfd = out[0];
+        }
+      if (err[0] >= 0)
+        {
+          FD_SET (err[0], &readable);
+          if (err[0] > maxfd)
+            maxfd = err[0];
+        }
+
+      if (select (maxfd + 1, &readable, &writable, NULL, NULL) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          break;
+        }
+
+      if (out[0] >= 0 && FD_ISSET (out[0], &readable))
+        forward_output (&out[0], sock, RP_STDOUT);
+      if (err[0] >= 0 && FD_ISSET (err[0], &readable))
+        forward_output (&err[0], sock, RP_STDERR);
+
+      if (pending_len > 0 && FD_ISSET (in[1], &writable))
+        {
+          n = write (in[1], pending, pending_len);
+          if (n > 0)
+            {
+              pending += n;
+              pending_len -= n;
+            }
+          else if (n < 0 && errno != EAGAIN && errno != EINTR)
+            /* The command closed its standard input: discard the rest.  */
+            pending_len = 0;
+          if (pending_len == 0)
+            {
+              free (pending_buf);
+              pending_buf = NULL;
+            }
+        }
+
+      if (sock_open && FD_ISSET (sock, &readable))
+        {
+          char *data;
+          size_t len;
+          int type;
+
+          if (rp_recv (sock, &type, &data, &len) <= 0)
+            {
+              /* make went away: stop the command.  */
+              sock_open = 0;
+              kill (-pid, SIGTERM);
+              continue;
+            }
+
+          if (type == RP_STDIN && len == 0)
+            {
+              if (in[1] >= 0)
+                close (in[1]);
+              in[1] = -1;
+              free (data);
+            }
+          else if (type == RP_STDIN && in[1] >= 0)
+            {
+              pending = pending_buf = data;
+              pending_len = len;
+            }
+          else if (type == RP_KILL && len == 4)
+            {
+              kill (-pid, (int) rp_get_u32 ((unsigned char *) data));
+              free (data);
+            }
+          else
+            free (data);
+        }
+    }
+
+  if (in[1] >= 0)
+    close (in[1]);
+  free (pending_buf);
+
+  while (waitpid (pid, &wstatus, 0) < 0)
+    if (errno != EINTR)
+      return;
+
+  rp_put_u32 (result, WIFEXITED (wstatus) ? WEXITSTATUS (wstatus) : 0);
+  rp_put_u32 (result + 4, WIFSIGNALED (wstatus) ? WTERMSIG (wstatus) : 0);
+  if (sock_open)
+    rp_send (sock, RP_EXIT, result, sizeof (result));
+
+  if (verbose)
+    fprintf (stderr, "%s: [%ld] exited with status %d\n",
+             program, (long) pid, wstatus);
+}
+
+/* The signal handlers of the relay write the signal number to this pipe,
+   so it can pass the signal on to the worker.  */
+static int relay_wakeup[2];
+
+static void
+relay_signal (int sig)
+{
+  unsigned char c = (unsigned char) sig;
+  int e = errno;
+  ssize_t n = write (relay_wakeup[1], &c, 1);
+  (void) n;
+  errno = e;
+}
+
+static void
+write_output (int fd, const char *data, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t n = write (fd, data, len);
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return;
+        }
+      data += n;
+      len -= n;
+    }
+}
+
+/* Pass standard input and signals to the worker on SOCK, and its output to
+   our standard output and error, until it reports that the command has
+   exited.  Then exit the same way.  */
+
+static int
+relay (int sock)
+{
+  static const int sigs[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT, 0 };
+  static const char lost[] = "lost connection to remote worker\n";
+  char buf[16384];
+  sigset_t empty;
+  int stdin_open = 1;
+  int i;
+
+  if (pipe (relay_wakeup) < 0)
+    return 2;
+
+  for (i = 0; sigs[i] != 0; ++i)
+    signal (sigs[i], relay_signal);
+  signal (SIGPIPE, SIG_IGN);
+
+  sigemptyset (&empty);
+  sigprocmask (SIG_SETMASK, &empty, NULL);
+
+  while (1)
+    {
+      fd_set readable;
+      int maxfd = sock > relay_wakeup[0] ? sock : relay_wakeup[0];
+
+      FD_ZERO (&readable);
+      FD_SET (sock, &readable);
+      FD_SET (relay_wakeup[0], &readable);
+      if (stdin_open)
+        FD_SET (0, &readable);
+
+      if (select (maxfd + 1, &readable, NULL, NULL, NULL) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          break;
+        }
+
+      if (FD_ISSET (relay_wakeup[0], &readable))
+        {
+          unsigned char c;
+          if (read (relay_wakeup[0], &c, 1) == 1)
+            {
+              unsigned char sig[4];
+              rp_put_u32 (sig, c);
+              rp_send (sock, RP_KILL, sig, sizeof (sig));
+            }
+        }
+
+      if (stdin_open && FD_ISSET (0, &readable))
+        {
+          ssize_t n;
+
+          do
+            n = read (0, buf, sizeof (buf));
+          while (n < 0 && errno == EINTR);
+          if (n <= 0)
+            {
+              n = 0;
+              stdin_open = 0;
+            }
+          if (rp_send (sock, RP_STDIN, buf, n) < 0)
+            stdin_open = 0;
+        }
+
+      if (FD_ISSET (sock, &readable))
+        {
+          char *data;
+          size_t len;
+          int type;
+
+          if (rp_recv (sock, &type, &data, &len) <= 0)
+            break;
+
+          if (type == RP_STDOUT)
+            write_output (1, data, len);
+          else if (type == RP_STDERR)
+            write_output (2, data, len);
+          else if (type == RP_EXIT && len == 8)
+            {
+              int code = (int) rp_get_u32 ((unsigned char *) data);
+              int sig = (int) rp_get_u32 ((unsigned char *) data + 4);
+
+              if (sig != 0)
+                {
+                  signal (sig, SIG_DFL);
+                  kill (getpid (), sig);
+                }
+              return code;
+            }
+          free (data);
+        }
+    }
+
+  /* The worker went away before telling us how the command exited.  */
+  write_output (2, lost, sizeof (lost) - 1);
+  return 2;
+}
+
+int
+main (int argc, char **argv)
+{
+  struct sigaction sa;
+  struct rp_addr *addr;
+  int lsock;
+  int i;
+
+  program = argv[0];
+
+  if (argc == 2 && strcmp (argv[1], "--relay") == 0)
+    return relay (RELAY_FD);
+
+  for (i = 1; i < argc && argv[i][0] == '-'; ++i)
+    if (strcmp (argv[i], "-v") == 0)
+      verbose = 1;
+    else
+      usage ();
+
+  if (i != argc - 1)
+    usage ();
+
+  addr = rp_resolve (argv[i], 1);
+  lsock = addr ? rp_listen (addr) : -1;
+  rp_free_addr (addr);
+  if (lsock < 0)
+    {
+      fprintf (stderr, "%s: %s: %s\n", program, argv[i], strerror (errno));
+      return 1;
+    }
+
+  /* Don't let connection handlers turn into zombies.  */
+  memset (&sa, 0, sizeof (sa));
+  sa.sa_handler = SIG_IGN;
+  sa.sa_flags = SA_NOCLDWAIT;
+  sigaction (SIGCHLD, &sa, NULL);
+  signal (SIGPIPE, SIG_IGN);
+
+  while (1)
+    {
+      pid_t pid;
+      int sock = accept (lsock, NULL, NULL);
+
+      if (sock < 0)
+        {
+          if (errno == EINTR || errno == ECONNABORTED)
+            continue;
+          fprintf (stderr, "%s: accept: %s\n", program, strerror (errno));
+          return 1;
+        }
+
+      pid = fork ();
+      if (pid == 0)
+        {
+          close (lsock);
+          sa.sa_handler = SIG_DFL;
+          sa.sa_flags = 0;
+          sigaction (SIGCHLD, &sa, NULL);
+          serve (sock);
+          _exit (0);
+        }
+
+      if (pid < 0)
+        fprintf (stderr, "%s: fork: %s\n", program, strerror (errno));
+      close (sock);
+    }
+}
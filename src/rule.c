@@ -600,6 +600,31 @@ print_rule (struct rule *r)
     print_commands (r->cmds);
 }
 
+/* Print the memory used by pattern rules for --memory-stats.  Their
+   prerequisites are counted with the other deps.  */
+
+void
+print_rule_memory_stats (void)
+{
+  unsigned long count = 0;
+  unsigned long bytes = 0;
+  struct rule *r;
+
+  for (r = pattern_rules; r != NULL; r = r->next)
+    {
+      ++count;
+      bytes += sizeof (struct rule)
+               + r->num * (2 * sizeof (const char *) + sizeof (unsigned int));
+      if (r->_defn)
+        bytes += strlen (r->_defn) + 1;
+      if (r->cmds)
+        bytes += commands_memory_size (r->cmds);
+    }
+
+  print_memory_usage (_("pattern rules"), count, bytes);
+}
+
+
 void
 print_rule_data_base (void)
 {
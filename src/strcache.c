@@ -23,7 +23,18 @@ this program.  If not, see <https://www.gnu.org/licenses/>.  */
 
 /* A string cached here will never be freed, so we don't need to worry about
    reference counting.  We just store the string, and then remember it in a
-   hash so it can be looked up again. */
+   hash so it can be looked up again.
+
+   Each string is preceded by a header holding its length and hash, so that
+   users of cached strings, such as the file table, needn't compute them
+   again.  The header is not aligned.  */
+
+struct sc_header {
+  unsigned int len;         /* Length of the string.  */
+  unsigned int hash;        /* Its hash: see strcache_string_hash().  */
+};
+
+#define SC_HEADER_SIZE          (sizeof (struct sc_header))
 
 typedef unsigned short int sc_buflen_t;
 
@@ -71,14 +82,33 @@ new_cache (struct strcache **head, sc_buflen_t buflen)
   return new;
 }
 
+/* Store the header for STR, of length LEN, and the string itself at DST.
+   Return the stored string.  */
+
+static char *
+store_string (char *dst, const char *str, size_t len, unsigned int hash)
+{
+  struct sc_header hdr;
+  char *res = dst + SC_HEADER_SIZE;
+
+  hdr.len = (unsigned int) len;
+  hdr.hash = hash;
+  memcpy (dst, &hdr, SC_HEADER_SIZE);
+
+  memmove (res, str, len);
+  res[len] = '\0';
+
+  return res;
+}
+
 static const char *
-copy_string (struct strcache *sp, const char *str, sc_buflen_t len)
+copy_string (struct strcache *sp, const char *str, sc_buflen_t len,
+             unsigned int hash)
 {
   /* Add the string to this cache.  */
-  char *res = &sp->buffer[sp->end];
+  char *res = store_string (&sp->buffer[sp->end], str, len, hash);
 
-  memmove (res, str, len);
-  res[len++] = '\0';
+  len += SC_HEADER_SIZE + 1;
   sp->end += len;
   sp->bytesfree -= len;
   ++sp->count;
@@ -87,13 +117,13 @@ copy_string (struct strcache *sp, const char *str, sc_buflen_t len)
 }
 
 static const char *
-add_string (const char *str, sc_buflen_t len)
+add_string (const char *str, sc_buflen_t len, unsigned int hash)
 {
   const char *res;
   struct strcache *sp;
   struct strcache **spp = &strcache;
-  /* We need space for the nul char.  */
-  sc_buflen_t sz = len + 1;
+  /* We need space for the header and the nul char.  */
+  sc_buflen_t sz = len + SC_HEADER_SIZE + 1;
 
   ++total_strings;
   total_size += sz;
@@ -103,7 +133,7 @@ add_string (const char *str, sc_buflen_t len)
   if (sz > BUFSIZE)
     {
       sp = new_cache (&fullcache, sz);
-      return copy_string (sp, str, len);
+      return copy_string (sp, str, len, hash);
     }
 
   /* Find the first cache with enough free space.  */
@@ -120,7 +150,7 @@ add_string (const char *str, sc_buflen_t len)
     }
 
   /* Add the string to this cache.  */
-  res = copy_string (sp, str, len);
+  res = copy_string (sp, str, len, hash);
 
   /* If the amount free in this cache is less than the average string size,
      consider it full and move it to the full list.  */
@@ -143,24 +173,71 @@ struct hugestring {
 static struct hugestring *hugestrings = NULL;
 
 static const char *
-add_hugestring (const char *str, size_t len)
+add_hugestring (const char *str, size_t len, unsigned int hash)
 {
-  struct hugestring *new = xmalloc (sizeof (struct hugestring) + len);
-  memcpy (new->buffer, str, len);
-  new->buffer[len] = '\0';
+  struct hugestring *new = xmalloc (sizeof (struct hugestring)
+                                    + SC_HEADER_SIZE + len);
+  const char *res = store_string (new->buffer, str, len, hash);
 
   new->next = hugestrings;
   hugestrings = new;
 
-  return new->buffer;
+  return res;
+}
+
+static struct sc_header
+get_header (const char *str)
+{
+  struct sc_header hdr;
+  memcpy (&hdr, str - SC_HEADER_SIZE, SC_HEADER_SIZE);
+  return hdr;
 }
 
-/* Hash table of strings in the cache.  */
+/* Return the hash that is stored with STR, which is LEN bytes long and
+   nul-terminated, if it's added to the cache.  File names are hashed the
+   same way as the cache compares them; other names may use it only if
+   that is case-sensitive.  */
+
+unsigned long
+strcache_string_hash (const char *str, size_t len)
+{
+  unsigned long hash = 0;
+
+#ifdef HAVE_CASE_INSENSITIVE_FS
+  (void) len;
+  ISTRING_HASH_1 (str, hash);
+#else
+  STRING_N_HASH_1 (str, len, hash);
+#endif
+
+  return (unsigned int) hash;
+}
+
+/* Return the hash of STR, which must be in the cache.  */
+
+unsigned long
+strcache_hash (const char *str)
+{
+  return get_header (str).hash;
+}
+
+/* Hash table of strings in the cache.  The items are cached strings, and
+   the key being looked up is described by lookup_key, so the hash of every
+   string is computed only once.  */
+
+static struct
+  {
+    const char *str;
+    size_t len;
+    unsigned int hash;
+  } lookup_key;
 
 static unsigned long
 str_hash_1 (const void *key)
 {
-  return_ISTRING_HASH_1 ((const char *) key);
+  if (key == lookup_key.str)
+    return lookup_key.hash;
+  return strcache_hash (key);
 }
 
 static unsigned long
@@ -172,6 +249,18 @@ str_hash_2 (const void *key)
 static int
 str_hash_cmp (const void *x, const void *y)
 {
+  const char *cached = x == lookup_key.str ? y : x;
+
+  if (x == y)
+    return 0;
+
+  /* Two different cached strings are never the same.  */
+  if (x != lookup_key.str && y != lookup_key.str)
+    return 1;
+
+  if (get_header (cached).len != lookup_key.len)
+    return 1;
+
   return_ISTRING_COMPARE ((const char *) x, (const char *) y);
 }
 
@@ -183,15 +272,20 @@ add_hash (const char *str, size_t len)
 {
   char *const *slot;
   const char *key;
+  unsigned int hash = (unsigned int) strcache_string_hash (str, len);
 
   /* If it's too large for the string cache, just copy it.
      We don't bother trying to match these.  */
-  if (len > USHRT_MAX - 1)
-    return add_hugestring (str, len);
+  if (len > USHRT_MAX - SC_HEADER_SIZE - 1)
+    return add_hugestring (str, len, hash);
 
   /* Look up the string in the hash.  If it's there, return it.  */
+  lookup_key.str = str;
+  lookup_key.len = len;
+  lookup_key.hash = hash;
   slot = (char *const *) hash_find_slot (&strings, str);
   key = *slot;
+  lookup_key.str = NULL;
 
   /* Count the total number of add operations we performed.  */
   ++total_adds;
@@ -200,7 +294,7 @@ add_hash (const char *str, size_t len)
     return key;
 
   /* Not there yet so add it to a buffer, then into the hash table.  */
-  key = add_string (str, (sc_buflen_t)len);
+  key = add_string (str, (sc_buflen_t)len, hash);
   hash_insert_at (&strings, key, slot);
   return key;
 }
@@ -221,7 +315,7 @@ strcache_iscached (const char *str)
   {
     struct hugestring *hp;
     for (hp = hugestrings; hp != 0; hp = hp->next)
-      if (str == hp->buffer)
+      if (str == hp->buffer + SC_HEADER_SIZE)
         return 1;
   }
 
@@ -257,6 +351,7 @@ void
 strcache_init (void)
 {
   hash_init (&strings, 8000, str_hash_1, str_hash_2, str_hash_cmp);
+  hash_set_incremental (&strings);
 }
 
 
@@ -328,3 +423,19 @@ strcache_print_stats (const char *prefix)
   fputs (_("# hash-table stats:\n# "), stdout);
   hash_print_stats (&strings, stdout);
 }
+
+/* Print the memory used by the strcache for --memory-stats.  */
+
+void
+strcache_memory_stats (void)
+{
+  const struct hugestring *hs;
+  unsigned long bytes = total_buffers * (BUFSIZE + CACHE_BUFFER_OFFSET);
+
+  for (hs = hugestrings; hs != NULL; hs = hs->next)
+    bytes += sizeof (struct hugestring) + SC_HEADER_SIZE
+             + get_header (hs->buffer + SC_HEADER_SIZE).len;
+
+  print_memory_usage (_("strcache"), total_strings,
+                      bytes + hash_memory_size (&strings));
+}
@@ -38,6 +38,17 @@ unsigned long long env_recursion = 0;
 /* Incremented every time we add or remove a global variable.  */
 static unsigned long variable_changenum = 0;
 
+/* Incremented every time any variable set changes; the new value is stored
+   in the set.  See target_environment().  */
+static unsigned long variable_generation = 0;
+
+/* The value of variable_generation when export settings last changed.  */
+static unsigned long exports_generation = 0;
+
+#define touch_variable_set(_s)  ((_s)->generation = ++variable_generation)
+
+static void discard_env_cache (struct variable_set_list *list);
+
 /* Chain of all pattern-specific variables.  */
 
 static struct pattern_var *pattern_vars = NULL;
@@ -146,6 +157,8 @@ static unsigned long
 variable_hash_1 (const void *keyv)
 {
   struct variable const *key = (struct variable const *) keyv;
+  if (key->name_cached)
+    return strcache_hash (key->name);
   return_STRING_N_HASH_1 (key->name, key->length);
 }
 
@@ -164,6 +177,9 @@ variable_hash_cmp (const void *xv, const void *yv)
   int result = x->length - y->length;
   if (result)
     return result;
+  /* Two different cached names are never the same.  */
+  if (x->name_cached && y->name_cached)
+    return x->name != y->name;
   return_STRING_N_COMPARE (x->name, y->name, x->length);
 }
 
@@ -179,7 +195,7 @@ variable_hash_cmp (const void *xv, const void *yv)
 
 static struct variable_set global_variable_set;
 static struct variable_set_list global_setlist
-  = { 0, &global_variable_set, 0 };
+  = { 0, &global_variable_set, 0, 0 };
 struct variable_set_list *current_variable_set_list = &global_setlist;
 
 /* Implement variables.  */
@@ -233,6 +249,7 @@ define_variable_in_set (const char *name, size_t length,
 
   var_key.name = (char *) name;
   var_key.length = (unsigned int) length;
+  var_key.name_cached = 0;
   var_slot = (struct variable **) hash_find_slot (&set->table, &var_key);
   v = *var_slot;
 
@@ -267,6 +284,12 @@ define_variable_in_set (const char *name, size_t length,
   if (env_overrides && origin == o_env)
     origin = o_env_override;
 
+  /* Automatic variables are never exported so they don't affect the
+     cached environments.  The caller may change V's flags, so note the
+     change even if we don't redefine it.  */
+  if (origin != o_automatic)
+    touch_variable_set (set);
+
   if (! HASH_VACANT (v))
     {
       if (env_overrides && v->origin == o_env)
@@ -294,7 +317,13 @@ define_variable_in_set (const char *name, size_t length,
   /* Create a new variable definition and add it to the hash table.  */
 
   v = xcalloc (sizeof (struct variable));
+#ifdef HAVE_CASE_INSENSITIVE_FS
+  /* The strcache would merge names that differ only in case.  */
   v->name = xstrndup (name, length);
+#else
+  v->name = (char *) strcache_add_len (name, length);
+  v->name_cached = 1;
+#endif
   v->length = (unsigned int) length;
   hash_insert_at (&set->table, v, var_slot);
   if (set == &global_variable_set)
@@ -336,13 +365,15 @@ static void
 free_variable_name_and_value (const void *item)
 {
   struct variable *v = (struct variable *) item;
-  free (v->name);
+  if (!v->name_cached)
+    free (v->name);
   free (v->value);
 }
 
 void
 free_variable_set (struct variable_set_list *list)
 {
+  discard_env_cache (list);
   hash_map (&list->set->table, free_variable_name_and_value);
   hash_free (&list->set->table, 1);
   free (list->set);
@@ -365,6 +396,7 @@ undefine_variable_in_set (const floc *flocp, const char *name, size_t length,
 
   var_key.name = (char *) name;
   var_key.length = (unsigned int) length;
+  var_key.name_cached = 0;
   var_slot = (struct variable **) hash_find_slot (&set->table, &var_key);
 
   if (env_overrides && origin == o_env)
@@ -385,18 +417,105 @@ undefine_variable_in_set (const floc *flocp, const char *name, size_t length,
           hash_delete_at (&set->table, var_slot);
           free_variable_name_and_value (v);
           free (v);
+          touch_variable_set (set);
           if (set == &global_variable_set)
             ++variable_changenum;
         }
     }
 }
 
+/* Variables defined by loaded objects, whose values are computed by FUNC
+   when they are first referenced.  Until then they are "special".  */
+
+struct lazy_variable
+  {
+    struct lazy_variable *next;
+    const char *name;
+    gmk_var_ptr func;
+  };
+
+static struct lazy_variable *lazy_variables = NULL;
+
+/* Remove the lazy variable NAME from the list and return it, or NULL.  */
+
+static struct lazy_variable *
+take_lazy_variable (const char *name)
+{
+  struct lazy_variable **lp;
+
+  for (lp = &lazy_variables; *lp != 0; lp = &(*lp)->next)
+    if (streq ((*lp)->name, name))
+      {
+        struct lazy_variable *lv = *lp;
+        *lp = lv->next;
+        return lv;
+      }
+
+  return NULL;
+}
+
+/* Define the global variable NAME, whose value will be computed by FUNC the
+   first time it is referenced.  */
+
+void
+define_lazy_variable (const char *name, gmk_var_ptr func, int recursive,
+                      const floc *flocp)
+{
+  struct variable *v;
+  struct lazy_variable *lv;
+
+  v = define_variable_global (name, strlen (name), "", o_file, recursive,
+                              flocp);
+
+  /* If it was defined on the command line, for example, that value wins.  */
+  if (v->origin != o_file)
+    return;
+
+  lv = take_lazy_variable (v->name);
+  if (!lv)
+    {
+      lv = xmalloc (sizeof (struct lazy_variable));
+      lv->name = strcache_add (v->name);
+    }
+  lv->func = func;
+  lv->next = lazy_variables;
+  lazy_variables = lv;
+
+  v->special = 1;
+}
+
+/* If VAR is a lazy variable that has not been computed yet, compute its
+   value now.  Return nonzero if it was a lazy variable.  */
+
+static int
+compute_lazy_variable (struct variable *var)
+{
+  struct lazy_variable *lv = take_lazy_variable (var->name);
+  char *value;
+
+  if (!lv)
+    return 0;
+
+  /* From now on this is an ordinary variable, even while FUNC runs.  */
+  var->special = 0;
+  value = (*lv->func) (var->name);
+  free (lv);
+
+  free (var->value);
+  var->value = value ? value : xstrdup ("");
+  touch_variable_set (&global_variable_set);
+
+  return 1;
+}
+
 /* If the variable passed in is "special", handle its special nature.
    Currently there are two such variables, both used for introspection:
    .VARIABLES expands to a list of all the variables defined in this instance
    of make.
    .TARGETS expands to a list of all the targets defined in this
    instance of make.
+   Variables defined by loaded objects with gmk_add_lazy_variable() are also
+   special until their value has been computed.
    Returns the variable reference passed in.  */
 
 #define EXPANSION_INCREMENT(_l)  ((((_l) / 500) + 1) * 500)
@@ -406,6 +525,9 @@ lookup_special_var (struct variable *var)
 {
   static unsigned long last_changenum = 0;
 
+  if (lazy_variables && compute_lazy_variable (var))
+    return var;
+
   /* This one actually turns out to be very hard, due to the way the parser
      records targets.  The way it works is that target information is collected
      internally until make knows the target is completely specified.  Only when
@@ -509,6 +631,7 @@ lookup_variable (const char *name, size_t length)
 
   var_key.name = (char *) name;
   var_key.length = (unsigned int) length;
+  var_key.name_cached = 0;
 
   for (setlist = current_variable_set_list;
        setlist != 0; setlist = setlist->next)
@@ -618,6 +741,7 @@ lookup_variable_in_set (const char *name, size_t length,
 
   var_key.name = (char *) name;
   var_key.length = (unsigned int) length;
+  var_key.name_cached = 0;
 
   return hash_find_item ((struct hash_table *) &set->table, &var_key);
 }
@@ -643,6 +767,8 @@ initialize_file_variables (struct file *file, int reading)
       l->set = xmalloc (sizeof (struct variable_set));
       hash_init (&l->set->table, PERFILE_VARIABLE_BUCKETS,
                  variable_hash_1, variable_hash_2, variable_hash_cmp);
+      touch_variable_set (l->set);
+      l->env = NULL;
       file->variables = l;
     }
 
@@ -742,12 +868,14 @@ create_new_variable_set (void)
   set = xmalloc (sizeof (struct variable_set));
   hash_init (&set->table, SMALL_SCOPE_VARIABLE_BUCKETS,
              variable_hash_1, variable_hash_2, variable_hash_cmp);
+  touch_variable_set (set);
 
   setlist = (struct variable_set_list *)
     xmalloc (sizeof (struct variable_set_list));
   setlist->set = set;
   setlist->next = current_variable_set_list;
   setlist->next_is_parent = 0;
+  setlist->env = NULL;
 
   return setlist;
 }
@@ -806,6 +934,7 @@ pop_variable_scope (void)
     }
 
   /* Free the one we no longer need.  */
+  discard_env_cache (setlist);
   free (setlist);
   hash_map (&set->table, free_variable_name_and_value);
   hash_free (&set->table, 1);
@@ -865,6 +994,7 @@ merge_variable_sets (struct variable_set *to_set,
         if (HASH_VACANT (*to_var_slot))
           {
             hash_insert_at (&to_set->table, from_var, to_var_slot);
+            touch_variable_set (to_set);
             variable_changenum += inc;
           }
         else
@@ -1115,42 +1245,195 @@ should_export (const struct variable *v)
   return 1;
 }
 
-/* Create a new environment for FILE's commands.
-   If FILE is nil, this is for the 'shell' function.
-   The child's MAKELEVEL variable is incremented.
-   If recursive is true then we're running a recursive make, else not.  */
+/* A cached environment.  The exported variables found by walking a variable
+   set list are remembered, along with the strings for those whose values
+   don't need to be expanded again.  If there are no others, every job using
+   the list shares the same vector.  */
 
-char **
-target_environment (struct file *file, int recursive)
+struct env_cache
+  {
+    struct env_cache *next;     /* Next in the chain of shared vectors.  */
+    unsigned long generation;   /* Value of variable_generation when built.  */
+    const char *invalid;        /* Jobserver invalidation option used.  */
+    struct variable_set **sets; /* The variable sets we were built from.  */
+    unsigned int nsets;         /* The number of SETS.  */
+    unsigned int count;         /* The number of strings in ENVP.  */
+    unsigned int refs;          /* Number of jobs using ENVP.  */
+    unsigned int local:1;       /* Nonzero if the first set was local.  */
+    unsigned int dynamic:1;     /* Nonzero if any strings must be expanded.  */
+    unsigned int detached:1;    /* Nonzero if no list refers to us.  */
+    struct variable **vars;     /* Variables, or NULL for added strings.  */
+    char **envp;                /* Strings, or NULL to expand VARS.  */
+  };
+
+/* Shared environment vectors that are still in use by some job.  */
+
+static struct env_cache *shared_envs = NULL;
+
+static void
+free_env_cache (struct env_cache *env)
 {
-  struct variable_set_list *set_list;
+  unsigned int i;
+
+  for (i = 0; i < env->count; ++i)
+    free (env->envp[i]);
+  free (env->envp);
+  free (env->vars);
+  free (env->sets);
+  free (env);
+}
+
+/* Remove the cached environment from LIST.  If a job is still using it, it
+   will be freed when the job is done.  */
+
+static void
+discard_env_cache (struct variable_set_list *list)
+{
+  struct env_cache *env = list->env;
+
+  list->env = NULL;
+  if (!env)
+    return;
+
+  if (env->refs)
+    env->detached = 1;
+  else
+    free_env_cache (env);
+}
+
+/* Return nonzero if we can ignore SET when looking for exported variables
+   because it contains nothing but automatic variables.  */
+
+static int
+only_automatic_vars (const struct variable_set *set)
+{
+  struct variable **v_slot = (struct variable **) set->table.ht_vec;
+  struct variable **v_end = v_slot + set->table.ht_size;
+
+  for ( ; v_slot < v_end; v_slot++)
+    if (! HASH_VACANT (*v_slot) && (*v_slot)->origin != o_automatic)
+      return 0;
+
+  return 1;
+}
+
+/* Return nonzero if the cached environment ENV is still valid for the
+   variable sets in SET_LIST.  */
+
+static int
+env_cache_valid (const struct env_cache *env,
+                 const struct variable_set_list *set_list, int local,
+                 const char *invalid)
+{
+  const struct variable_set_list *s;
+  unsigned int i = 0;
+
+  if (env->local != local || env->invalid != invalid
+      || env->generation < exports_generation)
+    return 0;
+
+  for (s = set_list; s != 0; s = s->next, ++i)
+    if (i == env->nsets || s->set != env->sets[i]
+        || s->set->generation > env->generation)
+      return 0;
+
+  return i == env->nsets;
+}
+
+/* Return the environment string for V, which is being exported to the
+   commands of FILE.  */
+
+static char *
+env_string (struct variable *v, struct file *file, const char *invalid)
+{
+  char *value = v->value;
+  char *cp = NULL;
+  char *result;
+
+  /* If V is recursively expanded and didn't come from the environment,
+     expand its value.  If it came from the environment, it should
+     go back into the environment unchanged... except MAKEFLAGS.  */
+  if (v->recursive && ((v->origin != o_env && v->origin != o_env_override)
+                       || streq (v->name, MAKEFLAGS_NAME)))
+    value = cp = recursively_expand_for_file (v, file);
+
+  /* If this is MAKELEVEL, update it.  */
+  if (streq (v->name, MAKELEVEL_NAME))
+    {
+      char val[INTSTR_LENGTH + 1];
+      sprintf (val, "%u", makelevel + 1);
+      free (cp);
+      value = cp = xstrdup (val);
+    }
+
+  /* If we need to reset jobserver, check for MAKEFLAGS / MFLAGS.  */
+  else if (invalid && streq (v->name, MAKEFLAGS_NAME))
+    {
+      if (strstr (value, " --" JOBSERVER_AUTH_OPT "="))
+        {
+          char *mf;
+          /* The invalid option must come before variable overrides.  */
+          char *vars = strstr (value, " -- ");
+          if (!vars)
+            mf = xstrdup (concat (2, value, invalid));
+          else
+            {
+              size_t lf = vars - value;
+              size_t li = strlen (invalid);
+              mf = xmalloc (strlen (value) + li + 1);
+              strcpy (mempcpy (mempcpy (mf, value, lf), invalid, li), vars);
+            }
+          free (cp);
+          value = cp = mf;
+        }
+    }
+
+  else if (invalid && streq (v->name, "MFLAGS"))
+    {
+      if (strstr (value, " --" JOBSERVER_AUTH_OPT "=") && v->origin == o_env)
+        {
+          const char *mf = concat (2, value, invalid);
+          free (cp);
+          value = cp = xstrdup (mf);
+        }
+    }
+
+#if MK_OS_W32
+  else if (streq (v->name, "Path") || streq (v->name, "PATH"))
+    {
+      if (!cp)
+        cp = xstrdup (value);
+      value = convert_Path_to_windows32 (cp, ';');
+    }
+#endif
+
+  result = xstrdup (concat (3, v->name, "=", value));
+  free (cp);
+
+  return result;
+}
+
+/* Find the variables exported from SET_LIST and return a new environment
+   cache describing them.  If LOCAL is nonzero, the first set is the local
+   set of the target.  */
+
+static struct env_cache *
+build_env_cache (struct variable_set_list *set_list, int local,
+                 const char *invalid)
+{
+  struct env_cache *env = xcalloc (sizeof (struct env_cache));
   struct variable_set_list *s;
   struct hash_table table;
   struct variable **v_slot;
   struct variable **v_end;
-  char **result_0;
-  char **result;
-  const char *invalid = NULL;
   /* If we got no value from the environment then never add the default.  */
   int added_SHELL = shell_var.value == 0;
   int found_makelevel = 0;
-  int found_mflags = 0;
-  int found_makeflags = 0;
+  unsigned int i;
 
-  /* If file is NULL we're creating the target environment for $(shell ...)
-     Remember this so we can just ignore recursion.  */
-  if (!file)
-    ++env_recursion;
-
-  /* We need to update makeflags if (a) we're not recurive, (b) jobserver_auth
-     is enabled, and (c) we need to add invalidation.  */
-  if (!recursive && jobserver_auth)
-    invalid = jobserver_get_invalid_auth ();
-
-  if (file)
-    set_list = file->variables;
-  else
-    set_list = current_variable_set_list;
+  env->generation = variable_generation;
+  env->invalid = invalid;
+  env->local = local;
 
   hash_init (&table, VARIABLE_BUCKETS,
              variable_hash_1, variable_hash_2, variable_hash_cmp);
@@ -1161,9 +1444,11 @@ target_environment (struct file *file, int recursive)
   for (s = set_list; s != 0; s = s->next)
     {
       struct variable_set *set = s->set;
-      const int islocal = s == set_list;
+      const int islocal = local && s == set_list;
       const int isglobal = set == &global_variable_set;
 
+      ++env->nsets;
+
       v_slot = (struct variable **) set->table.ht_vec;
       v_end = v_slot + set->table.ht_size;
       for ( ; v_slot < v_end; v_slot++)
@@ -1192,7 +1477,12 @@ target_environment (struct file *file, int recursive)
           }
     }
 
-  result = result_0 = xmalloc ((table.ht_fill + 3) * sizeof (char *));
+  env->sets = xmalloc (env->nsets * sizeof (struct variable_set *));
+  for (s = set_list, i = 0; s != 0; s = s->next, ++i)
+    env->sets[i] = s->set;
+
+  env->vars = xmalloc ((table.ht_fill + 3) * sizeof (struct variable *));
+  env->envp = xmalloc ((table.ht_fill + 3) * sizeof (char *));
 
   v_slot = (struct variable **) table.ht_vec;
   v_end = v_slot + table.ht_size;
@@ -1200,124 +1490,195 @@ target_environment (struct file *file, int recursive)
     if (! HASH_VACANT (*v_slot))
       {
         struct variable *v = *v_slot;
-        char *value = v->value;
-        char *cp = NULL;
 
         /* This might be here because it was a target-specific variable that
            we didn't know the status of when we added it.  */
         if (! should_export (v))
           continue;
 
-        /* If V is recursively expanded and didn't come from the environment,
-           expand its value.  If it came from the environment, it should
-           go back into the environment unchanged... except MAKEFLAGS.  */
-        if (v->recursive && ((v->origin != o_env && v->origin != o_env_override)
-                             || streq (v->name, MAKEFLAGS_NAME)))
-          value = cp = recursively_expand_for_file (v, file);
+        /* A lazy variable must have its value before it can be exported.  */
+        if (v->special)
+          lookup_special_var (v);
 
         /* If this is the SHELL variable remember we already added it.  */
         if (!added_SHELL && streq (v->name, "SHELL"))
-          {
-            added_SHELL = 1;
-            goto setit;
-          }
-
-        /* If this is MAKELEVEL, update it.  */
-        if (!found_makelevel && streq (v->name, MAKELEVEL_NAME))
-          {
-            char val[INTSTR_LENGTH + 1];
-            sprintf (val, "%u", makelevel + 1);
-            free (cp);
-            value = cp = xstrdup (val);
-            found_makelevel = 1;
-            goto setit;
-          }
-
-        /* If we need to reset jobserver, check for MAKEFLAGS / MFLAGS.  */
-        if (invalid)
-          {
-            if (!found_makeflags && streq (v->name, MAKEFLAGS_NAME))
-              {
-                char *mf;
-                char *vars;
-                found_makeflags = 1;
-
-                if (!strstr (value, " --" JOBSERVER_AUTH_OPT "="))
-                  goto setit;
+          added_SHELL = 1;
 
-                /* The invalid option must come before variable overrides.  */
-                vars = strstr (value, " -- ");
-                if (!vars)
-                  mf = xstrdup (concat (2, value, invalid));
-                else
-                  {
-                    size_t lf = vars - value;
-                    size_t li = strlen (invalid);
-                    mf = xmalloc (strlen (value) + li + 1);
-                    strcpy (mempcpy (mempcpy (mf, value, lf), invalid, li),
-                            vars);
-                  }
-                free (cp);
-                value = cp = mf;
-                if (found_mflags)
-                  invalid = NULL;
-                goto setit;
-              }
+        else if (!found_makelevel && streq (v->name, MAKELEVEL_NAME))
+          found_makelevel = 1;
 
-            if (!found_mflags && streq (v->name, "MFLAGS"))
-              {
-                const char *mf;
-                found_mflags = 1;
-
-                if (!strstr (value, " --" JOBSERVER_AUTH_OPT "="))
-                  goto setit;
-
-                if (v->origin != o_env)
-                  goto setit;
-                mf = concat (2, value, invalid);
-                free (cp);
-                value = cp = xstrdup (mf);
-                if (found_makeflags)
-                  invalid = NULL;
-                goto setit;
-              }
-          }
+        env->vars[env->count] = v;
 
-#if MK_OS_W32
-        if (streq (v->name, "Path") || streq (v->name, "PATH"))
+        /* If expanding the value can't change it, create the string now.
+           Otherwise it must be expanded for each job.  */
+        if (v->recursive && ((v->origin != o_env && v->origin != o_env_override)
+                             || streq (v->name, MAKEFLAGS_NAME))
+            && (v->append || strchr (v->value, '$') != NULL))
           {
-            if (!cp)
-              cp = xstrdup (value);
-            value = convert_Path_to_windows32 (cp, ';');
-            goto setit;
+            env->envp[env->count] = NULL;
+            env->dynamic = 1;
           }
-#endif
+        else
+          env->envp[env->count] = env_string (v, NULL, invalid);
 
-      setit:
-        *result++ = xstrdup (concat (3, v->name, "=", value));
-        free (cp);
+        ++env->count;
       }
 
   if (!added_SHELL)
-    *result++ = xstrdup (concat (3, shell_var.name, "=", shell_var.value));
+    {
+      env->vars[env->count] = NULL;
+      env->envp[env->count++] = xstrdup (concat (3, shell_var.name, "=",
+                                                 shell_var.value));
+    }
 
   if (!found_makelevel)
     {
       char val[MAKELEVEL_LENGTH + 1 + INTSTR_LENGTH + 1];
       sprintf (val, "%s=%u", MAKELEVEL_NAME, makelevel + 1);
-      *result++ = xstrdup (val);
+      env->vars[env->count] = NULL;
+      env->envp[env->count++] = xstrdup (val);
     }
 
-  *result = NULL;
+  env->envp[env->count] = NULL;
 
   hash_free (&table, 0);
 
+  return env;
+}
+
+/* Create a new environment for FILE's commands.
+   If FILE is nil, this is for the 'shell' function.
+   The child's MAKELEVEL variable is incremented.
+   If recursive is true then we're running a recursive make, else not.
+
+   The exported variables are cached in the variable set list of the first
+   set which contains anything other than automatic variables, so targets
+   with no target-specific variables of their own share their parent's (or
+   the global) environment.  The cache is discarded if any set in the list
+   has changed since it was built.  The result must be freed with
+   free_target_environment().  */
+
+char **
+target_environment (struct file *file, int recursive)
+{
+  struct variable_set_list *set_list;
+  struct env_cache *env;
+  const char *invalid = NULL;
+  char **result;
+  unsigned int i;
+  int local = 1;
+
+  /* We need to update makeflags if (a) we're not recurive, (b) jobserver_auth
+     is enabled, and (c) we need to add invalidation.  */
+  if (!recursive && jobserver_auth)
+    invalid = jobserver_get_invalid_auth ();
+
+  /* If file is NULL we're creating the target environment for $(shell ...)
+     Remember this so we can just ignore recursion.  Since this can run at
+     any time during parsing, don't bother caching it.  */
+  if (!file)
+    {
+      ++env_recursion;
+      env = build_env_cache (current_variable_set_list, 1, invalid);
+      env->detached = 1;
+    }
+  else
+    {
+      /* Skip sets which can't contribute anything.  */
+      set_list = file->variables;
+      while (set_list->next != 0 && only_automatic_vars (set_list->set))
+        {
+          set_list = set_list->next;
+          local = 0;
+        }
+
+      env = set_list->env;
+      if (!env || !env_cache_valid (env, set_list, local, invalid))
+        {
+          discard_env_cache (set_list);
+          env = build_env_cache (set_list, local, invalid);
+
+          /* Names which can't be exported normally, such as those of
+             automatic variables, might have been overridden by a set we
+             skipped: if we find any, start again without skipping.  */
+          for (i = 0; i < env->count; ++i)
+            if (env->vars[i] && !env->vars[i]->exportable)
+              break;
+
+          if (i == env->count)
+            set_list->env = env;
+          else
+            {
+              free_env_cache (env);
+              env = build_env_cache (file->variables, 1, invalid);
+              env->detached = 1;
+            }
+        }
+
+      /* If nothing needs to be expanded, share the vector.  */
+      if (!env->dynamic && !env->detached)
+        {
+          if (env->refs++ == 0)
+            {
+              env->next = shared_envs;
+              shared_envs = env;
+            }
+          return env->envp;
+        }
+    }
+
+  result = xmalloc ((env->count + 1) * sizeof (char *));
+  for (i = 0; i < env->count; ++i)
+    result[i] = (env->envp[i]
+                 ? xstrdup (env->envp[i])
+                 : env_string (env->vars[i], file, env->invalid));
+  result[i] = NULL;
+
+  if (env->detached)
+    free_env_cache (env);
+
   if (!file)
     --env_recursion;
 
-  return result_0;
+  return result;
 }
-
+
+/* Free an environment returned by target_environment().  */
+
+void
+free_target_environment (char **envp)
+{
+  struct env_cache **envpp;
+  char **ep;
+
+  for (envpp = &shared_envs; *envpp != 0; envpp = &(*envpp)->next)
+    if ((*envpp)->envp == envp)
+      {
+        struct env_cache *env = *envpp;
+
+        if (--env->refs == 0)
+          {
+            *envpp = env->next;
+            if (env->detached)
+              free_env_cache (env);
+          }
+        return;
+      }
+
+  for (ep = envp; *ep != 0; ++ep)
+    free (*ep);
+  free (envp);
+}
+
+/* Note that the export settings of some variable have changed, so that
+   all cached environments must be rebuilt.  */
+
+void
+variable_exports_changed ()
+{
+  exports_generation = ++variable_generation;
+}
+
 static struct variable *
 set_special_var (struct variable *var, enum variable_origin origin)
 {
@@ -1339,6 +1700,18 @@ set_special_var (struct variable *var, enum variable_origin origin)
       free (actions);
     }
 
+  else if (lazy_variables)
+    {
+      /* A lazy variable was redefined before it was used: forget about the
+         function that would have computed its value.  */
+      struct lazy_variable *lv = take_lazy_variable (var->name);
+      if (lv)
+        {
+          free (lv);
+          var->special = 0;
+        }
+    }
+
   return var;
 }
 
@@ -1357,7 +1730,7 @@ shell_result (const char *p)
 
   args[0] = (char *) p;
   args[1] = NULL;
-  func_shell_base (variable_buffer, args, 0);
+  func_shell_base (variable_buffer, args, NULL, 0);
 
   return swap_variable_buffer (buf, len);
 }
@@ -2086,6 +2459,69 @@ print_variable_data_base (void)
 }
 
 
+/* Count the memory used by variables, for --memory-stats.  */
+
+struct variable_usage
+  {
+    unsigned long count;
+    unsigned long bytes;
+  };
+
+static unsigned long
+variable_memory_size (const struct variable *v)
+{
+  unsigned long bytes = strlen (v->value) + 1;
+
+  if (!v->name_cached)
+    bytes += v->length + 1;
+
+  return bytes;
+}
+
+static void
+add_variable_usage (const void *item, void *arg)
+{
+  struct variable_usage *u = arg;
+
+  ++u->count;
+  u->bytes += sizeof (struct variable)
+              + variable_memory_size ((const struct variable *) item);
+}
+
+/* Return the number of bytes used by SET and its variables, and add the
+   number of variables to *COUNT.  */
+
+unsigned long
+variable_set_memory_size (struct variable_set *set, unsigned long *count)
+{
+  struct variable_usage u = { 0, 0 };
+
+  hash_map_arg (&set->table, add_variable_usage, &u);
+  *count += u.count;
+
+  return u.bytes + sizeof (struct variable_set)
+         + sizeof (struct variable_set_list) + hash_memory_size (&set->table);
+}
+
+void
+print_variable_memory_stats (void)
+{
+  unsigned long count = 0;
+  unsigned long bytes = variable_set_memory_size (&global_variable_set, &count);
+  struct pattern_var *p;
+
+  print_memory_usage (_("global variables"), count, bytes);
+
+  count = bytes = 0;
+  for (p = pattern_vars; p != 0; p = p->next)
+    {
+      ++count;
+      bytes += sizeof (struct pattern_var) + variable_memory_size (&p->variable);
+    }
+  print_memory_usage (_("pattern variables"), count, bytes);
+}
+
+
 /* Print all the local variables of FILE.  */
 
 void
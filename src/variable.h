@@ -82,6 +82,7 @@ struct variable
     unsigned int expanding:1;   /* Nonzero if currently being expanded.  */
     unsigned int private_var:1; /* Nonzero avoids inheritance of this
                                    target-specific variable.  */
+    unsigned int name_cached:1; /* Nonzero if name is in the strcache.  */
     unsigned int exp_count:EXP_COUNT_BITS;
                                 /* If >1, allow this many self-referential
                                    expansions.  */
@@ -98,15 +99,19 @@ struct variable
 struct variable_set
   {
     struct hash_table table;    /* Hash table of variables.  */
+    unsigned long generation;   /* Changes when a variable is (re)defined.  */
   };
 
 /* Structure that represents a list of variable sets.  */
 
+struct env_cache;
+
 struct variable_set_list
   {
     struct variable_set_list *next;     /* Link in the chain.  */
     struct variable_set *set;           /* Variable set.  */
     int next_is_parent;                 /* True if next is a parent target.  */
+    struct env_cache *env;              /* Environment for this chain.  */
   };
 
 /* Structure used for pattern-specific variables.  */
@@ -132,6 +137,7 @@ char *variable_buffer_output (char *ptr, const char *string, size_t length);
 void install_variable_buffer (char **bufp, size_t *lenp);
 void restore_variable_buffer (char *buf, size_t len);
 char *swap_variable_buffer (char *buf, size_t len);
+void print_expand_memory_stats (void);
 
 char *expand_string_buf (char *buf, const char *string, size_t length);
 #define expand_string(s) expand_string_buf (NULL, (s), SIZE_MAX)
@@ -158,7 +164,8 @@ char *patsubst_expand_pat (char *o, const char *text, const char *pattern,
                            const char *replace, const char *pattern_percent,
                            const char *replace_percent);
 char *patsubst_expand (char *o, const char *text, char *pattern, char *replace);
-char *func_shell_base (char *o, char **argv, int trim_newlines);
+char *func_shell_base (char *o, char **argv, const char *inputs,
+                       int trim_newlines);
 void shell_completed (int exit_code, int exit_sig);
 
 /* variable.c */
@@ -171,6 +178,9 @@ void restore_file_context (struct variable_set_list *oldlist, const floc *oldflo
 void define_automatic_variables (void);
 void initialize_file_variables (struct file *file, int reading);
 void print_file_variables (const struct file *file);
+unsigned long variable_set_memory_size (struct variable_set *set,
+                                        unsigned long *count);
+void print_variable_memory_stats (void);
 void print_target_variables (const struct file *file);
 void merge_variable_set_lists (struct variable_set_list **to_list,
                                struct variable_set_list *from_list);
@@ -235,6 +245,9 @@ void reset_env_override (void);
 #define define_variable_for_file(n,l,v,o,r,f) \
           define_variable_in_set((n),(l),(v),(o),(r),(f)->variables->set,NILF)
 
+void define_lazy_variable (const char *name, gmk_var_ptr func, int recursive,
+                           const floc *flocp);
+
 void undefine_variable_in_set (const floc *flocp,
                                const char *name, size_t length,
                                enum variable_origin origin,
@@ -246,6 +259,8 @@ void undefine_variable_in_set (const floc *flocp,
           undefine_variable_in_set((f),(n),(l),(o),NULL)
 
 char **target_environment (struct file *file, int recursive);
+void free_target_environment (char **envp);
+void variable_exports_changed (void);
 
 struct pattern_var *create_pattern_var (const char *target,
                                         const char *suffix);